@@ -0,0 +1,226 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <obs/obs-module.h>
+#include <gst/gst.h>
+
+// One event loop thread for the whole plugin. It owns the bus watches and
+// restart timeouts of every source, which only need to run briefly now and
+// then, instead of every source running a thread of its own. Work that may
+// block, tearing pipelines down mostly, goes to a worker thread of its own
+// so that it never holds the dispatcher up.
+
+typedef struct {
+	const char *name;
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+} event_loop_t;
+
+static GMutex mutex;
+static event_loop_t dispatcher = {.name = "GStreamer Dispatcher"};
+static event_loop_t worker = {.name = "GStreamer Worker"};
+
+static gpointer event_loop_thread(gpointer user_data)
+{
+	event_loop_t *event_loop = user_data;
+
+	g_main_context_push_thread_default(event_loop->context);
+
+	g_main_loop_run(event_loop->loop);
+
+	g_main_context_pop_thread_default(event_loop->context);
+
+	return NULL;
+}
+
+static GMainContext *event_loop_get_context(event_loop_t *event_loop)
+{
+	g_mutex_lock(&mutex);
+
+	if (event_loop->thread == NULL) {
+		event_loop->context = g_main_context_new();
+		event_loop->loop = g_main_loop_new(event_loop->context, FALSE);
+		event_loop->thread = g_thread_new(
+			event_loop->name, event_loop_thread, event_loop);
+	}
+
+	g_mutex_unlock(&mutex);
+
+	return event_loop->context;
+}
+
+// The context is the thread default context of the dispatcher thread, so
+// bus watches and timeouts added from dispatched functions end up there.
+GMainContext *gstreamer_dispatcher_get_context(void)
+{
+	return event_loop_get_context(&dispatcher);
+}
+
+void gstreamer_dispatcher_invoke(GSourceFunc func, gpointer user_data)
+{
+	g_main_context_invoke(gstreamer_dispatcher_get_context(), func,
+			      user_data);
+}
+
+typedef struct {
+	GSourceFunc func;
+	gpointer user_data;
+	GMutex mutex;
+	GCond cond;
+	gboolean done;
+} call_t;
+
+static gboolean call_sync(gpointer user_data)
+{
+	call_t *call = user_data;
+
+	call->func(call->user_data);
+
+	g_mutex_lock(&call->mutex);
+	call->done = TRUE;
+	g_cond_signal(&call->cond);
+	g_mutex_unlock(&call->mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void invoke_sync(GMainContext *ctx, GSourceFunc func,
+			gpointer user_data)
+{
+	if (g_main_context_is_owner(ctx)) {
+		func(user_data);
+		return;
+	}
+
+	call_t call = {
+		.func = func,
+		.user_data = user_data,
+	};
+
+	g_mutex_init(&call.mutex);
+	g_cond_init(&call.cond);
+
+	g_main_context_invoke(ctx, call_sync, &call);
+
+	g_mutex_lock(&call.mutex);
+	while (!call.done)
+		g_cond_wait(&call.cond, &call.mutex);
+	g_mutex_unlock(&call.mutex);
+
+	g_mutex_clear(&call.mutex);
+	g_cond_clear(&call.cond);
+}
+
+// Runs 'func' on the dispatcher thread and waits for it to return.
+void gstreamer_dispatcher_invoke_sync(GSourceFunc func, gpointer user_data)
+{
+	invoke_sync(gstreamer_dispatcher_get_context(), func, user_data);
+}
+
+// Runs 'func' on the worker thread, after the work queued before it.
+void gstreamer_worker_invoke(GSourceFunc func, gpointer user_data)
+{
+	g_main_context_invoke(event_loop_get_context(&worker), func,
+			      user_data);
+}
+
+typedef struct {
+	GSourceFunc func;
+	gpointer user_data;
+} then_t;
+
+static gboolean then_dispatch(gpointer user_data)
+{
+	then_t *then = user_data;
+
+	gstreamer_dispatcher_invoke(then->func, then->user_data);
+	g_free(then);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Runs 'func' on the dispatcher thread once the work queued on the worker
+// so far is done.
+void gstreamer_worker_then(GSourceFunc func, gpointer user_data)
+{
+	then_t *then = g_new0(then_t, 1);
+
+	then->func = func;
+	then->user_data = user_data;
+
+	gstreamer_worker_invoke(then_dispatch, then);
+}
+
+static gboolean nothing(gpointer user_data)
+{
+	return G_SOURCE_REMOVE;
+}
+
+// Waits for the work queued on the worker so far. Not to be called from the
+// dispatcher thread, which is never to wait for the worker.
+void gstreamer_worker_drain(void)
+{
+	invoke_sync(event_loop_get_context(&worker), nothing, NULL);
+}
+
+static gboolean dispose(gpointer user_data)
+{
+	GstElement *element = user_data;
+
+	gst_element_set_state(element, GST_STATE_NULL);
+	gst_object_unref(element);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Stops 'element' and drops the reference passed in, on the worker thread.
+void gstreamer_worker_dispose(GstElement *element)
+{
+	gstreamer_worker_invoke(dispose, element);
+}
+
+static void event_loop_shutdown(event_loop_t *event_loop)
+{
+	g_mutex_lock(&mutex);
+
+	if (event_loop->thread != NULL) {
+		g_main_loop_quit(event_loop->loop);
+		g_thread_join(event_loop->thread);
+
+		g_main_loop_unref(event_loop->loop);
+		g_main_context_unref(event_loop->context);
+
+		event_loop->thread = NULL;
+		event_loop->loop = NULL;
+		event_loop->context = NULL;
+	}
+
+	g_mutex_unlock(&mutex);
+}
+
+void gstreamer_dispatcher_shutdown(void)
+{
+	// What is left for the worker may still hand over to the dispatcher
+	if (worker.thread != NULL)
+		gstreamer_worker_drain();
+	event_loop_shutdown(&worker);
+	event_loop_shutdown(&dispatcher);
+}
@@ -22,6 +22,17 @@
 #include <gst/gst.h>
 #include <gst/app/app.h>
 
+// Typed copy of the encoder settings, built once on create so that
+// gstreamer_encoder_encode() does not need any obs_data_t lookups.
+typedef struct {
+	gchar *encoder_type;
+	gint bitrate;
+	gboolean is_cbr;
+	gint keyint_sec;
+	gchar *extra_options;
+	gboolean force_copy;
+} settings_t;
+
 typedef struct {
 	GstElement *pipe;
 	GstElement *appsrc;
@@ -33,9 +44,38 @@ typedef struct {
 	GstMapInfo info;
 	obs_encoder_t *encoder;
 	obs_data_t *settings;
+	settings_t *snapshot;
 	struct obs_video_info ovi;
 } data_t;
 
+static settings_t *settings_new(obs_data_t *settings)
+{
+	settings_t *snapshot = g_new0(settings_t, 1);
+
+	snapshot->encoder_type =
+		g_strdup(obs_data_get_string(settings, "encoder_type"));
+	snapshot->bitrate = obs_data_get_int(settings, "bitrate");
+	snapshot->is_cbr =
+		g_strcmp0(obs_data_get_string(settings, "rate_control"),
+			  "CBR") == 0;
+	snapshot->keyint_sec = obs_data_get_int(settings, "keyint_sec");
+	snapshot->extra_options =
+		g_strdup(obs_data_get_string(settings, "extra_options"));
+	snapshot->force_copy = obs_data_get_bool(settings, "force_copy");
+
+	return snapshot;
+}
+
+static void settings_free(settings_t *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	g_free(snapshot->encoder_type);
+	g_free(snapshot->extra_options);
+	g_free(snapshot);
+}
+
 const char *gstreamer_encoder_get_name(void *type_data)
 {
 	return "GStreamer Encoder";
@@ -50,6 +90,9 @@ void *gstreamer_encoder_create(obs_data_t *settings, obs_encoder_t *encoder)
 	data->encoder = encoder;
 	data->settings = settings;
 
+	settings_t *snapshot = settings_new(settings);
+	g_atomic_pointer_set(&data->snapshot, snapshot);
+
 	obs_get_video_info(&data->ovi);
 
 	switch (data->ovi.output_format) {
@@ -108,56 +151,50 @@ void *gstreamer_encoder_create(obs_data_t *settings, obs_encoder_t *encoder)
 		return NULL;
 	}
 
-	const gchar *encoder_type =
-		obs_data_get_string(data->settings, "encoder_type");
-
-	const gboolean is_cbr =
-		g_strcmp0(obs_data_get_string(data->settings, "rate_control"),
-			  "CBR") == 0
-			? true
-			: false;
+	const gchar *encoder_type = snapshot->encoder_type;
+	const gboolean is_cbr = snapshot->is_cbr;
 
 	gchar *encoder_string = "";
 	if (g_strcmp0(encoder_type, "x264") == 0) {
 		encoder_string = g_strdup_printf(
 			"x264enc tune=zerolatency bitrate=%d pass=%s key-int-max=%d",
-			(int)obs_data_get_int(data->settings, "bitrate"),
+			snapshot->bitrate,
 			is_cbr ? "cbr" : "pass1",
-			(int)obs_data_get_int(data->settings, "keyint_sec") *
+			snapshot->keyint_sec *
 				data->ovi.fps_num / data->ovi.fps_den);
 	} else if (g_strcmp0(encoder_type, "nvh264enc") == 0) {
 		encoder_string = g_strdup_printf(
 			"nvh264enc bitrate=%d rc-mode=%s gop-size=%d",
-			(int)obs_data_get_int(data->settings, "bitrate"),
+			snapshot->bitrate,
 			is_cbr ? "cbr" : "vbr",
-			(int)obs_data_get_int(data->settings, "keyint_sec") *
+			snapshot->keyint_sec *
 				data->ovi.fps_num / data->ovi.fps_den);
 	} else if (g_strcmp0(encoder_type, "vaapih264enc") == 0) {
 		encoder_string = g_strdup_printf(
 			"vaapih264enc bitrate=%d rate-control=%s keyframe-period=%d",
-			(int)obs_data_get_int(data->settings, "bitrate"),
+			snapshot->bitrate,
 			is_cbr ? "cbr" : "vbr",
-			(int)obs_data_get_int(data->settings, "keyint_sec") *
+			snapshot->keyint_sec *
 				data->ovi.fps_num / data->ovi.fps_den);
 	} else if (g_strcmp0(encoder_type, "omxh264enc") == 0) {
 		encoder_string = g_strdup_printf(
 			"omxh264enc target-bitrate=%d control-rate=%s periodicity-idr=%d",
-			(int)obs_data_get_int(data->settings, "bitrate") * 1000,
+			snapshot->bitrate * 1000,
 			is_cbr ? "constant" : "variable",
-			(int)obs_data_get_int(data->settings, "keyint_sec") *
+			snapshot->keyint_sec *
 				data->ovi.fps_num / data->ovi.fps_den);
 	} else if (g_strcmp0(encoder_type, "omxh264enc_old") == 0) {
 		encoder_string = g_strdup_printf(
 			"omxh264enc bitrate=%d control-rate=%s iframeinterval=%d",
-			(int)obs_data_get_int(data->settings, "bitrate") * 1000,
+			snapshot->bitrate * 1000,
 			is_cbr ? "constant" : "variable",
-			(int)obs_data_get_int(data->settings, "keyint_sec") *
+			snapshot->keyint_sec *
 				data->ovi.fps_num / data->ovi.fps_den);
 	} else if (g_strcmp0(encoder_type, "vtenc_h264") == 0) {
 		encoder_string = g_strdup_printf(
 			"vtenc_h264 bitrate=%d max-keyframe-interval=%d",
-			(int)obs_data_get_int(data->settings, "bitrate"),
-			(int)obs_data_get_int(data->settings, "keyint_sec") *
+			snapshot->bitrate,
+			snapshot->keyint_sec *
 				data->ovi.fps_num / data->ovi.fps_den);
 	} else {
 		blog(LOG_ERROR, "invalid encoder selected");
@@ -168,7 +205,7 @@ void *gstreamer_encoder_create(obs_data_t *settings, obs_encoder_t *encoder)
 		"appsrc name=appsrc ! video/x-raw, format=%s, width=%d, height=%d, framerate=%d/%d, interlace-mode=progressive ! videoconvert ! %s name=video_encoder  %s ! h264parse ! video/x-h264, stream-format=byte-stream, alignment=au ! appsink sync=false name=appsink",
 		format, data->ovi.output_width, data->ovi.output_height,
 		data->ovi.fps_num, data->ovi.fps_den, encoder_string,
-		obs_data_get_string(data->settings, "extra_options"));
+		snapshot->extra_options);
 
 	GError *err = NULL;
 
@@ -210,6 +247,8 @@ void gstreamer_encoder_destroy(void *p)
 		gst_sample_unref(data->sample);
 	}
 
+	settings_free(data->snapshot);
+
 	g_free(data->codec_data);
 	g_free(data);
 }
@@ -228,9 +267,10 @@ bool gstreamer_encoder_encode(void *p, struct encoder_frame *frame,
 		data->sample = NULL;
 	}
 
+	const settings_t *settings = g_atomic_pointer_get(&data->snapshot);
 	GstBuffer *buffer;
 
-	if (obs_data_get_bool(data->settings, "force_copy") == true) {
+	if (settings->force_copy == true) {
 		buffer = gst_buffer_new_allocate(NULL, data->buffer_size, NULL);
 
 		gint32 offset = 0;
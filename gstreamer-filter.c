@@ -24,6 +24,11 @@
 #include <gst/audio/audio.h>
 #include <gst/app/app.h>
 
+// Typed copy of the filter settings, rebuilt on create and update.
+typedef struct {
+	gchar *pipeline;
+} settings_t;
+
 typedef struct {
 	GstElement *pipe;
 	GstElement *appsrc;
@@ -32,8 +37,59 @@ typedef struct {
 	GstAudioInfo audio_info;
 	obs_source_t *source;
 	obs_data_t *settings;
+	// The latest settings, see settings_acquire()
+	settings_t *snapshot;
+	GMutex snapshot_mutex;
 } data_t;
 
+static settings_t *settings_new(obs_data_t *settings)
+{
+	settings_t *snapshot = g_atomic_rc_box_new0(settings_t);
+
+	snapshot->pipeline =
+		g_strdup(obs_data_get_string(settings, "pipeline"));
+
+	return snapshot;
+}
+
+static void settings_clear(gpointer user_data)
+{
+	settings_t *snapshot = user_data;
+
+	g_free(snapshot->pipeline);
+}
+
+// Snapshots are reference counted. The filter callbacks run on the OBS
+// video and audio threads, they take the latest one with settings_acquire()
+// and give it back with settings_release(), so that a snapshot replaced
+// meanwhile lives on until its last reader is done.
+static const settings_t *settings_acquire(data_t *data)
+{
+	g_mutex_lock(&data->snapshot_mutex);
+	const settings_t *snapshot = g_atomic_rc_box_acquire(data->snapshot);
+	g_mutex_unlock(&data->snapshot_mutex);
+
+	return snapshot;
+}
+
+static void settings_release(const settings_t *snapshot)
+{
+	g_atomic_rc_box_release_full((gpointer)snapshot, settings_clear);
+}
+
+static void publish_settings(data_t *data, obs_data_t *settings)
+{
+	settings_t *snapshot = settings_new(settings);
+
+	g_mutex_lock(&data->snapshot_mutex);
+	settings_t *old = data->snapshot;
+	data->snapshot = snapshot;
+	g_mutex_unlock(&data->snapshot_mutex);
+
+	if (old)
+		settings_release(old);
+}
+
 const char *gstreamer_filter_get_name_video(void *type_data)
 {
 	return "GStreamer Filter (Video)";
@@ -51,6 +107,9 @@ void *gstreamer_filter_create(obs_data_t *settings, obs_source_t *source)
 	data->source = source;
 	data->settings = settings;
 
+	g_mutex_init(&data->snapshot_mutex);
+	publish_settings(data, settings);
+
 	return data;
 }
 
@@ -66,6 +125,9 @@ void gstreamer_filter_destroy(void *p)
 		gst_object_unref(data->pipe);
 	}
 
+	settings_release(data->snapshot);
+	g_mutex_clear(&data->snapshot_mutex);
+
 	g_free(data);
 }
 
@@ -111,6 +173,8 @@ void gstreamer_filter_update(void *p, obs_data_t *settings)
 {
 	data_t *data = (data_t *)p;
 
+	publish_settings(data, settings);
+
 	if (data->pipe != NULL) {
 		gst_element_set_state(data->pipe, GST_STATE_NULL);
 
@@ -174,12 +238,14 @@ gstreamer_filter_filter_video(void *p, struct obs_source_frame *frame)
 			break;
 		}
 
+		const settings_t *settings = settings_acquire(data);
 		gchar *str = g_strdup_printf(
 			"appsrc name=appsrc format=time ! video/x-raw, width=%d, height=%d, format=%s, framerate=0/1 ! videoconvert ! "
 			"%s ! videoconvert ! video/x-raw, width=%d, height=%d, format=%s, framerate=0/1 ! appsink name=appsink sync=false",
 			frame->width, frame->height, format,
-			obs_data_get_string(data->settings, "pipeline"),
+			settings->pipeline,
 			frame->width, frame->height, format);
+		settings_release(settings);
 		data->pipe = gst_parse_launch(str, &err);
 		g_free(str);
 		if (err != NULL) {
@@ -244,12 +310,14 @@ gstreamer_filter_filter_audio(void *p, struct obs_audio_data *audio_data)
 					  audio_info.speakers, NULL);
 		data->audio_info.layout = GST_AUDIO_LAYOUT_NON_INTERLEAVED;
 
+		const settings_t *settings = settings_acquire(data);
 		gchar *str = g_strdup_printf(
 			"appsrc name=appsrc format=time ! audio/x-raw, rate=%d, channels=%d, format=F32LE, layout=non-interleaved ! audioconvert ! "
 			"%s ! audioconvert ! audio/x-raw, rate=%d, channels=%d, format=F32LE, layout=non-interleaved ! appsink name=appsink sync=false",
 			data->audio_info.rate, data->audio_info.channels,
-			obs_data_get_string(data->settings, "pipeline"),
+			settings->pipeline,
 			data->audio_info.rate, data->audio_info.channels);
+		settings_release(settings);
 		data->pipe = gst_parse_launch(str, &err);
 		g_free(str);
 		if (err != NULL) {
@@ -22,14 +22,50 @@
 #include <gst/gst.h>
 #include <gst/app/app.h>
 
+// Typed copy of the output settings, rebuilt on create and update.
+typedef struct {
+	gchar *pipeline;
+} settings_t;
+
 typedef struct {
 	GstElement *pipe;
 	GstElement *video;
 	GstElement *audio;
 	obs_output_t *output;
 	obs_data_t *settings;
+	settings_t *snapshot;
 } data_t;
 
+static settings_t *settings_new(obs_data_t *settings)
+{
+	settings_t *snapshot = g_new0(settings_t, 1);
+
+	snapshot->pipeline =
+		g_strdup(obs_data_get_string(settings, "pipeline"));
+
+	return snapshot;
+}
+
+static void settings_free(settings_t *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	g_free(snapshot->pipeline);
+	g_free(snapshot);
+}
+
+// The snapshot is only read while starting the output, which OBS never runs
+// concurrently with an update, so the previous one can go right away.
+static void publish_settings(data_t *data, obs_data_t *settings)
+{
+	settings_t *old = g_atomic_pointer_get(&data->snapshot);
+
+	g_atomic_pointer_set(&data->snapshot, settings_new(settings));
+
+	settings_free(old);
+}
+
 const char *gstreamer_output_get_name(void *type_data)
 {
 	return "GStreamer Output";
@@ -42,17 +78,29 @@ void *gstreamer_output_create(obs_data_t *settings, obs_output_t *output)
 	data->output = output;
 	data->settings = settings;
 
+	publish_settings(data, settings);
+
 	return data;
 }
 
-void gstreamer_output_destroy(void *data)
+void gstreamer_output_destroy(void *p)
 {
+	data_t *data = (data_t *)p;
+
+	settings_free(data->snapshot);
+
 	g_free(data);
 }
 
+void gstreamer_output_update(void *p, obs_data_t *settings)
+{
+	publish_settings((data_t *)p, settings);
+}
+
 bool gstreamer_output_start(void *p)
 {
 	data_t *data = (data_t *)p;
+	const settings_t *settings = g_atomic_pointer_get(&data->snapshot);
 
 	struct obs_video_info ovi;
 	obs_get_video_info(&ovi);
@@ -67,15 +115,15 @@ bool gstreamer_output_start(void *p)
 		"appsrc name=appsrc_audio ! audio/mpeg, mpegversion=4, stream-format=raw, rate=%d, channels=%d, codec_data=(buffer)1190 ! aacparse name=audio "
 		"%s",
 		ovi.output_width, ovi.output_height, oai.samples_per_sec,
-		oai.speakers, obs_data_get_string(data->settings, "pipeline"));
+		oai.speakers, settings->pipeline);
 
 	data->pipe = gst_parse_launch(pipe, &err);
 	g_free(pipe);
 	if (err) {
+		blog(LOG_ERROR, "%s", err->message);
 		g_error_free(err);
-		g_free(data);
 
-		return NULL;
+		return false;
 	}
 
 	data->video = gst_bin_get_by_name(GST_BIN(data->pipe), "appsrc_video");
@@ -31,12 +31,13 @@ typedef struct {
 	gint64 frame_count;
 	gint64 audio_count;
 	GSource *timeout;
-	GThread *thread;
-	GMainLoop *loop;
-	GMutex mutex;
-	GCond cond;
+	gboolean running;
 } data_t;
 
+// gstreamer-dispatcher.c
+extern void gstreamer_dispatcher_invoke_sync(GSourceFunc func,
+					     gpointer user_data);
+
 static void create_pipeline(data_t *data);
 
 static void timeout_destroy(gpointer user_data)
@@ -300,10 +301,6 @@ static gboolean loop_startup(gpointer user_data)
 
 	create_pipeline(data);
 
-	g_mutex_lock(&data->mutex);
-	g_cond_signal(&data->cond);
-	g_mutex_unlock(&data->mutex);
-
 	if (data->pipe)
 		gst_element_set_state(data->pipe, GST_STATE_PLAYING);
 
@@ -390,21 +387,12 @@ static void create_pipeline(data_t *data)
 	gst_object_unref(bus);
 }
 
-static gpointer _start(gpointer user_data)
+static gboolean loop_teardown(gpointer user_data)
 {
 	data_t *data = user_data;
 
-	GMainContext *context = g_main_context_new();
-
-	g_main_context_push_thread_default(context);
-
-	data->loop = g_main_loop_new(context, FALSE);
-
-	GSource *source = g_idle_source_new();
-	g_source_set_callback(source, loop_startup, data, NULL);
-	g_source_attach(source, context);
-
-	g_main_loop_run(data->loop);
+	if (data->timeout != NULL)
+		g_source_destroy(data->timeout);
 
 	if (data->pipe != NULL) {
 		gst_element_set_state(data->pipe, GST_STATE_NULL);
@@ -417,22 +405,13 @@ static gpointer _start(gpointer user_data)
 		data->pipe = NULL;
 	}
 
-	g_main_loop_unref(data->loop);
-	data->loop = NULL;
-
-	g_main_context_unref(context);
-
-	return NULL;
+	return G_SOURCE_REMOVE;
 }
 
 static void start(data_t *data)
 {
-	g_mutex_lock(&data->mutex);
-
-	data->thread = g_thread_new("GStreamer Source", _start, data);
-
-	g_cond_wait(&data->cond, &data->mutex);
-	g_mutex_unlock(&data->mutex);
+	gstreamer_dispatcher_invoke_sync(loop_startup, data);
+	data->running = TRUE;
 }
 
 void *gstreamer_source_create(obs_data_t *settings, obs_source_t *source)
@@ -442,9 +421,6 @@ void *gstreamer_source_create(obs_data_t *settings, obs_source_t *source)
 	data->source = source;
 	data->settings = settings;
 
-	g_mutex_init(&data->mutex);
-	g_cond_init(&data->cond);
-
 	if (obs_data_get_bool(settings, "stop_on_hide") == false)
 		start(data);
 
@@ -453,13 +429,11 @@ void *gstreamer_source_create(obs_data_t *settings, obs_source_t *source)
 
 static void stop(data_t *data)
 {
-	if (data->thread == NULL)
+	if (!data->running)
 		return;
 
-	g_main_loop_quit(data->loop);
-
-	g_thread_join(data->thread);
-	data->thread = NULL;
+	gstreamer_dispatcher_invoke_sync(loop_teardown, data);
+	data->running = FALSE;
 
 	obs_source_output_video(data->source, NULL);
 }
@@ -470,9 +444,6 @@ void gstreamer_source_destroy(void *user_data)
 
 	stop(data);
 
-	g_mutex_clear(&data->mutex);
-	g_cond_clear(&data->cond);
-
 	g_free(data);
 }
 
@@ -572,8 +543,10 @@ void gstreamer_source_update(void *data, obs_data_t *settings)
 
 void gstreamer_source_show(void *data)
 {
-	if (((data_t *)data)->pipe == NULL)
+	if (((data_t *)data)->pipe == NULL) {
+		stop(data);
 		start(data);
+	}
 }
 
 void gstreamer_source_hide(void *data)
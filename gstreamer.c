@@ -35,6 +35,13 @@ extern obs_properties_t *gstreamer_source_get_properties(void *data);
 extern void gstreamer_source_update(void *data, obs_data_t *settings);
 extern void gstreamer_source_show(void *data);
 extern void gstreamer_source_hide(void *data);
+extern void gstreamer_source_video_tick(void *data, float seconds);
+
+// streaminsync-clock.c
+extern void streaminsync_clock_cleanup(void);
+
+// gstreamer-dispatcher.c
+extern void gstreamer_dispatcher_shutdown(void);
 
 // gstreamer-encoder.c
 extern const char *gstreamer_encoder_get_name(void *type_data);
@@ -69,6 +76,7 @@ extern const char *gstreamer_output_get_name(void *type_data);
 extern void *gstreamer_output_create(obs_data_t *settings,
 				     obs_output_t *output);
 extern void gstreamer_output_destroy(void *data);
+extern void gstreamer_output_update(void *data, obs_data_t *settings);
 extern bool gstreamer_output_start(void *data);
 extern void gstreamer_output_stop(void *data, uint64_t ts);
 extern void gstreamer_output_encoded_packet(void *data,
@@ -95,6 +103,7 @@ bool obs_module_load(void)
 		.update = gstreamer_source_update,
 		.show = gstreamer_source_show,
 		.hide = gstreamer_source_hide,
+		.video_tick = gstreamer_source_video_tick,
 	};
 
 	obs_register_source(&source_info);
@@ -163,6 +172,7 @@ bool obs_module_load(void)
 		.destroy = gstreamer_output_destroy,
 		.start = gstreamer_output_start,
 		.stop = gstreamer_output_stop,
+		.update = gstreamer_output_update,
 
 		.encoded_packet = gstreamer_output_encoded_packet,
 
@@ -176,3 +186,10 @@ bool obs_module_load(void)
 
 	return true;
 }
+
+void obs_module_unload(void)
+{
+	// Clocks stop watching their statistics on the dispatcher thread
+	streaminsync_clock_cleanup();
+	gstreamer_dispatcher_shutdown();
+}
@@ -0,0 +1,271 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Bandwidth estimation from the receiver's TWCC feedback, a simplified take
+// on Google congestion control. The delay-based part backs off as soon as
+// queues build up along the path, the loss-based part covers links that drop
+// rather than queue. The estimate grows slowly while neither complains and
+// the encoders actually use what they are given. With several receivers
+// each path is estimated on its own and the encoders, which all of them
+// share, get what the narrowest one takes.
+
+#include <gst/rtp/rtp.h>
+
+#include "bwe.h"
+
+// Average growth of the queuing delay between two packets, in us, above
+// which the path counts as overused
+#define OVERUSE_US 500
+// Share of the received rate to fall back to on overuse
+#define BACKOFF 0.85
+// Growth of the estimate per update while the path is fine
+#define INCREASE 1.05
+// Loss, in percent, above which the estimate is cut and below which it may
+// grow again. FEC and retransmissions take care of what is in between.
+#define LOSS_HIGH 10.0
+#define LOSS_LOW 2.0
+// Nothing is learnt about the path while the encoders send less than this
+// share of the estimate, it is not raised then
+#define APP_LIMITED 0.5
+
+// The path to one receiver
+typedef struct
+{
+    // The rtpsession element, which gathers the TWCC feedback
+    GstElement *session;
+    // For all media, in kbps
+    gint estimate;
+    // Last feedback seen, to tell new feedback from the same one again
+    guint last_sent;
+    guint last_received;
+    guint last_packets;
+    // What that feedback said
+    gint received_kbps;
+    gdouble loss;
+    gint delay_trend;
+} path_t;
+
+struct bwe
+{
+    // Of path_t, the first one given to bwe_new()
+    GList *paths;
+    GstElement *venc;
+    GstElement *aenc;
+    // Video bitrate bounds, in kbps
+    gint min_kbps;
+    gint max_kbps;
+    // All in kbps, the estimate is that of the narrowest path
+    gint estimate;
+    gint video;
+    gint audio;
+};
+
+// Numbers the packets of 'payloader' transport-wide. Needs GStreamer 1.20.
+bool bwe_add_extension(GstElement *payloader)
+{
+#if GST_CHECK_VERSION(1, 20, 0)
+    GstRTPHeaderExtension *ext = gst_rtp_header_extension_create_from_uri(BWE_TWCC_URI);
+
+    if (ext == NULL)
+        return false;
+
+    gst_rtp_header_extension_set_id(ext, BWE_TWCC_ID);
+    g_signal_emit_by_name(payloader, "add-extension", ext);
+    gst_object_unref(ext);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+static path_t *path_new(GstElement *rtpbin, guint session, gint estimate)
+{
+    GstElement *element = NULL;
+
+    g_signal_emit_by_name(rtpbin, "get-session", session, &element);
+    if (element == NULL)
+        return NULL;
+
+    path_t *path = g_new0(path_t, 1);
+
+    path->session = element;
+    path->estimate = estimate;
+
+    return path;
+}
+
+static void path_free(gpointer user_data)
+{
+    path_t *path = user_data;
+
+    gst_object_unref(path->session);
+    g_free(path);
+}
+
+// Estimates the path of 'session' of 'rtpbin', whose video and audio
+// encoders are 'venc' and 'aenc' (may be NULL). Starts from 'max_kbps', the
+// video bitrate the encoder was set up with.
+bwe_t *bwe_new(GstElement *rtpbin, guint session, GstElement *venc,
+               GstElement *aenc, gint min_kbps, gint max_kbps)
+{
+    path_t *path = path_new(rtpbin, session, max_kbps + BWE_AUDIO_MAX);
+    if (path == NULL)
+        return NULL;
+
+    bwe_t *bwe = g_new0(bwe_t, 1);
+
+    bwe->paths = g_list_append(NULL, path);
+    bwe->venc = gst_object_ref(venc);
+    bwe->aenc = aenc ? gst_object_ref(aenc) : NULL;
+    bwe->min_kbps = MIN(min_kbps, max_kbps);
+    bwe->max_kbps = max_kbps;
+    bwe->video = max_kbps;
+    bwe->audio = BWE_AUDIO_MAX;
+    bwe->estimate = bwe->video + bwe->audio;
+
+    return bwe;
+}
+
+// Estimates the path of 'session' of 'rtpbin' as well, another receiver of
+// the same encoders. False when there is no such session.
+bool bwe_add_path(bwe_t *bwe, GstElement *rtpbin, guint session)
+{
+    path_t *path = path_new(rtpbin, session, bwe->max_kbps + BWE_AUDIO_MAX);
+    if (path == NULL)
+        return false;
+
+    bwe->paths = g_list_append(bwe->paths, path);
+
+    return true;
+}
+
+void bwe_free(bwe_t *bwe)
+{
+    if (bwe == NULL)
+        return;
+
+    g_list_free_full(bwe->paths, path_free);
+    gst_object_unref(bwe->venc);
+    if (bwe->aenc)
+        gst_object_unref(bwe->aenc);
+    g_free(bwe);
+}
+
+// Audio is kept at its best as long as the video can get its minimum, what
+// is left goes to the video. Both encoders take new bitrates while playing.
+static void apply(bwe_t *bwe)
+{
+    const gint audio = CLAMP(bwe->estimate - bwe->min_kbps, BWE_AUDIO_MIN, BWE_AUDIO_MAX);
+    const gint video = CLAMP(bwe->estimate - audio, bwe->min_kbps, bwe->max_kbps);
+
+    if (video != bwe->video)
+        g_object_set(bwe->venc, "bitrate", (guint)video, NULL);
+    if (audio != bwe->audio && bwe->aenc)
+        g_object_set(bwe->aenc, "bitrate", audio * 1000, NULL);
+
+    bwe->video = video;
+    bwe->audio = audio;
+}
+
+// False when there is no new feedback for 'path'
+static bool path_update(bwe_t *bwe, path_t *path)
+{
+    GstStructure *s = NULL;
+    guint sent = 0;
+    guint received = 0;
+    guint packets = 0;
+    gdouble loss = 0.0;
+    gint64 delay_trend = 0;
+
+    g_object_get(path->session, "twcc-stats", &s, NULL);
+    if (s == NULL)
+        return false;
+
+    gst_structure_get_uint(s, "bitrate-sent", &sent);
+    gst_structure_get_uint(s, "bitrate-recv", &received);
+    gst_structure_get_uint(s, "packets-recv", &packets);
+    gst_structure_get_double(s, "packet-loss-pct", &loss);
+    gst_structure_get_int64(s, "avg-delta-of-delta", &delay_trend);
+    gst_structure_free(s);
+
+    if (packets == 0 ||
+        (sent == path->last_sent && received == path->last_received && packets == path->last_packets))
+        return false;
+
+    path->last_sent = sent;
+    path->last_received = received;
+    path->last_packets = packets;
+
+    const gint received_kbps = received / 1000;
+    const gint trend_us = delay_trend / GST_USECOND;
+    gint estimate = path->estimate;
+
+    if (trend_us > OVERUSE_US)
+        estimate = MIN(estimate, received_kbps * BACKOFF);
+    else if (loss > LOSS_HIGH)
+        estimate = estimate * (1.0 - loss / 200.0);
+    else if (loss < LOSS_LOW && trend_us > -OVERUSE_US && sent / 1000 >= estimate * APP_LIMITED)
+        estimate = estimate * INCREASE + 1;
+
+    path->estimate = CLAMP(estimate, bwe->min_kbps + BWE_AUDIO_MIN, bwe->max_kbps + BWE_AUDIO_MAX);
+    path->received_kbps = received_kbps;
+    path->loss = loss;
+    path->delay_trend = trend_us;
+
+    return true;
+}
+
+// Takes in the feedback received since the last call, meant to be called a
+// couple of times a second. Returns false when there was none. The report
+// is that of the narrowest path.
+bool bwe_update(bwe_t *bwe, bwe_report_t *report)
+{
+    bool updated = false;
+    path_t *narrowest = NULL;
+
+    for (GList *l = bwe->paths; l != NULL; l = l->next)
+    {
+        path_t *path = l->data;
+
+        if (path_update(bwe, path))
+            updated = true;
+        if (narrowest == NULL || path->estimate < narrowest->estimate)
+            narrowest = path;
+    }
+
+    if (!updated)
+        return false;
+
+    bwe->estimate = narrowest->estimate;
+    apply(bwe);
+
+    if (report)
+    {
+        report->received_kbps = narrowest->received_kbps;
+        report->loss = narrowest->loss;
+        report->delay_trend = narrowest->delay_trend;
+        report->estimate_kbps = bwe->estimate;
+        report->video_kbps = bwe->video;
+        report->audio_kbps = bwe->audio;
+    }
+
+    return true;
+}
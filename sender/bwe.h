@@ -0,0 +1,62 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BWE_H
+#define BWE_H
+
+#include <gst/gst.h>
+#include <stdbool.h>
+
+// Transport-wide congestion control (TWCC): every video packet carries a
+// transport-wide sequence number in an RTP header extension, the receiver
+// reports when each one arrived and the estimator below turns that into the
+// bitrate the path can take. Same extension id as in streaminsync.h.
+#define BWE_TWCC_URI "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
+#define BWE_TWCC_ID 5
+
+// Opus bitrate bounds, in kbps. Audio keeps its maximum as long as the video
+// can be given its minimum.
+#define BWE_AUDIO_MIN 16
+#define BWE_AUDIO_MAX 64
+
+typedef struct bwe bwe_t;
+
+// What the last update saw and decided
+typedef struct
+{
+    // As the receiver reports it
+    gint received_kbps;
+    gdouble loss;
+    // Average change of the queuing delay between packets, in us
+    gint delay_trend;
+    // The estimate, for all media, and its split
+    gint estimate_kbps;
+    gint video_kbps;
+    gint audio_kbps;
+} bwe_report_t;
+
+bool bwe_add_extension(GstElement *payloader);
+bwe_t *bwe_new(GstElement *rtpbin, guint session, GstElement *venc,
+               GstElement *aenc, gint min_kbps, gint max_kbps);
+bool bwe_add_path(bwe_t *bwe, GstElement *rtpbin, guint session);
+bool bwe_update(bwe_t *bwe, bwe_report_t *report);
+void bwe_free(bwe_t *bwe);
+
+#endif
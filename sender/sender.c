@@ -26,9 +26,12 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <argp.h>
+#include <sys/resource.h>
 
 #include "log.h"
+#include "bwe.h"
 
 extern const char *argp_program_version;
 
@@ -37,11 +40,12 @@ const char *argp_program_bug_address =
 
 /* Program documentation. */
 static char doc[] =
-    "Stream in Sync sender -- a program to send audio and video to a receiver synchronising all those sources";
+    "Stream in Sync sender -- a program to send audio and video to a receiver synchronising all those sources"
+    "\vWith several RECEIVER_IP:PORT the video and audio are encoded once and sent to every receiver, each with RTCP, "
+    "retransmissions and FEC of its own. Congestion control follows the slowest receiver.";
 
 /* A description of the arguments we accept. */
-#define NB_CLI_ARGS 2
-static char args_doc[] = "RECEIVER_IP RECEIVER_PORT";
+static char args_doc[] = "RECEIVER_IP RECEIVER_PORT\nRECEIVER_IP:PORT...";
 
 #define SHORT_VIDEO_SOURCE 'i'
 #define SHORT_AUDIO_SOURCE 'a'
@@ -51,6 +55,19 @@ static char args_doc[] = "RECEIVER_IP RECEIVER_PORT";
 #define SHORT_FRAMERATE 'f'
 #define SHORT_NTP_IP 'n'
 #define SHORT_NTP_PORT 'p'
+#define SHORT_SSRC 's'
+#define SHORT_FEC 'e'
+#define SHORT_BUNDLE 'u'
+#define SHORT_CLOCK 'c'
+#define SHORT_CLOCK_THRESHOLD 't'
+#define SHORT_PTP_DOMAIN 'd'
+#define SHORT_CONGESTION 'g'
+#define SHORT_MIN_BITRATE 'm'
+#define SHORT_THREADS 'j'
+#define SHORT_THREADING 'x'
+#define SHORT_BENCHMARK 'B'
+#define SHORT_PROFILE 'P'
+#define SHORT_LAYERS 'L'
 
 /* The options we understand. */
 static struct argp_option options[] = {
@@ -60,39 +77,252 @@ static struct argp_option options[] = {
     {"width", SHORT_WITDH, "WIDTH", 0, "Video width to use."},
     {"height", SHORT_HEIGHT, "HEIGHT", 0, "Video height to use."},
     {"framerate", SHORT_FRAMERATE, "FPS", 0, "Video framerate to use."},
-    {"ntp-ip", SHORT_NTP_IP, "IP", 0, "IP address of the NTP server."},
-    {"ntp-port", SHORT_NTP_PORT, "PORT", 0, "Port of the NTP server."},
+    {"clock", SHORT_CLOCK, "TYPE", 0, "Clock to slave to: ntp (an NTP server), net (a receiver providing its clock) or ptp."},
+    {"ntp-ip", SHORT_NTP_IP, "IP", 0, "IP address of the NTP server, or of the receiver with --clock net."},
+    {"ntp-port", SHORT_NTP_PORT, "PORT", 0, "Port of the NTP server, or the receiver's clock port with --clock net."},
+    {"ptp-domain", SHORT_PTP_DOMAIN, "DOMAIN", 0, "PTP domain with --clock ptp."},
+    {"clock-threshold", SHORT_CLOCK_THRESHOLD, "USEC", 0, "Clock offset to report the clock synchronised at."},
+    {"ssrc", SHORT_SSRC, "SSRC", 0, "SSRC to send with, used as stream id by a shared receiver (0 = random)."},
+    {"fec", SHORT_FEC, "PERCENT", 0, "ULPFEC protection, FEC packets in percent of the media packets (0 = off)."},
+    {"bundle", SHORT_BUNDLE, 0, 0, "Send audio, video and RTCP over RECEIVER_PORT alone."},
+    {"congestion-control", SHORT_CONGESTION, 0, 0, "Adapt the audio and video bitrates to what the path to the receiver takes, with --vbitrate as the maximum."},
+    {"min-vbitrate", SHORT_MIN_BITRATE, "BITRATE", 0, "Video bitrate congestion control does not go below."},
+    {"threads", SHORT_THREADS, "N", 0, "Video encoder threads (0 = one per core)."},
+    {"threading", SHORT_THREADING, "TYPE", 0, "Video encoder threading: sliced (threads share each frame, no added latency) or frame (threads work on successive frames, more throughput, a frame of latency per thread)."},
+    {"profile", SHORT_PROFILE, "NAME", 0, "Encoding profile: default, or low-latency (no B-frames or lookahead, intra-refresh instead of keyframes, 10 ms audio frames)."},
+    {"layers", SHORT_LAYERS, "N", 0, "Simulcast: send the video N times (1 to 3), each at half the size of the one before and on its own SSRC, for the receivers to pick from."},
+    {"benchmark", SHORT_BENCHMARK, "SECONDS", 0, "Encode SECONDS of test video with each profile and threading configuration as fast as possible, report and exit. Needs no receiver."},
     {0}};
 
 #define NB_PORTS 6
+
+// Receivers one encode can be sent to
+#define MAX_DESTINATIONS 8
+
+enum
+{
+    CLOCK_NTP,
+    CLOCK_NET,
+    CLOCK_PTP,
+};
+
+enum
+{
+    THREADING_SLICED,
+    THREADING_FRAME,
+};
+
+enum
+{
+    PROFILE_DEFAULT,
+    PROFILE_LOW_LATENCY,
+};
+
+static const char *const profile_names[] = {"default", "low-latency"};
+
+// Auto-sized encoder threads stop there. More slices cost compression for
+// little speed, more frame threads latency.
+#define MAX_SLICED_THREADS 8
+#define MAX_FRAME_THREADS 16
+
+// Seconds from the NTP epoch (1900) to the Unix one (1970)
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT(2208988800)
+
+// Payload types, distinct so that both media can be bundled, see
+// streaminsync.h
+#define VIDEO_PT 96
+#define VIDEO_RTX_PT 97
+#define FEC_PT 98
+#define AUDIO_PT 100
+#define AUDIO_RTX_PT 101
+// Simulcast layers, the full size one being layer 0 and each next one half
+// the size of the one before. Layers after the first take the payload types
+// after audio, and with a given SSRC the SSRC plus the layer in the top bits.
+#define MAX_LAYERS 3
+#define LAYER_PT(layer) ((layer) == 0 ? VIDEO_PT : 100 + 2 * (layer))
+#define LAYER_RTX_PT(layer) (LAYER_PT(layer) + 1)
+#define LAYER_SSRC(ssrc, layer) ((guint32)(ssrc) + ((guint32)(layer) << 28))
+// Sent packets kept for retransmission, in ms. Receivers do not ask for
+// packets older than their maximum playout latency.
+#define RTX_HISTORY_MS 1000
+// Loss the Opus in-band FEC is sized for, in percent. Each packet carries a
+// lower quality copy of the previous one that the receiver decodes when that
+// one got lost.
+#define AUDIO_EXPECTED_LOSS 10
+// Time between two looks at the receiver's congestion feedback, in ms
+#define BWE_INTERVAL_MS 500
+// Time between two reports of the encoder latency, in ms
+#define LATENCY_REPORT_MS 10000
+// Frames in flight an encoder latency probe keeps track of
+#define LATENCY_SLOTS 128
+
+// A receiver, each gets an rtpbin of its own
 typedef struct
 {
-    bool restart_on_eos;
-    bool restart_on_error;
-    guint64 restart_timeout;
-    const gchar *clock_ip;
-    gint clock_port;
-    const gchar *receiver_ip;
-    // Used ports, in order:
+    const gchar *ip;
+    // Used ports, in order, only the first one when bundled:
     // 0: video
     // 1: video
     // 2: video
     // 3: audio
     // 4: audio
     // 5: audio
-    gint receiver_ports[NB_PORTS];
+    gint ports[NB_PORTS];
+} destination_t;
+
+typedef struct
+{
+    bool restart_on_eos;
+    bool restart_on_error;
+    guint64 restart_timeout;
+    gint clock_type;
+    const gchar *clock_ip;
+    gint clock_port;
+    gint ptp_domain;
+    gint clock_threshold;
+    destination_t destinations[MAX_DESTINATIONS];
+    gint n_destinations;
     const gchar *videosource;
     const gchar *audiosource;
     gint bitrate;
     gint framerate;
     gint width;
     gint height;
+    guint32 ssrc;
+    gint fec_percentage;
+    bool bundle;
+    bool congestion_control;
+    gint min_bitrate;
+    gint threading;
+    gint threads;
+    gint profile;
+    gint layers;
+    gint benchmark;
 } settings_t;
 
+// Time buffers spend in an encoder, from its sink pad to its source pad. An
+// output buffer is matched with the input buffer holding its first sample or
+// its frame, so that it also works for audio encoders that cut the input
+// into frames of their own.
+typedef struct
+{
+    GMutex mutex;
+    struct
+    {
+        GstClockTime pts;
+        GstClockTime end;
+        gint64 entered;
+    } slots[LATENCY_SLOTS];
+    guint next;
+    gint frames;
+    gint64 total;
+    gint64 max;
+} encoder_latency_t;
+
+static GstPadProbeReturn latency_in_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    encoder_latency_t *latency = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&latency->mutex);
+    latency->slots[latency->next].pts = GST_BUFFER_PTS(buffer);
+    latency->slots[latency->next].end =
+        GST_BUFFER_PTS(buffer) + (GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : 1);
+    latency->slots[latency->next].entered = g_get_monotonic_time();
+    latency->next = (latency->next + 1) % LATENCY_SLOTS;
+    g_mutex_unlock(&latency->mutex);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn latency_out_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    encoder_latency_t *latency = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    const gint64 now = g_get_monotonic_time();
+
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&latency->mutex);
+    for (guint i = 0; i < LATENCY_SLOTS; i++)
+    {
+        if (latency->slots[i].entered && latency->slots[i].pts <= GST_BUFFER_PTS(buffer) &&
+            GST_BUFFER_PTS(buffer) < latency->slots[i].end)
+        {
+            latency->total += now - latency->slots[i].entered;
+            latency->max = MAX(latency->max, now - latency->slots[i].entered);
+            latency->frames++;
+            break;
+        }
+    }
+    g_mutex_unlock(&latency->mutex);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void encoder_latency_free(gpointer data)
+{
+    encoder_latency_t *latency = data;
+
+    g_mutex_clear(&latency->mutex);
+    g_free(latency);
+}
+
+// Measures 'encoder' for as long as it lives
+static encoder_latency_t *encoder_latency_attach(GstElement *encoder)
+{
+    encoder_latency_t *latency = g_new0(encoder_latency_t, 1);
+
+    g_mutex_init(&latency->mutex);
+
+    GstPad *pad = gst_element_get_static_pad(encoder, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, latency_in_probe, latency, NULL);
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(encoder, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, latency_out_probe, latency, NULL);
+    gst_object_unref(pad);
+
+    g_object_set_data_full(G_OBJECT(encoder), "encoder-latency", latency, encoder_latency_free);
+
+    return latency;
+}
+
+// Mean and worst latency in ms since the last call, returns the number of
+// buffers measured
+static gint encoder_latency_take(encoder_latency_t *latency, gdouble *mean, gdouble *max)
+{
+    g_mutex_lock(&latency->mutex);
+    const gint frames = latency->frames;
+    *mean = frames ? latency->total / 1000.0 / frames : 0.0;
+    *max = latency->max / 1000.0;
+    latency->frames = 0;
+    latency->total = 0;
+    latency->max = 0;
+    g_mutex_unlock(&latency->mutex);
+
+    return frames;
+}
+
 typedef struct
 {
     GstElement *pipe;
+    // Kept across pipeline restarts, so that it stays synchronised
+    GstClock *clock;
+    gint64 clock_created;
+    gint clock_synced;
     settings_t *settings;
+    // Congestion control of the current pipeline
+    bwe_t *bwe;
+    GSource *bwe_timer;
+    gint bwe_logged;
+    // Encoder latency reports of the current pipeline
+    encoder_latency_t *video_latency;
+    encoder_latency_t *audio_latency;
+    GSource *latency_timer;
     GSource *timeout;
     GThread *thread;
     GMainLoop *loop;
@@ -101,6 +331,8 @@ typedef struct
 } data_t;
 
 static bool create_pipeline(data_t *data);
+static void congestion_control_stop(data_t *data);
+static void latency_report_stop(data_t *data);
 
 static void timeout_destroy(gpointer user_data)
 {
@@ -115,6 +347,9 @@ static gboolean start_pipe(gpointer user_data)
 {
     data_t *data = user_data;
 
+    congestion_control_stop(data);
+    latency_report_stop(data);
+
     GstBus *bus = gst_element_get_bus(data->pipe);
     gst_bus_remove_watch(bus);
     gst_object_unref(bus);
@@ -206,19 +441,659 @@ static void cb_new_pad(GstElement *element, GstPad *pad, gpointer data)
     // gst_element_link(element, sink);
 }
 
-static bool create_pipeline(data_t *data)
+// Receivers send a FIR or PLI when they join or lose packets, rtpbin turns
+// it into an upstream force-key-unit event which x264enc answers with an IDR.
+static GstPadProbeReturn keyframe_request_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+    if (gst_video_event_is_force_key_unit(event))
+        log_info("Keyframe requested by a receiver");
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Retransmissions (RFC 4588 RTX) go out with their own payload type and
+// SSRC, rtprtxsend keeps the recent packets to answer the receivers' NACKs.
+static GstElement *cb_request_aux_sender(GstElement *rtpbin, guint session, gpointer user_data)
+{
+    GstElement *rtx = gst_element_factory_make("rtprtxsend", NULL);
+    if (!rtx)
+    {
+        log_warn("rtprtxsend missing, no retransmission");
+        return NULL;
+    }
+
+    GstStructure *map = gst_structure_new("application/x-rtp-pt-map",
+                                          G_STRINGIFY(VIDEO_PT), G_TYPE_UINT, VIDEO_RTX_PT,
+                                          G_STRINGIFY(AUDIO_PT), G_TYPE_UINT, AUDIO_RTX_PT,
+                                          NULL);
+    for (gint layer = 1; layer < MAX_LAYERS; layer++)
+    {
+        gchar *pt = g_strdup_printf("%d", LAYER_PT(layer));
+        gst_structure_set(map, pt, G_TYPE_UINT, LAYER_RTX_PT(layer), NULL);
+        g_free(pt);
+    }
+    g_object_set(rtx,
+                 "payload-type-map", map,
+                 "max-size-time", RTX_HISTORY_MS,
+                 NULL);
+    gst_structure_free(map);
+
+    GstElement *bin = gst_bin_new(NULL);
+    gst_bin_add(GST_BIN(bin), rtx);
+
+    GstPad *pad = gst_element_get_static_pad(rtx, "src");
+    gchar *name = g_strdup_printf("src_%u", session);
+    gst_element_add_pad(bin, gst_ghost_pad_new(name, pad));
+    g_free(name);
+    gst_object_unref(pad);
+
+    pad = gst_element_get_static_pad(rtx, "sink");
+    name = g_strdup_printf("sink_%u", session);
+    gst_element_add_pad(bin, gst_ghost_pad_new(name, pad));
+    g_free(name);
+    gst_object_unref(pad);
+
+    return bin;
+}
+
+// Forward error correction (RFC 5109 ULPFEC) on top of the media packets, so
+// that receivers can recover losses without waiting for a retransmission.
+static GstElement *fec_encoder_new(const settings_t *settings)
+{
+    if (settings->fec_percentage <= 0)
+        return NULL;
+
+    GstElement *fecenc = gst_element_factory_make("rtpulpfecenc", NULL);
+    if (!fecenc)
+    {
+        log_warn("rtpulpfecenc missing, no forward error correction");
+        return NULL;
+    }
+
+    g_object_set(fecenc,
+                 "pt", FEC_PT,
+                 "percentage", settings->fec_percentage,
+                 "multipacket", TRUE,
+                 NULL);
+
+    return fecenc;
+}
+
+static GstElement *cb_request_fec_encoder(GstElement *rtpbin, guint session, gpointer user_data)
+{
+    return fec_encoder_new(user_data);
+}
+
+// Drops the RTCP that does not come from 'user_data', a GInetAddress
+static GstPadProbeReturn rtcp_filter_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    (void)pad;
+    GstNetAddressMeta *meta = gst_buffer_get_net_address_meta(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    if (meta == NULL || !G_IS_INET_SOCKET_ADDRESS(meta->addr))
+        return GST_PAD_PROBE_OK;
+
+    GInetAddress *from = g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(meta->addr));
+    return g_inet_address_equal(from, G_INET_ADDRESS(user_data)) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+// Whether receivers other than 'dest' send their RTCP to local 'port' too
+static bool rtcp_port_shared(const settings_t *settings, const destination_t *dest, gint port)
+{
+    for (gint d = 0; d < settings->n_destinations; d++)
+    {
+        const destination_t *other = &settings->destinations[d];
+        if (other != dest && (other->ports[2] == port || other->ports[5] == port))
+            return true;
+    }
+    return false;
+}
+
+// The RTCP 'dest' sends to local 'port'. Receivers send it to their own port
+// numbers on this host, so two of them on the same ports share one udpsrc,
+// kept in 'sources' by port. The packets then go to the right rtpbin by the
+// address they come from, or one receiver would get the NACKs of another
+// answered.
+static GstElement *rtcp_source_new(data_t *data, GHashTable *sources, const destination_t *dest, gint port)
+{
+    if (!rtcp_port_shared(data->settings, dest, port))
+    {
+        GstElement *src = gst_element_factory_make("udpsrc", NULL);
+        g_object_set(src, "port", port, NULL);
+        gst_bin_add(GST_BIN(data->pipe), src);
+        return src;
+    }
+
+    GstElement *tee = g_hash_table_lookup(sources, GINT_TO_POINTER(port));
+    if (tee == NULL)
+    {
+        GstElement *src = gst_element_factory_make("udpsrc", NULL);
+        g_object_set(src, "port", port, NULL);
+        tee = gst_element_factory_make("tee", NULL);
+        gst_bin_add_many(GST_BIN(data->pipe), src, tee, NULL);
+        gst_element_link(src, tee);
+        g_hash_table_insert(sources, GINT_TO_POINTER(port), tee);
+    }
+
+    GInetAddress *address = g_inet_address_new_from_string(dest->ip);
+    if (address == NULL)
+    {
+        GList *addresses = g_resolver_lookup_by_name(g_resolver_get_default(), dest->ip, NULL, NULL);
+        if (addresses)
+        {
+            address = g_object_ref(addresses->data);
+            g_resolver_free_addresses(addresses);
+        }
+    }
+    if (address == NULL)
+    {
+        log_error("Cannot resolve %s", dest->ip);
+        return NULL;
+    }
+
+    GstElement *queue = gst_element_factory_make("queue", NULL);
+    gst_bin_add(GST_BIN(data->pipe), queue);
+    gst_element_link(tee, queue);
+
+    GstPad *pad = gst_element_get_static_pad(queue, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, rtcp_filter_probe, address, g_object_unref);
+    gst_object_unref(pad);
+
+    return queue;
+}
+
+// One session per media, each with its own ports for RTP, RTCP out and RTCP
+// in. The RTCP in comes from 'sources', see rtcp_source_new().
+static bool link_sessions(data_t *data, GHashTable *sources, const destination_t *dest, GstElement *rtpbin,
+                          GstElement *vpay, GstElement *apay)
+{
+    GstElement *vrtpsink = gst_element_factory_make("udpsink", NULL);
+    g_object_set(vrtpsink,
+                 "port", dest->ports[0],
+                 "host", dest->ip,
+                 "ts-offset", 0,
+                 NULL);
+    GstElement *vrtcpsink = gst_element_factory_make("udpsink", NULL);
+    g_object_set(vrtcpsink,
+                 "port", dest->ports[1],
+                 "host", dest->ip,
+                 "sync", FALSE,
+                 "async", FALSE,
+                 NULL);
+
+    GstElement *vrtcpsrc = rtcp_source_new(data, sources, dest, dest->ports[2]);
+    if (vrtcpsrc == NULL)
+        return false;
+
+    GstElement *artpsink = gst_element_factory_make("udpsink", NULL);
+    g_object_set(artpsink,
+                 "port", dest->ports[3],
+                 "host", dest->ip,
+                 "ts-offset", 0,
+                 NULL);
+
+    GstElement *artcpsink = gst_element_factory_make("udpsink", NULL);
+    g_object_set(artcpsink,
+                 "port", dest->ports[4],
+                 "host", dest->ip,
+                 "sync", FALSE,
+                 "async", FALSE,
+                 NULL);
+
+    GstElement *artcpsrc = rtcp_source_new(data, sources, dest, dest->ports[5]);
+    if (artcpsrc == NULL)
+        return false;
+
+    gst_bin_add_many(GST_BIN(data->pipe),
+                     vrtcpsink,
+                     vrtpsink,
+                     artpsink,
+                     artcpsink,
+                     NULL);
+
+    gst_element_link_pads(vpay, "src", rtpbin, "send_rtp_sink_0");
+    gst_element_link_pads(rtpbin, "send_rtcp_src_0", vrtcpsink, "sink");
+    gst_element_link_pads(rtpbin, "send_rtp_src_0", vrtpsink, "sink");
+    gst_element_link_pads(vrtcpsrc, "src", rtpbin, "recv_rtcp_sink_0");
+
+    gst_element_link_pads(apay, "src", rtpbin, "send_rtp_sink_1");
+    gst_element_link_pads(rtpbin, "send_rtcp_src_1", artcpsink, "sink");
+    gst_element_link_pads(rtpbin, "send_rtp_src_1", artpsink, "sink");
+    gst_element_link_pads(artcpsrc, "src", rtpbin, "recv_rtcp_sink_1");
+
+    return true;
+}
+
+// Both media in session 0 and RTP and RTCP over a single socket, to the
+// receiver's first port. The receiver answers to wherever the packets come
+// from, so any local port will do.
+static bool link_bundled(data_t *data, const destination_t *dest, GstElement *rtpbin, GstElement *vpay,
+                         GstElement *apay)
 {
     GError *err = NULL;
+    GSocket *socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &err);
+    if (socket)
+    {
+        GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+        GSocketAddress *address = g_inet_socket_address_new(any, 0);
 
-    data->pipe = gst_pipeline_new("pipe");
+        if (!g_socket_bind(socket, address, TRUE, &err))
+            g_clear_object(&socket);
+
+        g_object_unref(address);
+        g_object_unref(any);
+    }
+    if (socket == NULL)
+    {
+        log_error("Cannot create the bundle socket: %s", err->message);
+        g_error_free(err);
+        return false;
+    }
+
+    GstElement *funnel = gst_element_factory_make("rtpfunnel", NULL);
+    GstElement *fecenc = fec_encoder_new(data->settings);
+    GstElement *mux = gst_element_factory_make("funnel", NULL);
+
+    GstElement *sink = gst_element_factory_make("udpsink", NULL);
+    g_object_set(sink,
+                 "socket", socket,
+                 "close-socket", FALSE,
+                 "port", dest->ports[0],
+                 "host", dest->ip,
+                 "ts-offset", 0,
+                 NULL);
+
+    GstElement *src = gst_element_factory_make("udpsrc", NULL);
+    g_object_set(src,
+                 "socket", socket,
+                 "close-socket", FALSE,
+                 NULL);
+    g_object_unref(socket);
+
+    if (!funnel || !mux)
+    {
+        log_error("rtpfunnel or funnel missing, cannot bundle");
+        return false;
+    }
+
+    gst_bin_add_many(GST_BIN(data->pipe), funnel, mux, sink, src, NULL);
+
+    if (fecenc)
+    {
+        gst_bin_add(GST_BIN(data->pipe), fecenc);
+        gst_element_link_many(vpay, fecenc, funnel, NULL);
+    }
+    else
+    {
+        gst_element_link(vpay, funnel);
+    }
+    gst_element_link(apay, funnel);
+
+    gst_element_link_pads(funnel, "src", rtpbin, "send_rtp_sink_0");
+    gst_element_link_pads(rtpbin, "send_rtp_src_0", mux, "sink_%u");
+    gst_element_link_pads(rtpbin, "send_rtcp_src_0", mux, "sink_%u");
+    gst_element_link(mux, sink);
+    // Only the receiver's RTCP comes back
+    gst_element_link_pads(src, "src", rtpbin, "recv_rtcp_sink_0");
+
+    return true;
+}
+
+static gboolean congestion_update(gpointer user_data)
+{
+    data_t *data = user_data;
+    bwe_report_t report;
+
+    if (!bwe_update(data->bwe, &report))
+        return G_SOURCE_CONTINUE;
+
+    // Only steps of 10 % are worth a line
+    if (ABS(report.video_kbps - data->bwe_logged) * 10 >= data->bwe_logged)
+    {
+        log_info("Bitrate video %d kbps, audio %d kbps (received %d kbps, %.1f %% lost, delay trend %d us)",
+                 report.video_kbps, report.audio_kbps, report.received_kbps, report.loss, report.delay_trend);
+        data->bwe_logged = report.video_kbps;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+// The receivers' rtpbins answer transport-wide sequence numbers with TWCC
+// feedback, the estimator retunes the encoders from it. There is one encode
+// for all of them, the narrowest path sets its bitrate.
+static void congestion_control_start(data_t *data, GstElement **rtpbins, gint n_rtpbins, GstElement *venc,
+                                     GstElement *aenc)
+{
+    data->bwe = bwe_new(rtpbins[0], 0, venc, aenc, data->settings->min_bitrate, data->settings->bitrate);
+    for (gint d = 1; d < n_rtpbins && data->bwe; d++)
+    {
+        if (!bwe_add_path(data->bwe, rtpbins[d], 0))
+        {
+            bwe_free(data->bwe);
+            data->bwe = NULL;
+        }
+    }
+
+    if (data->bwe == NULL)
+    {
+        log_warn("No RTP session to estimate, no congestion control");
+        return;
+    }
+
+    data->bwe_logged = data->settings->bitrate;
+    data->bwe_timer = g_timeout_source_new(BWE_INTERVAL_MS);
+    g_source_set_callback(data->bwe_timer, congestion_update, data, NULL);
+    g_source_attach(data->bwe_timer, g_main_context_get_thread_default());
+}
+
+static void congestion_control_stop(data_t *data)
+{
+    if (data->bwe_timer)
+    {
+        g_source_destroy(data->bwe_timer);
+        g_source_unref(data->bwe_timer);
+        data->bwe_timer = NULL;
+    }
+
+    bwe_free(data->bwe);
+    data->bwe = NULL;
+}
+
+static gboolean latency_report(gpointer user_data)
+{
+    data_t *data = user_data;
+    gdouble video;
+    gdouble video_max;
+    gdouble audio;
+    gdouble audio_max;
+
+    // Both are taken every time, so that neither period spans two reports
+    const bool have_video = encoder_latency_take(data->video_latency, &video, &video_max);
+    const bool have_audio = encoder_latency_take(data->audio_latency, &audio, &audio_max);
+
+    if (!have_video || !have_audio)
+        return G_SOURCE_CONTINUE;
+
+    log_info("Encoder latency (%s profile): video %.1f ms (max %.1f ms), audio %.1f ms (max %.1f ms)",
+             profile_names[data->settings->profile], video, video_max, audio, audio_max);
+
+    return G_SOURCE_CONTINUE;
+}
+
+// What the encoders add to the end-to-end latency, from pad probes on both,
+// logged every LATENCY_REPORT_MS
+static void latency_report_start(data_t *data, GstElement *venc, GstElement *aenc)
+{
+    data->video_latency = encoder_latency_attach(venc);
+    data->audio_latency = encoder_latency_attach(aenc);
+
+    data->latency_timer = g_timeout_source_new(LATENCY_REPORT_MS);
+    g_source_set_callback(data->latency_timer, latency_report, data, NULL);
+    g_source_attach(data->latency_timer, g_main_context_get_thread_default());
+}
+
+static void latency_report_stop(data_t *data)
+{
+    if (data->latency_timer)
+    {
+        g_source_destroy(data->latency_timer);
+        g_source_unref(data->latency_timer);
+        data->latency_timer = NULL;
+    }
+
+    // Owned by the encoders
+    data->video_latency = NULL;
+    data->audio_latency = NULL;
+}
+
+static void report_clock_synced(data_t *data, GstClockTimeDiff offset)
+{
+    if (!g_atomic_int_compare_and_exchange(&data->clock_synced, FALSE, TRUE))
+        return;
+
+    log_info("Clock synchronised to %" G_GINT64_FORMAT " us after %" G_GINT64_FORMAT " ms",
+             ABS(offset) / GST_USECOND,
+             (g_get_monotonic_time() - data->clock_created) / G_TIME_SPAN_MILLISECOND);
+}
+
+// Statistics of the NTP and network clocks, posted from their own thread
+static GstBusSyncReply clock_statistics(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+    data_t *data = user_data;
+    const GstStructure *s = gst_message_get_structure(message);
+    gboolean synchronised = FALSE;
+    gint64 offset = 0;
+
+    if (s != NULL && gst_structure_has_name(s, "gst-netclock-statistics"))
+    {
+        gst_structure_get_boolean(s, "synchronised", &synchronised);
+        gst_structure_get_int64(s, "local-clock-offset", &offset);
+
+        if (synchronised && ABS(offset) < data->settings->clock_threshold * GST_USECOND)
+            report_clock_synced(data, offset);
+    }
+
+    return GST_BUS_DROP;
+}
+
+// PTP has no offset statistics, its own sync is all there is to report
+static void clock_synced(GstClock *clock, gboolean synced, gpointer user_data)
+{
+    if (synced)
+        report_clock_synced(user_data, 0);
+}
+
+// The pipeline does not wait for the clock: until it is synchronised it runs
+// from the local wall clock, which is close enough to start with.
+static GstClock *clock_new(data_t *data)
+{
+    const settings_t *settings = data->settings;
+    const GstClockTime now = g_get_real_time() * GST_USECOND;
+    GstClock *clock;
+
+    data->clock_created = g_get_monotonic_time();
+
+    switch (settings->clock_type)
+    {
+    case CLOCK_PTP:
+        if (!gst_ptp_is_initialized() && !gst_ptp_init(GST_PTP_CLOCK_ID_NONE, NULL))
+            log_error("Cannot initialise PTP");
+        clock = gst_ptp_clock_new("ptp_clock", settings->ptp_domain);
+        g_signal_connect(clock, "synced", G_CALLBACK(clock_synced), data);
+        return clock;
+    case CLOCK_NET:
+        // The receiver provides its wall clock
+        clock = gst_net_client_clock_new("net_clock", settings->clock_ip, settings->clock_port, now);
+        break;
+    default:
+        clock = gst_ntp_clock_new("main_ntp_clock", settings->clock_ip, settings->clock_port,
+                                  now + NTP_UNIX_OFFSET * GST_SECOND);
+        break;
+    }
+
+    GstBus *bus = gst_bus_new();
+    gst_bus_set_sync_handler(bus, clock_statistics, data, NULL);
+    g_object_set(clock, "bus", bus, NULL);
+    gst_object_unref(bus);
+
+    return clock;
+}
+
+// Encoder threads, 0 auto-sizes from the core count
+static gint encoder_threads(gint threading, gint threads)
+{
+    if (threads > 0)
+        return threads;
+
+    return MIN(g_get_num_processors(), threading == THREADING_SLICED ? MAX_SLICED_THREADS : MAX_FRAME_THREADS);
+}
+
+static GstElement *video_encoder_new(const settings_t *settings)
+{
+    GstElement *venc = gst_element_factory_make("x264enc", NULL);
+    if (venc == NULL)
+        return NULL;
+
+    g_object_set(venc,
+                 "tune", 0,
+                 //  "profile", 0,
+                 "key-int-max", 30,
+                 "bframes", 2,
+                 "byte-stream", TRUE,
+                 "bitrate", settings->bitrate,
+                 "speed-preset", 3, // veryfast
+                 "threads", encoder_threads(settings->threading, settings->threads),
+                 "sliced-threads", settings->threading == THREADING_SLICED,
+                 "pass", 0, // O: cbr
+                 NULL);
+
+    // Nothing held back in the encoder: no B-frames to wait for, no
+    // lookahead, and instead of periodic IDR frames a column of intra blocks
+    // sweeping the picture once every key-int-max frames, which keeps the
+    // frame sizes even. Requested keyframes are still IDR frames.
+    if (settings->profile == PROFILE_LOW_LATENCY)
+    {
+        gst_util_set_object_arg(G_OBJECT(venc), "tune", "zerolatency");
+        g_object_set(venc,
+                     "bframes", 0,
+                     "rc-lookahead", 0,
+                     "sync-lookahead", 0,
+                     "intra-refresh", TRUE,
+                     "key-int-max", settings->framerate,
+                     NULL);
+    }
+
+    return venc;
+}
+
+// Layers after the first follow its bitrate, which congestion control
+// changes, at a quarter for each halving of the size.
+static void follow_bitrate(GObject *venc, GParamSpec *pspec, gpointer user_data)
+{
+    GObject *layer_venc = user_data;
+    const gint layer = GPOINTER_TO_INT(g_object_get_data(layer_venc, "simulcast-layer"));
+    guint bitrate = 0;
+
+    g_object_get(venc, "bitrate", &bitrate, NULL);
+    g_object_set(layer_venc, "bitrate", MAX(bitrate >> (2 * layer), 1), NULL);
+}
+
+// One simulcast layer fed from the capture 'tee', on a thread of its own:
+// scaled down to half the size per layer, encoded at a quarter of the bitrate
+// per layer and payloaded with the layer's payload type and SSRC. Returns the
+// payloader, NULL on failure, and the encoder in 'venc'.
+static GstElement *video_layer_new(data_t *data, GstElement *tee, gint layer, GstElement **venc)
+{
+    settings_t config = *data->settings;
+
+    config.bitrate = MAX(config.bitrate >> (2 * layer), 1);
+
+    GstElement *queue = gst_element_factory_make("queue", NULL);
+    GstElement *encoder = video_encoder_new(&config);
+    GstElement *enccapsfilter = gst_element_factory_make("capsfilter", NULL);
+    GstElement *parse = gst_element_factory_make("h264parse", NULL);
+    GstElement *pay = gst_element_factory_make("rtph264pay", NULL);
+    GstElement *scale = layer > 0 ? gst_element_factory_make("videoscale", NULL) : NULL;
+    GstElement *scalecapsfilter = layer > 0 ? gst_element_factory_make("capsfilter", NULL) : NULL;
 
-    GstClock *clock = gst_ntp_clock_new("main_ntp_clock", data->settings->clock_ip, data->settings->clock_port, 0);
-    gst_pipeline_use_clock(GST_PIPELINE(data->pipe), clock);
+    if (!queue || !encoder || !enccapsfilter || !parse || !pay || (layer > 0 && (!scale || !scalecapsfilter)))
+    {
+        log_error("Cannot create the elements of video layer %d", layer);
+        return NULL;
+    }
+
+    GstCaps *caps = gst_caps_new_simple("video/x-h264", "profile", G_TYPE_STRING, "high", NULL);
+    g_object_set(enccapsfilter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(pay,
+                 "pt", LAYER_PT(layer),
+                 "config-interval", -1, // SPS/PPS with every IDR, requested ones included
+                 NULL);
+    if (config.ssrc)
+        g_object_set(pay, "ssrc", LAYER_SSRC(config.ssrc, layer), NULL);
+
+    GstPad *encsrc = gst_element_get_static_pad(encoder, "src");
+    gst_pad_add_probe(encsrc, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, keyframe_request_probe, NULL, NULL);
+    gst_object_unref(encsrc);
+
+    gst_bin_add_many(GST_BIN(data->pipe), queue, encoder, enccapsfilter, parse, pay, NULL);
+
+    bool linked;
+    if (layer > 0)
+    {
+        // Even sizes, as I420 wants them
+        caps = gst_caps_new_simple("video/x-raw",
+                                   "width", G_TYPE_INT, (config.width >> layer) & ~1,
+                                   "height", G_TYPE_INT, (config.height >> layer) & ~1,
+                                   NULL);
+        g_object_set(scalecapsfilter, "caps", caps, NULL);
+        gst_caps_unref(caps);
+
+        gst_bin_add_many(GST_BIN(data->pipe), scale, scalecapsfilter, NULL);
+        linked = gst_element_link_many(tee, queue, scale, scalecapsfilter, encoder, enccapsfilter, parse, pay, NULL);
+    }
+    else
+    {
+        linked = gst_element_link_many(tee, queue, encoder, enccapsfilter, parse, pay, NULL);
+    }
+
+    if (!linked)
+    {
+        log_warn("can't link video layer %d", layer);
+        return NULL;
+    }
 
+    g_object_set_data(G_OBJECT(encoder), "simulcast-layer", GINT_TO_POINTER(layer));
+    *venc = encoder;
+
+    return pay;
+}
+
+// RTP and RTCP towards one receiver, in 'data->pipe'
+static GstElement *rtpbin_new(data_t *data)
+{
     GstElement *rtpbin = gst_element_factory_make("rtpbin", NULL);
+
     g_object_set(rtpbin, "rtp-profile", 3, NULL); // 3 = RTP/AVPF
     g_object_set(rtpbin, "rtcp-sync-send-time", FALSE, NULL);
     g_object_set(rtpbin, "ntp-time-source", 3, NULL); // 3 = clock-time
+    g_signal_connect(rtpbin, "request-aux-sender", G_CALLBACK(cb_request_aux_sender), NULL);
+    // Bundled, audio shares the session and FEC is put on the video only
+    if (!data->settings->bundle)
+        g_signal_connect(rtpbin, "request-fec-encoder", G_CALLBACK(cb_request_fec_encoder), data->settings);
+
+    gst_bin_add(GST_BIN(data->pipe), rtpbin);
+
+    return rtpbin;
+}
+
+// A receiver's own thread off 'tee', so that one receiver's sending, RTX and
+// FEC never hold up the others
+static GstElement *destination_queue_new(data_t *data, GstElement *tee)
+{
+    GstElement *queue = gst_element_factory_make("queue", NULL);
+
+    gst_bin_add(GST_BIN(data->pipe), queue);
+    gst_element_link(tee, queue);
+
+    return queue;
+}
+
+static bool create_pipeline(data_t *data)
+{
+    GError *err = NULL;
+
+    congestion_control_stop(data);
+    latency_report_stop(data);
+
+    data->pipe = gst_pipeline_new("pipe");
+
+    if (data->clock == NULL)
+        data->clock = clock_new(data);
+    gst_pipeline_use_clock(GST_PIPELINE(data->pipe), data->clock);
 
     // VIDEO
 
@@ -235,47 +1110,12 @@ static bool create_pipeline(data_t *data)
 
     GstElement *vscale = gst_element_factory_make("videoscale", NULL);
     GstElement *vconvert = gst_element_factory_make("videoconvert", NULL);
-    GstElement *vqueue = gst_element_factory_make("queue", NULL);
-
-    GstElement *venc = gst_element_factory_make("x264enc", NULL);
-    g_object_set(venc,
-                 "tune", 0,
-                 //  "profile", 0,
-                 "key-int-max", 30,
-                 "bframes", 2,
-                 "byte-stream", TRUE,
-                 "bitrate", data->settings->bitrate,
-                 "speed-preset", 3, // veryfast
-                 "threads", 1,
-                 "pass", 0, // O: cbr
-                 NULL);
-    GstElement *venccapsfilter = gst_element_factory_make("capsfilter", NULL);
-    g_object_set(venccapsfilter, "caps", gst_caps_new_simple("video/x-h264", "profile", G_TYPE_STRING, "high", NULL),
-                 NULL);
-    GstElement *vparse = gst_element_factory_make("h264parse", NULL);
-    GstElement *vpay = gst_element_factory_make("rtph264pay", NULL);
-    g_object_set(vpay,
-                 "pt", 96,
-                 "config-interval", 2,
-                 NULL);
-    GstElement *vrtpqueue = gst_element_factory_make("rtprtxqueue", NULL);
-
-    GstElement *vrtpsink = gst_element_factory_make("udpsink", NULL);
-    g_object_set(vrtpsink,
-                 "port", data->settings->receiver_ports[0],
-                 "host", data->settings->receiver_ip,
-                 "ts-offset", 0,
-                 NULL);
-    GstElement *vrtcpsink = gst_element_factory_make("udpsink", NULL);
-    g_object_set(vrtcpsink,
-                 "port", data->settings->receiver_ports[1],
-                 "host", data->settings->receiver_ip,
-                 "sync", FALSE,
-                 "async", FALSE,
-                 NULL);
+    // Captured and converted once for all layers
+    GstElement *vtee = gst_element_factory_make("tee", NULL);
 
-    GstElement *vrtcpsrc = gst_element_factory_make("udpsrc", NULL);
-    g_object_set(vrtcpsrc, "port", data->settings->receiver_ports[2], NULL);
+    log_info("Encoding %d layer(s) with %d %s threads each", data->settings->layers,
+             encoder_threads(data->settings->threading, data->settings->threads),
+             data->settings->threading == THREADING_SLICED ? "sliced" : "frame");
 
     // AUDIO
 
@@ -290,73 +1130,122 @@ static bool create_pipeline(data_t *data)
     g_object_set(acapsfilter, "caps", acaps, NULL);
 
     GstElement *aenc = gst_element_factory_make("opusenc", NULL);
+    g_object_set(aenc, "inband-fec", TRUE, "packet-loss-percentage", AUDIO_EXPECTED_LOSS, NULL);
+    // Each packet waits for its frame to fill up, and each frame for the
+    // source buffer carrying its first samples
+    if (data->settings->profile == PROFILE_LOW_LATENCY)
+    {
+        gst_util_set_object_arg(G_OBJECT(aenc), "frame-size", "10");
+        g_object_set(asource, "samplesperbuffer", 480, NULL);
+    }
     GstElement *apay = gst_element_factory_make("rtpopuspay", NULL);
-    g_object_set(apay, "pt", 96, NULL);
-
-    GstElement *artpqueue = gst_element_factory_make("rtprtxqueue", NULL);
-    GstElement *artpsink = gst_element_factory_make("udpsink", NULL);
-    g_object_set(artpsink,
-                 "port", data->settings->receiver_ports[3],
-                 "host", data->settings->receiver_ip,
-                 "ts-offset", 0,
-                 NULL);
-
-    GstElement *artcpsink = gst_element_factory_make("udpsink", NULL);
-    g_object_set(artcpsink,
-                 "port", data->settings->receiver_ports[4],
-                 "host", data->settings->receiver_ip,
-                 "sync", FALSE,
-                 "async", FALSE,
-                 NULL);
-
-    GstElement *artcpsrc = gst_element_factory_make("udpsrc", NULL);
-    g_object_set(artcpsrc, "port", data->settings->receiver_ports[5], NULL);
+    g_object_set(apay, "pt", AUDIO_PT, NULL);
+    // Audio needs an SSRC of its own when it shares the session with video
+    if (data->settings->ssrc)
+        g_object_set(apay, "ssrc", data->settings->bundle ? data->settings->ssrc + 1 : data->settings->ssrc, NULL);
 
     // Add all elements to the pipe
     gst_bin_add_many(GST_BIN(data->pipe),
-                     rtpbin,
-
                      vsource,
                      vcapsfilter,
                      vscale,
                      vconvert,
-                     vqueue,
-                     venc,
-                     venccapsfilter,
-                     vparse,
-                     vpay,
-                     vrtpqueue,
-                     vrtcpsink,
-                     vrtpsink,
-                     vrtcpsrc,
+                     vtee,
 
                      asource,
                      aconvert,
                      acapsfilter,
                      aenc,
                      apay,
-                     artpqueue,
-                     artpsink,
-                     artcpsink,
-                     artcpsrc,
                      NULL);
 
-    if (!gst_element_link_many(vsource, vscale, vconvert, vcapsfilter, vqueue, venc, venccapsfilter, vparse, vpay, vrtpqueue, NULL) //
-        || !gst_element_link_many(asource, aconvert, acapsfilter, aenc, apay, artpqueue, NULL))
+    if (!gst_element_link_many(vsource, vscale, vconvert, vcapsfilter, vtee, NULL) //
+        || !gst_element_link_many(asource, aconvert, acapsfilter, aenc, apay, NULL))
     {
         log_warn("can't link elements");
         return false;
     }
 
-    gst_element_link_pads(vrtpqueue, "src", rtpbin, "send_rtp_sink_0");
-    gst_element_link_pads(rtpbin, "send_rtcp_src_0", vrtcpsink, "sink");
-    gst_element_link_pads(rtpbin, "send_rtp_src_0", vrtpsink, "sink");
-    gst_element_link_pads(vrtcpsrc, "src", rtpbin, "recv_rtcp_sink_0");
+    // Simulcast layers go into the video session together
+    GstElement *venc = NULL;
+    GstElement *vpay = NULL;
+    if (data->settings->layers > 1)
+    {
+        vpay = gst_element_factory_make("rtpfunnel", NULL);
+        if (vpay == NULL)
+        {
+            log_error("rtpfunnel missing, cannot send layers");
+            return false;
+        }
+        gst_bin_add(GST_BIN(data->pipe), vpay);
+    }
 
-    gst_element_link_pads(artpqueue, "src", rtpbin, "send_rtp_sink_1");
-    gst_element_link_pads(rtpbin, "send_rtcp_src_1", artcpsink, "sink");
-    gst_element_link_pads(rtpbin, "send_rtp_src_1", artpsink, "sink");
-    gst_element_link_pads(artcpsrc, "src", rtpbin, "recv_rtcp_sink_1");
+    bool congestion_control = data->settings->congestion_control;
+    for (gint layer = 0; layer < data->settings->layers; layer++)
+    {
+        GstElement *layer_venc;
+        GstElement *layer_vpay = video_layer_new(data, vtee, layer, &layer_venc);
+        if (layer_vpay == NULL)
+            return false;
+
+        if (congestion_control && !bwe_add_extension(layer_vpay))
+        {
+            log_warn("Transport-wide sequence numbers unsupported, no congestion control");
+            congestion_control = false;
+        }
+
+        if (layer == 0)
+            venc = layer_venc;
+        else
+            g_signal_connect(venc, "notify::bitrate", G_CALLBACK(follow_bitrate), layer_venc);
+
+        if (vpay == NULL)
+            vpay = layer_vpay;
+        else
+            gst_element_link(layer_vpay, vpay);
+    }
+
+    // Several receivers get the payloaded media through tees
+    GstElement *vtees = NULL;
+    GstElement *atees = NULL;
+    if (data->settings->n_destinations > 1)
+    {
+        vtees = gst_element_factory_make("tee", NULL);
+        atees = gst_element_factory_make("tee", NULL);
+        gst_bin_add_many(GST_BIN(data->pipe), vtees, atees, NULL);
+        gst_element_link(vpay, vtees);
+        gst_element_link(apay, atees);
+    }
+
+    GstElement *rtpbins[MAX_DESTINATIONS] = {NULL};
+    GHashTable *rtcp_sources = g_hash_table_new(NULL, NULL);
+    for (gint d = 0; d < data->settings->n_destinations; d++)
+    {
+        const destination_t *dest = &data->settings->destinations[d];
+        GstElement *dest_rtpbin = rtpbin_new(data);
+        GstElement *dest_vpay = vtees ? destination_queue_new(data, vtees) : vpay;
+        GstElement *dest_apay = atees ? destination_queue_new(data, atees) : apay;
+
+        if (!(data->settings->bundle ? link_bundled(data, dest, dest_rtpbin, dest_vpay, dest_apay)
+                                     : link_sessions(data, rtcp_sources, dest, dest_rtpbin, dest_vpay, dest_apay)))
+        {
+            g_hash_table_destroy(rtcp_sources);
+            return false;
+        }
+
+        log_info("Sending to %s:%d", dest->ip, dest->ports[0]);
+
+        rtpbins[d] = dest_rtpbin;
+    }
+    g_hash_table_destroy(rtcp_sources);
+
+    // The video session carries the sequence numbers, bundled or not
+    if (congestion_control)
+        congestion_control_start(data, rtpbins, data->settings->n_destinations, venc, aenc);
+
+    GstElement *rtpbin = rtpbins[0];
+
+    latency_report_start(data, venc, aenc);
 
     GstPad *vscalesink = gst_element_get_static_pad(vscale, "sink");
     GstPad *aconvertsink = gst_element_get_static_pad(aconvert, "sink");
@@ -396,6 +1285,9 @@ static gpointer _start(gpointer user_data)
 
     g_main_loop_run(data->loop);
 
+    congestion_control_stop(data);
+    latency_report_stop(data);
+
     if (data->pipe != NULL)
     {
         gst_element_set_state(data->pipe, GST_STATE_NULL);
@@ -455,30 +1347,159 @@ void gstreamer_source_destroy(void *user_data)
 
     stop(data);
 
+    if (data->clock)
+        gst_object_unref(data->clock);
+
     g_mutex_clear(&data->mutex);
     g_cond_clear(&data->cond);
 
     g_free(data);
 }
 
+// Ports from 'port' on, see destination_t
+static void destination_set(destination_t *dest, const gchar *ip, gint port)
+{
+    dest->ip = ip;
+    for (gint ii = 0; ii < NB_PORTS; ii++)
+        dest->ports[ii] = port + ii;
+}
+
 void gstreamer_source_get_defaults(settings_t *settings)
 {
     settings->restart_on_eos = true;
     settings->restart_on_error = true;
     settings->restart_timeout = 2000;
-    settings->receiver_ip = "127.0.0.1";
-
-    for (int ii = 0; ii < NB_PORTS; ii++)
-        settings->receiver_ports[ii] = 5000 + ii;
+    destination_set(&settings->destinations[0], "127.0.0.1", 5000);
+    settings->n_destinations = 1;
 
+    settings->clock_type = CLOCK_NTP;
     settings->clock_ip = "45.159.204.28";
     settings->clock_port = 123;
+    settings->ptp_domain = 0;
+    settings->clock_threshold = 1000;
     settings->videosource = "videotestsrc";
     settings->audiosource = "audiotestsrc";
     settings->bitrate = 3000;
     settings->framerate = 30;
     settings->width = 1920;
     settings->height = 1080;
+    settings->ssrc = 0;
+    settings->fec_percentage = 0;
+    settings->bundle = false;
+    settings->congestion_control = false;
+    settings->min_bitrate = 300;
+    settings->threading = THREADING_SLICED;
+    settings->threads = 0;
+    settings->profile = PROFILE_DEFAULT;
+    settings->layers = 1;
+    settings->benchmark = 0;
+}
+
+static gint64 cpu_time(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+           usage.ru_stime.tv_usec;
+}
+
+// Encodes settings->benchmark seconds of test video as fast as it goes.
+// Returns the frame rate, 0 on failure, the mean and worst encode latency in
+// ms and the CPU time used in percent of one core.
+static gdouble benchmark_run(const settings_t *settings, gdouble *latency, gdouble *latency_max, gdouble *cpu)
+{
+    GstElement *pipe = gst_pipeline_new(NULL);
+    GstElement *src = gst_element_factory_make("videotestsrc", NULL);
+    GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+    GstElement *venc = video_encoder_new(settings);
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+
+    if (!src || !filter || !venc || !sink)
+    {
+        log_error("Cannot create the benchmark elements");
+        gst_object_unref(pipe);
+        return 0.0;
+    }
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, "I420",
+                                        "width", G_TYPE_INT, settings->width,
+                                        "height", G_TYPE_INT, settings->height,
+                                        "framerate", GST_TYPE_FRACTION, settings->framerate, 1,
+                                        NULL);
+    g_object_set(filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    g_object_set(src, "num-buffers", settings->benchmark * settings->framerate, NULL);
+    gst_util_set_object_arg(G_OBJECT(src), "pattern", "ball");
+    g_object_set(sink, "sync", FALSE, NULL);
+
+    gst_bin_add_many(GST_BIN(pipe), src, filter, venc, sink, NULL);
+    gst_element_link_many(src, filter, venc, sink, NULL);
+
+    encoder_latency_t *encoder_latency = encoder_latency_attach(venc);
+
+    const gint64 cpu_start = cpu_time();
+    const gint64 start = g_get_monotonic_time();
+
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+
+    GstBus *bus = gst_element_get_bus(pipe);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    const gint64 elapsed = g_get_monotonic_time() - start;
+    const bool failed = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR;
+
+    *cpu = elapsed > 0 ? (cpu_time() - cpu_start) * 100.0 / elapsed : 0.0;
+    const gint frames = encoder_latency_take(encoder_latency, latency, latency_max);
+
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+
+    return failed || elapsed <= 0 ? 0.0 : frames * (gdouble)G_USEC_PER_SEC / elapsed;
+}
+
+// Every profile and threading configuration, with the rest of the settings
+// as given
+static void benchmark(const settings_t *settings)
+{
+    static const gint thread_counts[] = {1, 2, 4, 8, 0};
+    static const gint threadings[] = {THREADING_SLICED, THREADING_FRAME};
+
+    printf("%dx%d@%d, %d s of video, %d cores\n", settings->width, settings->height, settings->framerate,
+           settings->benchmark, g_get_num_processors());
+    printf("%12s %10s %8s %10s %12s %12s %8s\n", "profile", "threading", "threads", "fps", "latency ms", "max ms",
+           "cpu %");
+
+    for (gsize p = 0; p < G_N_ELEMENTS(profile_names); p++)
+    {
+        for (gsize t = 0; t < G_N_ELEMENTS(threadings); t++)
+        {
+            for (gsize i = 0; i < G_N_ELEMENTS(thread_counts); i++)
+            {
+                settings_t config = *settings;
+                gdouble latency = 0.0;
+                gdouble latency_max = 0.0;
+                gdouble cpu = 0.0;
+
+                config.profile = p;
+                config.threading = threadings[t];
+                config.threads = thread_counts[i];
+
+                const gdouble fps = benchmark_run(&config, &latency, &latency_max, &cpu);
+                gchar *threads = thread_counts[i] ? g_strdup_printf("%d", thread_counts[i])
+                                                  : g_strdup_printf("auto %d", encoder_threads(config.threading, 0));
+
+                printf("%12s %10s %8s %10.1f %12.1f %12.1f %8.0f\n", profile_names[p],
+                       config.threading == THREADING_SLICED ? "sliced" : "frame", threads, fps, latency, latency_max,
+                       cpu);
+
+                g_free(threads);
+            }
+        }
+    }
 }
 
 /* Parse a single option. */
@@ -515,32 +1536,111 @@ parse_opt(int key, char *arg, struct argp_state *state)
     case SHORT_NTP_IP:
         settings->clock_ip = arg;
         break;
+    case SHORT_CLOCK:
+        if (strcmp(arg, "ntp") == 0)
+            settings->clock_type = CLOCK_NTP;
+        else if (strcmp(arg, "net") == 0)
+            settings->clock_type = CLOCK_NET;
+        else if (strcmp(arg, "ptp") == 0)
+            settings->clock_type = CLOCK_PTP;
+        else
+            argp_error(state, "unknown clock type '%s'", arg);
+        break;
+    case SHORT_PTP_DOMAIN:
+        settings->ptp_domain = atoi(arg);
+        break;
+    case SHORT_CLOCK_THRESHOLD:
+        settings->clock_threshold = atoi(arg);
+        break;
+    case SHORT_SSRC:
+        settings->ssrc = strtoul(arg, NULL, 10);
+        break;
+    case SHORT_FEC:
+        settings->fec_percentage = CLAMP(atoi(arg), 0, 100);
+        break;
+    case SHORT_BUNDLE:
+        settings->bundle = true;
+        break;
+    case SHORT_CONGESTION:
+        settings->congestion_control = true;
+        break;
+    case SHORT_MIN_BITRATE:
+        settings->min_bitrate = atoi(arg);
+        break;
+    case SHORT_THREADS:
+        settings->threads = MAX(atoi(arg), 0);
+        break;
+    case SHORT_THREADING:
+        if (strcmp(arg, "sliced") == 0)
+            settings->threading = THREADING_SLICED;
+        else if (strcmp(arg, "frame") == 0)
+            settings->threading = THREADING_FRAME;
+        else
+            argp_error(state, "unknown threading '%s'", arg);
+        break;
+    case SHORT_PROFILE:
+        if (strcmp(arg, "default") == 0)
+            settings->profile = PROFILE_DEFAULT;
+        else if (strcmp(arg, "low-latency") == 0)
+            settings->profile = PROFILE_LOW_LATENCY;
+        else
+            argp_error(state, "unknown profile '%s'", arg);
+        break;
+    case SHORT_LAYERS:
+        settings->layers = CLAMP(atoi(arg), 1, MAX_LAYERS);
+        break;
+    case SHORT_BENCHMARK:
+        settings->benchmark = MAX(atoi(arg), 1);
+        break;
 
     case ARGP_KEY_ARG:
-        if (state->arg_num >= NB_CLI_ARGS)
-            /* Too many arguments. */
-            argp_usage(state);
+    {
+        const char *colon = strrchr(arg, ':');
 
-        switch (state->arg_num)
+        // Given destinations replace the default one
+        if (state->arg_num == 0)
+            settings->n_destinations = 0;
+
+        if (colon != NULL)
         {
-        case 0:
-            settings->receiver_ip = arg;
-            break;
-        case 1:
-            const gint port = atoi(arg);
-            for (gint ii = 0; ii < NB_PORTS; ii++)
-                settings->receiver_ports[ii] = port + ii;
-            break;
-        default:
-            log_warn("Missing at least one positional argument transformation in the argument parser (it's the dev's fault...)");
+            if (settings->n_destinations >= MAX_DESTINATIONS)
+                argp_error(state, "at most %d receivers", MAX_DESTINATIONS);
+            destination_set(&settings->destinations[settings->n_destinations++], g_strndup(arg, colon - arg),
+                            atoi(colon + 1));
         }
-
-        break;
+        else if (state->arg_num == 0)
+        {
+            // RECEIVER_IP RECEIVER_PORT, the port comes next
+            settings->destinations[0].ip = arg;
+        }
+        else if (state->arg_num == 1 && settings->n_destinations == 0)
+        {
+            destination_set(&settings->destinations[settings->n_destinations++], settings->destinations[0].ip,
+                            atoi(arg));
+        }
+        else
+        {
+            argp_usage(state);
+        }
+    }
+    break;
 
     case ARGP_KEY_END:
-        if (state->arg_num < NB_CLI_ARGS)
+        if ((state->arg_num == 0 || settings->n_destinations == 0) && !settings->benchmark)
             /* Not enough arguments. */
             argp_usage(state);
+        // RTCP from one host to one local port cannot be told apart
+        for (gint d = 0; d < settings->n_destinations && !settings->bundle; d++)
+            for (gint e = d + 1; e < settings->n_destinations; e++)
+            {
+                const destination_t *a = &settings->destinations[d];
+                const destination_t *b = &settings->destinations[e];
+                if (g_strcmp0(a->ip, b->ip) == 0 &&
+                    (a->ports[2] == b->ports[2] || a->ports[2] == b->ports[5] || a->ports[5] == b->ports[2] ||
+                     a->ports[5] == b->ports[5]))
+                    argp_error(state, "receivers %s:%d and %s:%d share RTCP ports, use --bundle or other ports",
+                               a->ip, a->ports[0], b->ip, b->ports[0]);
+            }
         break;
 
     default:
@@ -560,6 +1660,12 @@ int main(int argc, char **argv)
 
     gst_init(NULL, NULL);
 
+    if (settings.benchmark)
+    {
+        benchmark(&settings);
+        return EXIT_SUCCESS;
+    }
+
     data_t *data = gstreamer_source_create(&settings);
 
     if (create_pipeline(data))
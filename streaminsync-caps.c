@@ -0,0 +1,190 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streaminsync.h"
+
+// Translates negotiated caps into an OBS frame/audio template. This is only
+// needed when the caps change, the appsink callbacks then copy the template
+// and fill in the data pointers and the timestamp.
+
+bool streaminsync_video_template(GstCaps *caps, GstVideoInfo *video_info,
+								 struct obs_source_frame *frame)
+{
+	memset(frame, 0, sizeof(*frame));
+
+	if (!gst_video_info_from_caps(video_info, caps))
+		return false;
+
+	frame->width = video_info->width;
+	frame->height = video_info->height;
+	frame->linesize[0] = video_info->stride[0];
+	frame->linesize[1] = video_info->stride[1];
+	frame->linesize[2] = video_info->stride[2];
+
+	enum video_range_type range = VIDEO_RANGE_DEFAULT;
+	switch (video_info->colorimetry.range)
+	{
+	case GST_VIDEO_COLOR_RANGE_0_255:
+		range = VIDEO_RANGE_FULL;
+		frame->full_range = 1;
+		break;
+	case GST_VIDEO_COLOR_RANGE_16_235:
+		range = VIDEO_RANGE_PARTIAL;
+		break;
+	default:
+		break;
+	}
+
+	enum video_colorspace cs = VIDEO_CS_DEFAULT;
+	switch (video_info->colorimetry.matrix)
+	{
+	case GST_VIDEO_COLOR_MATRIX_BT709:
+		cs = VIDEO_CS_709;
+		break;
+	case GST_VIDEO_COLOR_MATRIX_BT601:
+		cs = VIDEO_CS_601;
+		break;
+	default:
+		break;
+	}
+
+	video_format_get_parameters(cs, range, frame->color_matrix,
+								frame->color_range_min,
+								frame->color_range_max);
+
+	switch (video_info->finfo->format)
+	{
+	case GST_VIDEO_FORMAT_I420:
+		frame->format = VIDEO_FORMAT_I420;
+		break;
+	case GST_VIDEO_FORMAT_NV12:
+		frame->format = VIDEO_FORMAT_NV12;
+		break;
+	case GST_VIDEO_FORMAT_BGRA:
+		frame->format = VIDEO_FORMAT_BGRA;
+		break;
+	case GST_VIDEO_FORMAT_BGRx:
+		frame->format = VIDEO_FORMAT_BGRX;
+		break;
+	case GST_VIDEO_FORMAT_RGBx:
+	case GST_VIDEO_FORMAT_RGBA:
+		frame->format = VIDEO_FORMAT_RGBA;
+		break;
+	case GST_VIDEO_FORMAT_UYVY:
+		frame->format = VIDEO_FORMAT_UYVY;
+		break;
+	case GST_VIDEO_FORMAT_YUY2:
+		frame->format = VIDEO_FORMAT_YUY2;
+		break;
+	case GST_VIDEO_FORMAT_YVYU:
+		frame->format = VIDEO_FORMAT_YVYU;
+		break;
+	default:
+		frame->format = VIDEO_FORMAT_NONE;
+		blog(LOG_ERROR, "Unknown video format: %s",
+			 video_info->finfo->name);
+		break;
+	}
+
+	return true;
+}
+
+bool streaminsync_audio_template(GstCaps *caps, GstAudioInfo *audio_info,
+								 struct obs_source_audio *audio)
+{
+	memset(audio, 0, sizeof(*audio));
+
+	if (!gst_audio_info_from_caps(audio_info, caps))
+		return false;
+
+	audio->samples_per_sec = audio_info->rate;
+
+	switch (audio_info->channels)
+	{
+	case 1:
+		audio->speakers = SPEAKERS_MONO;
+		break;
+	case 2:
+		audio->speakers = SPEAKERS_STEREO;
+		break;
+	case 3:
+		audio->speakers = SPEAKERS_2POINT1;
+		break;
+	case 4:
+		audio->speakers = SPEAKERS_4POINT0;
+		break;
+	case 5:
+		audio->speakers = SPEAKERS_4POINT1;
+		break;
+	case 6:
+		audio->speakers = SPEAKERS_5POINT1;
+		break;
+	case 8:
+		audio->speakers = SPEAKERS_7POINT1;
+		break;
+	default:
+		audio->speakers = SPEAKERS_UNKNOWN;
+		blog(LOG_ERROR, "Unsupported channel count: %d",
+			 audio_info->channels);
+		break;
+	}
+
+	switch (audio_info->finfo->format)
+	{
+	case GST_AUDIO_FORMAT_U8:
+		audio->format = AUDIO_FORMAT_U8BIT;
+		break;
+	case GST_AUDIO_FORMAT_S16LE:
+		audio->format = AUDIO_FORMAT_16BIT;
+		break;
+	case GST_AUDIO_FORMAT_S32LE:
+		audio->format = AUDIO_FORMAT_32BIT;
+		break;
+	case GST_AUDIO_FORMAT_F32LE:
+		audio->format = AUDIO_FORMAT_FLOAT;
+		break;
+	default:
+		audio->format = AUDIO_FORMAT_UNKNOWN;
+		blog(LOG_ERROR, "Unknown audio format: %s",
+			 audio_info->finfo->name);
+		break;
+	}
+
+	return true;
+}
+
+// A black frame of the given size, 'frame->data[0]' is to be freed with
+// g_free().
+void streaminsync_placeholder_frame(guint32 width, guint32 height,
+									struct obs_source_frame *frame)
+{
+	memset(frame, 0, sizeof(*frame));
+
+	frame->width = width;
+	frame->height = height;
+	frame->format = VIDEO_FORMAT_Y800;
+	frame->full_range = 1;
+	frame->linesize[0] = width;
+	frame->data[0] = g_malloc0((gsize)width * height);
+
+	video_format_get_parameters(VIDEO_CS_DEFAULT, VIDEO_RANGE_FULL,
+								frame->color_matrix, frame->color_range_min,
+								frame->color_range_max);
+}
@@ -0,0 +1,294 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gst/net/gstnet.h>
+
+#include "streaminsync.h"
+
+// Process-wide pipeline clocks, one per clock source. Every pipeline using
+// the same source shares the same, already synchronised, clock instead of
+// converging again on every restart. Pipelines get their clock right away:
+// until it has converged it runs from the local wall clock, which is close
+// enough to start with, and gets corrected underway.
+
+// How long an unused clock stays around, so that stopping and starting a
+// source (settings update, show/hide) does not lose synchronisation.
+#define CLOCK_LINGER (60 * G_USEC_PER_SEC)
+
+// Seconds from the NTP epoch (1900) to the Unix one (1970)
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT(2208988800)
+
+typedef struct
+{
+	gchar *name;
+	GstClock *clock;
+	GstNetTimeProvider *provider;
+	GstBus *bus;
+	GSource *watch;
+	gint source;
+	gint64 created;
+	// In us, the strictest of its users, see streaminsync_clock_acquire()
+	gint threshold;
+	gint converged;
+	gint refcount;
+	gint64 idle_since;
+} entry_t;
+
+static GMutex clocks_mutex;
+static GHashTable *clocks;
+
+// Called without clocks_mutex: entries are freed with it held, waiting for
+// the dispatcher thread.
+static void report_converged(entry_t *entry, GstClockTimeDiff offset)
+{
+	if (!g_atomic_int_compare_and_exchange(&entry->converged, FALSE, TRUE))
+		return;
+
+	blog(LOG_INFO,
+		 "Clock %s synchronised to %" G_GINT64_FORMAT " us after %" G_GINT64_FORMAT
+		 " ms",
+		 entry->name, ABS(offset) / GST_USECOND,
+		 (g_get_monotonic_time() - entry->created) / G_TIME_SPAN_MILLISECOND);
+}
+
+// Statistics of network clients, on the dispatcher thread
+static gboolean clock_bus_callback(GstBus *bus, GstMessage *message,
+								   gpointer user_data)
+{
+	entry_t *entry = user_data;
+	const GstStructure *s = gst_message_get_structure(message);
+	gboolean synchronised = FALSE;
+	gint64 offset = 0;
+
+	if (s == NULL || !gst_structure_has_name(s, "gst-netclock-statistics"))
+		return TRUE;
+
+	gst_structure_get_boolean(s, "synchronised", &synchronised);
+	gst_structure_get_int64(s, "local-clock-offset", &offset);
+
+	if (synchronised &&
+		ABS(offset) < (GstClockTimeDiff)(g_atomic_int_get(&entry->threshold) *
+										  GST_USECOND))
+		report_converged(entry, offset);
+
+	return TRUE;
+}
+
+// PTP has no offset statistics, its own sync is all there is to report.
+static void on_synced(GstClock *clock, gboolean synced, gpointer user_data)
+{
+	if (synced)
+		report_converged(user_data, 0);
+}
+
+// Runs on the dispatcher thread, so no callback is in flight once it is gone
+static gboolean entry_unwatch(gpointer user_data)
+{
+	entry_t *entry = user_data;
+
+	g_source_destroy(entry->watch);
+	g_source_unref(entry->watch);
+	entry->watch = NULL;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void entry_free(gpointer user_data)
+{
+	entry_t *entry = user_data;
+
+	if (entry->watch)
+		gstreamer_dispatcher_invoke_sync(entry_unwatch, entry);
+	if (entry->bus)
+		gst_object_unref(entry->bus);
+	if (entry->provider)
+		gst_object_unref(entry->provider);
+
+	g_signal_handlers_disconnect_by_data(entry->clock, entry);
+	gst_object_unref(entry->clock);
+	g_free(entry->name);
+	g_free(entry);
+}
+
+static gboolean entry_expired(gpointer key, gpointer value, gpointer user_data)
+{
+	entry_t *entry = value;
+	gint64 now = *(gint64 *)user_data;
+
+	return entry->refcount == 0 && now - entry->idle_since > CLOCK_LINGER;
+}
+
+static void watch_statistics(entry_t *entry)
+{
+	entry->bus = gst_bus_new();
+	g_object_set(entry->clock, "bus", entry->bus, NULL);
+
+	entry->watch = gst_bus_create_watch(entry->bus);
+	g_source_set_callback(entry->watch, (GSourceFunc)clock_bus_callback,
+						  entry, NULL);
+	g_source_attach(entry->watch, gstreamer_dispatcher_get_context());
+}
+
+static void entry_create(entry_t *entry,
+						 const streaminsync_clock_config_t *config)
+{
+	// Wall clock now, as the provisional time of a clock still converging
+	const GstClockTime now = g_get_real_time() * GST_USECOND;
+
+	switch (config->source)
+	{
+	case STREAMINSYNC_CLOCK_HOST:
+		// The senders slave to this one, ours is the reference
+		entry->clock = g_object_new(GST_TYPE_SYSTEM_CLOCK, "name",
+									entry->name, "clock-type",
+									GST_CLOCK_TYPE_REALTIME, NULL);
+		entry->provider =
+			gst_net_time_provider_new(entry->clock, NULL, config->port);
+		if (entry->provider == NULL)
+			blog(LOG_ERROR, "Cannot provide the clock on port %d",
+				 config->port);
+		else
+			blog(LOG_INFO, "Providing the clock on port %d", config->port);
+		entry->converged = TRUE;
+		break;
+	case STREAMINSYNC_CLOCK_PTP:
+		if (!gst_ptp_is_initialized() &&
+			!gst_ptp_init(GST_PTP_CLOCK_ID_NONE, NULL))
+			blog(LOG_ERROR, "Cannot initialise PTP");
+		entry->clock = gst_ptp_clock_new(entry->name, config->port);
+		g_signal_connect(entry->clock, "synced", G_CALLBACK(on_synced),
+						 entry);
+		break;
+	default:
+		entry->clock = gst_ntp_clock_new(
+			entry->name, config->address, config->port,
+			now + NTP_UNIX_OFFSET * GST_SECOND);
+		watch_statistics(entry);
+		break;
+	}
+
+	blog(LOG_INFO, "Created clock %s", entry->name);
+}
+
+// Sources sharing a clock share its report, the strictest accuracy asked
+// for wins. NTP reports it again once reached, PTP has no offset to hold it
+// to. Called with clocks_mutex.
+static void entry_require(entry_t *entry, gint threshold)
+{
+	if (threshold >= entry->threshold)
+		return;
+
+	g_atomic_int_set(&entry->threshold, threshold);
+	if (entry->source == STREAMINSYNC_CLOCK_NTP)
+		g_atomic_int_set(&entry->converged, FALSE);
+}
+
+GstClock *streaminsync_clock_acquire(const streaminsync_clock_config_t *config)
+{
+	gchar *key;
+	gint64 now = g_get_monotonic_time();
+
+	if (config->source == STREAMINSYNC_CLOCK_HOST)
+		key = g_strdup_printf("host:%d", config->port);
+	else if (config->source == STREAMINSYNC_CLOCK_PTP)
+		key = g_strdup_printf("ptp:%d", config->port);
+	else
+		key = g_strdup_printf("ntp:%s:%d", config->address, config->port);
+
+	g_mutex_lock(&clocks_mutex);
+
+	if (clocks == NULL)
+		clocks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+									   entry_free);
+
+	g_hash_table_foreach_remove(clocks, entry_expired, &now);
+
+	entry_t *entry = g_hash_table_lookup(clocks, key);
+	if (entry == NULL)
+	{
+		entry = g_new0(entry_t, 1);
+		entry->name = g_strdup(key);
+		entry->source = config->source;
+		entry->created = now;
+		entry->threshold = config->threshold;
+		entry_create(entry, config);
+		g_hash_table_insert(clocks, g_strdup(key), entry);
+	}
+	else
+	{
+		entry_require(entry, config->threshold);
+	}
+
+	entry->refcount++;
+	GstClock *clock = gst_object_ref(entry->clock);
+
+	g_mutex_unlock(&clocks_mutex);
+
+	g_free(key);
+
+	return clock;
+}
+
+static gboolean entry_has_clock(gpointer key, gpointer value,
+								gpointer user_data)
+{
+	return ((entry_t *)value)->clock == user_data;
+}
+
+void streaminsync_clock_release(GstClock *clock)
+{
+	if (clock == NULL)
+		return;
+
+	g_mutex_lock(&clocks_mutex);
+
+	entry_t *entry =
+		clocks ? g_hash_table_find(clocks, entry_has_clock, clock) : NULL;
+	if (entry && --entry->refcount == 0)
+		entry->idle_since = g_get_monotonic_time();
+
+	g_mutex_unlock(&clocks_mutex);
+
+	gst_object_unref(clock);
+}
+
+// For another user of a clock already acquired, a shared receiver's streams
+void streaminsync_clock_require(GstClock *clock, gint threshold)
+{
+	g_mutex_lock(&clocks_mutex);
+
+	entry_t *entry =
+		clocks ? g_hash_table_find(clocks, entry_has_clock, clock) : NULL;
+	if (entry)
+		entry_require(entry, threshold);
+
+	g_mutex_unlock(&clocks_mutex);
+}
+
+void streaminsync_clock_cleanup(void)
+{
+	g_mutex_lock(&clocks_mutex);
+
+	if (clocks)
+		g_hash_table_destroy(clocks);
+	clocks = NULL;
+
+	g_mutex_unlock(&clocks_mutex);
+}
@@ -0,0 +1,242 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streaminsync.h"
+
+// H.264 decoder selection and the decoding chain of the stream-in-sync
+// receiver.
+
+// Frames a stage queue holds, enough to even out a stage that is slow on
+// some frames without adding much latency
+#define STAGE_QUEUE_BUFFERS 3
+
+typedef struct
+{
+	const char *factory;
+	const char *description;
+} decoder_t;
+
+// Decoders we know how to name in the UI, in no particular order. Anything
+// else the registry offers is still reachable through "auto".
+static const decoder_t known_decoders[] = {
+	{"avdec_h264", "FFmpeg (CPU)"},
+	{"openh264dec", "OpenH264 (CPU)"},
+	{"nvh264dec", "NVIDIA (NVDEC)"},
+	{"vah264dec", "VA"},
+	{"vaapih264dec", "VA-API"},
+	{"msdkh264dec", "Intel Media SDK"},
+	{"d3d11h264dec", "Direct3D 11"},
+	{"vtdec", "Apple (VideoToolBox)"},
+	{"v4l2h264dec", "V4L2"},
+};
+
+static bool check_feature(const char *name)
+{
+	GstRegistry *registry = gst_registry_get();
+	GstPluginFeature *feature = gst_registry_lookup_feature(registry, name);
+
+	if (feature)
+	{
+		gst_object_unref(feature);
+		return true;
+	}
+
+	return false;
+}
+
+// All decoder factories able to take H.264, highest rank first.
+static GList *list_h264_decoders(void)
+{
+	GList *decoders = gst_element_factory_list_get_elements(
+		GST_ELEMENT_FACTORY_TYPE_DECODER |
+			GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO,
+		GST_RANK_MARGINAL);
+
+	GstCaps *caps = gst_caps_new_empty_simple("video/x-h264");
+	GList *h264 =
+		gst_element_factory_list_filter(decoders, caps, GST_PAD_SINK, FALSE);
+	gst_caps_unref(caps);
+	gst_plugin_feature_list_free(decoders);
+
+	return g_list_sort(h264, gst_plugin_feature_rank_compare_func);
+}
+
+void streaminsync_decoder_add_list(obs_property_t *prop)
+{
+	obs_property_list_add_string(prop, "Automatic (highest rank)", "auto");
+
+	GList *decoders = list_h264_decoders();
+
+	for (GList *l = decoders; l != NULL; l = l->next)
+	{
+		const gchar *name = gst_plugin_feature_get_name(l->data);
+		const gchar *description = name;
+
+		for (size_t i = 0; i < G_N_ELEMENTS(known_decoders); i++)
+		{
+			if (g_strcmp0(known_decoders[i].factory, name) == 0)
+				description = known_decoders[i].description;
+		}
+
+		obs_property_list_add_string(prop, description, name);
+	}
+
+	gst_plugin_feature_list_free(decoders);
+}
+
+static void set_if_exists(GstElement *element, const char *name, gint value)
+{
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), name))
+		g_object_set(element, name, value, NULL);
+}
+
+// Threads to give a decoder when the user left it on automatic: split the
+// cores evenly between the sources that are currently decoding.
+gint streaminsync_decoder_auto_threads(gint active_sources)
+{
+	gint cores = g_get_num_processors();
+
+	return MAX(1, cores / MAX(1, active_sources));
+}
+
+// Creates the decoder named by 'name' ("auto" picks the highest ranked one),
+// falling back to avdec_h264. 'threads' of 0 means auto-size and
+// 'thread_type' follows avdec's flags (0 auto, 1 frame, 2 slice). Threading
+// options are ignored by decoders that do not have them.
+GstElement *streaminsync_decoder_make(const char *name, gint threads,
+									  gint thread_type, gint active_sources)
+{
+	GstElement *decoder = NULL;
+
+	if (name == NULL || g_strcmp0(name, "auto") == 0)
+	{
+		GList *decoders = list_h264_decoders();
+
+		for (GList *l = decoders; l != NULL && decoder == NULL; l = l->next)
+			decoder = gst_element_factory_create(l->data, NULL);
+
+		gst_plugin_feature_list_free(decoders);
+	}
+	else if (check_feature(name))
+	{
+		decoder = gst_element_factory_make(name, NULL);
+	}
+
+	if (decoder == NULL)
+	{
+		blog(LOG_WARNING, "H.264 decoder '%s' not available, using avdec_h264",
+			 name ? name : "auto");
+		decoder = gst_element_factory_make("avdec_h264", NULL);
+	}
+
+	if (decoder == NULL)
+		return NULL;
+
+	if (threads <= 0)
+		threads = streaminsync_decoder_auto_threads(active_sources);
+
+	set_if_exists(decoder, "max-threads", threads);
+	if (thread_type > 0)
+		set_if_exists(decoder, "thread-type", thread_type);
+
+	blog(LOG_INFO, "Using H.264 decoder %s (%d threads)",
+		 GST_OBJECT_NAME(gst_element_get_factory(decoder)), threads);
+
+	return decoder;
+}
+
+// Bounded queue in front of a stage of the decoding chain. Blocking, it holds
+// the stage before it back as a direct link would, otherwise it drops its
+// oldest frame so that a slow stage costs frames rather than latency.
+static GstElement *stage_queue_new(const char *name, gboolean block)
+{
+	GstElement *queue = gst_element_factory_make("queue", name);
+
+	if (queue == NULL)
+		return NULL;
+
+	g_object_set(queue, "max-size-buffers", STAGE_QUEUE_BUFFERS,
+				 "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+	g_object_set(queue, "leaky", block ? 0 : 2, NULL);
+
+	return queue;
+}
+
+// Adds the colour conversion after 'decoder' in 'bin' and links them to
+// 'sink'. Serial, decoding, conversion and 'sink' all run on the streaming
+// thread that feeds the decoder. Pipelined, a queue in front of the
+// conversion and one in front of 'sink' give each its own thread, and the
+// conversion gets 'threads' threads like the decoder (0 = auto-size).
+gboolean streaminsync_decoder_link(GstBin *bin, GstElement *decoder,
+								   GstElement *sink, gboolean pipelined,
+								   gint threads, gint active_sources,
+								   gboolean block)
+{
+	GstElement *conv = gst_element_factory_make("videoconvert", "convert");
+
+	if (conv == NULL)
+		return FALSE;
+
+	if (!pipelined)
+	{
+		gst_bin_add(bin, conv);
+		return gst_element_link_many(decoder, conv, sink, NULL);
+	}
+
+	GstElement *decoded = stage_queue_new("decoded", block);
+	GstElement *converted = stage_queue_new("converted", block);
+
+	if (decoded == NULL || converted == NULL)
+	{
+		gst_object_unref(conv);
+		if (decoded)
+			gst_object_unref(decoded);
+		if (converted)
+			gst_object_unref(converted);
+		return FALSE;
+	}
+
+	if (threads <= 0)
+		threads = streaminsync_decoder_auto_threads(active_sources);
+	set_if_exists(conv, "n-threads", threads);
+
+	gst_bin_add_many(bin, decoded, conv, converted, NULL);
+
+	return gst_element_link_many(decoder, decoded, conv, converted, sink,
+								 NULL);
+}
+
+// Whether the stage queues of a chain made by streaminsync_decoder_link wait
+// for the stage after them or drop. Serial chains have none.
+void streaminsync_decoder_set_blocking(GstBin *bin, gboolean block)
+{
+	static const char *const names[] = {"decoded", "converted"};
+
+	for (gsize i = 0; i < G_N_ELEMENTS(names); i++)
+	{
+		GstElement *queue = gst_bin_get_by_name(bin, names[i]);
+
+		if (queue == NULL)
+			continue;
+
+		g_object_set(queue, "leaky", block ? 0 : 2, NULL);
+		gst_object_unref(queue);
+	}
+}
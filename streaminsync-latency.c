@@ -0,0 +1,333 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Adaptive playout latency. All receiving rtpbins are registered here and
+// polled from the dispatcher thread. The jitter they see decides on one
+// common latency which is applied to all of them, so that every sender keeps
+// being played out at the same offset from the NTP clock.
+
+#include "streaminsync.h"
+
+#define LATENCY_POLL_MS 1000
+// Headroom above the measured jitter, in ms
+#define LATENCY_MARGIN 20
+// Multiple of the mean jitter the buffer has to absorb
+#define LATENCY_JITTER_FACTOR 4
+// Minimum increase on late packets, in ms
+#define LATENCY_STEP 20
+// Polls to wait after an increase before the latency may go down again
+#define LATENCY_HOLD 10
+// Changes smaller than this many ms are not applied to the pipelines
+#define LATENCY_HYSTERESIS 10
+
+typedef struct
+{
+	GstElement *rtpbin;
+	streaminsync_latency_t config;
+	gint applied;
+	gboolean primed;
+	guint64 late;
+	// Round trip of retransmissions from the sender, and the one the RTX
+	// budget was set with
+	GstClockTime rtt;
+	GstClockTime budget_rtt;
+} controller_t;
+
+static GMutex mutex;
+static GList *controllers;
+static GSource *timer;
+// Common latency in ms, 0 as long as no adaptive pipeline is running
+static gint common;
+static gint hold;
+// The sources' bounds have nothing in common, see shared_bounds()
+static gboolean apart;
+
+static gint clamp_latency(const streaminsync_latency_t *config, gint latency)
+{
+	if (!config->adaptive)
+		return config->latency;
+
+	return CLAMP(latency, config->min, MAX(config->min, config->max));
+}
+
+// Latency every source can be played out at, the intersection of the
+// bounds of the adaptive ones and the fixed latency of the others. Without
+// one each source is kept within its own bounds and they drift apart, which
+// is logged once.
+static gboolean shared_bounds(gint *lower, gint *upper)
+{
+	*lower = 0;
+	*upper = G_MAXINT;
+
+	for (GList *l = controllers; l != NULL; l = l->next)
+	{
+		const streaminsync_latency_t *config =
+			&((controller_t *)l->data)->config;
+
+		*lower = MAX(*lower, config->adaptive ? config->min : config->latency);
+		*upper = MIN(*upper, config->adaptive
+								 ? MAX(config->min, config->max)
+								 : config->latency);
+	}
+
+	if ((*lower > *upper) != apart)
+	{
+		apart = *lower > *upper;
+		if (apart)
+			blog(LOG_WARNING,
+				 "Playout latency bounds of the sources do not overlap "
+				 "(highest minimum %d ms, lowest maximum %d ms), they cannot "
+				 "share a common playout offset",
+				 *lower, *upper);
+		else
+			blog(LOG_INFO, "Sources share a common playout offset again");
+	}
+
+	return !apart;
+}
+
+// Brings the common latency within the shared bounds after they changed
+static void fit_common(void)
+{
+	gint lower;
+	gint upper;
+
+	if (shared_bounds(&lower, &upper) && common > 0)
+		common = CLAMP(common, lower, upper);
+}
+
+static void apply(void)
+{
+	for (GList *l = controllers; l != NULL; l = l->next)
+	{
+		controller_t *controller = l->data;
+		const gint latency = clamp_latency(&controller->config, common);
+		const gint rtt_change = (gint)(ABS((gint64)controller->rtt -
+										   (gint64)controller->budget_rtt) /
+									   GST_MSECOND);
+
+		if (ABS(latency - controller->applied) >= LATENCY_HYSTERESIS)
+		{
+			// rtpbin hands this on to all of its jitterbuffers
+			g_object_set(controller->rtpbin, "latency", latency, NULL);
+			controller->applied = latency;
+		}
+		else if (rtt_change < LATENCY_HYSTERESIS)
+		{
+			continue;
+		}
+
+		streaminsync_rtx_budget(controller->rtpbin, controller->applied,
+								controller->rtt);
+		controller->budget_rtt = controller->rtt;
+	}
+}
+
+static gboolean poll_latency(gpointer user_data)
+{
+	gint target = 0;
+	gint lower;
+	gint upper;
+	gboolean adaptive = FALSE;
+	gboolean late = FALSE;
+	streaminsync_stats_t worst = {0};
+
+	g_mutex_lock(&mutex);
+
+	for (GList *l = controllers; l != NULL; l = l->next)
+	{
+		controller_t *controller = l->data;
+		streaminsync_stats_t stats = {0};
+
+		streaminsync_stats_rtp(controller->rtpbin, G_MAXUINT, 0, &stats);
+		controller->rtt = stats.rtt;
+
+		if (!controller->config.adaptive)
+			continue;
+
+		// Late packets mean the buffer is too short. Lost packets alone
+		// are not a reason to wait longer, waiting does not bring them
+		// back.
+		if (controller->primed && stats.late > controller->late)
+			late = TRUE;
+		controller->late = stats.late;
+		controller->primed = TRUE;
+
+		// Give a retransmission the time of a round trip, see
+		// streaminsync_rtx_budget()
+		gint need = LATENCY_MARGIN + LATENCY_JITTER_FACTOR *
+										 (gint)(stats.jitter / GST_MSECOND);
+		need = MAX(need, LATENCY_MARGIN + (gint)(stats.rtt / GST_MSECOND));
+
+		target = MAX(target, need);
+		adaptive = TRUE;
+
+		worst.jitter = MAX(worst.jitter, stats.jitter);
+		worst.rtt = MAX(worst.rtt, stats.rtt);
+		worst.late += stats.late;
+		worst.lost += stats.lost;
+	}
+
+	const gboolean shared = shared_bounds(&lower, &upper);
+
+	if (!adaptive)
+	{
+		// Only fixed latencies, which still bound the RTX budget
+		apply();
+	}
+	else
+	{
+		const gint previous = common;
+
+		if (late)
+		{
+			common = MAX(target, common + MAX(common / 4, LATENCY_STEP));
+			hold = LATENCY_HOLD;
+		}
+		else if (target > common)
+		{
+			common = target;
+			hold = LATENCY_HOLD;
+		}
+		else if (hold > 0)
+		{
+			hold--;
+		}
+		else
+		{
+			// Ease down so a short calm spell does not empty the buffer
+			common -= (common - target) / 4;
+		}
+
+		// Each source clamps it to its own bounds otherwise, see apply()
+		if (shared)
+			common = CLAMP(common, lower, upper);
+		else
+			common = MIN(common, STREAMINSYNC_LATENCY_MAX);
+
+		if (ABS(common - previous) >= LATENCY_HYSTERESIS)
+			blog(LOG_INFO,
+				 "Playout latency %d ms (jitter %" G_GUINT64_FORMAT
+				 " ms, rtt %" G_GUINT64_FORMAT " ms, late %" G_GUINT64_FORMAT
+				 ", lost %" G_GUINT64_FORMAT ")",
+				 common, worst.jitter / GST_MSECOND, worst.rtt / GST_MSECOND,
+				 worst.late, worst.lost);
+
+		apply();
+	}
+
+	g_mutex_unlock(&mutex);
+
+	return G_SOURCE_CONTINUE;
+}
+
+// Latency a new pipeline is to be created with: the common one if other
+// pipelines are already running, so that it joins them in sync.
+gint streaminsync_latency_initial(const streaminsync_latency_t *config)
+{
+	g_mutex_lock(&mutex);
+	const gint latency = common > 0 ? common : config->latency;
+	g_mutex_unlock(&mutex);
+
+	return clamp_latency(config, latency);
+}
+
+void streaminsync_latency_add(GstElement *rtpbin,
+							  const streaminsync_latency_t *config)
+{
+	controller_t *controller = g_new0(controller_t, 1);
+	guint latency;
+
+	g_object_get(rtpbin, "latency", &latency, NULL);
+
+	controller->rtpbin = gst_object_ref(rtpbin);
+	controller->config = *config;
+	controller->applied = latency;
+
+	g_mutex_lock(&mutex);
+
+	if (common == 0 && config->adaptive)
+		common = latency;
+
+	controllers = g_list_prepend(controllers, controller);
+	fit_common();
+
+	if (timer == NULL)
+	{
+		timer = g_timeout_source_new(LATENCY_POLL_MS);
+		g_source_set_callback(timer, poll_latency, NULL, NULL);
+		g_source_attach(timer, gstreamer_dispatcher_get_context());
+	}
+
+	g_mutex_unlock(&mutex);
+}
+
+// New bounds or fixed latency for a registered rtpbin, applied right away.
+void streaminsync_latency_update(GstElement *rtpbin,
+								 const streaminsync_latency_t *config)
+{
+	g_mutex_lock(&mutex);
+
+	for (GList *l = controllers; l != NULL; l = l->next)
+	{
+		controller_t *controller = l->data;
+
+		if (controller->rtpbin == rtpbin)
+			controller->config = *config;
+	}
+
+	if (common == 0 && config->adaptive)
+		common = clamp_latency(config, config->latency);
+
+	fit_common();
+	apply();
+
+	g_mutex_unlock(&mutex);
+}
+
+void streaminsync_latency_remove(GstElement *rtpbin)
+{
+	g_mutex_lock(&mutex);
+
+	for (GList *l = controllers; l != NULL; l = l->next)
+	{
+		controller_t *controller = l->data;
+
+		if (controller->rtpbin != rtpbin)
+			continue;
+
+		controllers = g_list_delete_link(controllers, l);
+		gst_object_unref(controller->rtpbin);
+		g_free(controller);
+		break;
+	}
+
+	if (controllers == NULL && timer != NULL)
+	{
+		g_source_destroy(timer);
+		g_source_unref(timer);
+		timer = NULL;
+
+		common = 0;
+		hold = 0;
+	}
+
+	g_mutex_unlock(&mutex);
+}
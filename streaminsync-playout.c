@@ -0,0 +1,68 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Playout scheduling. The appsinks hold every sample until it is due on the
+// pipeline clock, which is shared with the senders and with the other
+// sources, at a latency that is the same for all of them. Handing OBS that
+// instant on its own timeline, instead of a time relative to the stream,
+// lines all sources up with each other and lets OBS show them as they come
+// without buffering of its own.
+
+#include <gst/base/gstbasesink.h>
+#include <obs/util/platform.h>
+
+#include "streaminsync.h"
+
+guint64 streaminsync_playout_time(GstAppSink *appsink, GstSample *sample)
+{
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	const GstSegment *segment = gst_sample_get_segment(sample);
+
+	if (buffer == NULL || segment == NULL || !GST_BUFFER_PTS_IS_VALID(buffer))
+		return 0;
+
+	const GstClockTime running = gst_segment_to_running_time(
+		segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+	if (!GST_CLOCK_TIME_IS_VALID(running))
+		return 0;
+
+	GstClock *clock = gst_element_get_clock(GST_ELEMENT(appsink));
+	if (clock == NULL)
+		return 0;
+
+	// Capture time on the shared clock plus the playout latency, the same
+	// deadline the sink synchronised on
+	const GstClockTime due = running +
+							 gst_element_get_base_time(GST_ELEMENT(appsink)) +
+							 gst_base_sink_get_latency(GST_BASE_SINK(appsink));
+
+	// Read back to back, the two clocks map onto each other through the
+	// difference
+	const GstClockTime now = gst_clock_get_time(clock);
+	const guint64 os_now = os_gettime_ns();
+
+	gst_object_unref(clock);
+
+	const GstClockTimeDiff ahead = GST_CLOCK_DIFF(now, due);
+	if (ahead < 0 && (guint64)-ahead > os_now)
+		return 0;
+
+	return os_now + ahead;
+}
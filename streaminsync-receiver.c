@@ -0,0 +1,1679 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <gst/net/gstnet.h>
+
+#include "streaminsync.h"
+
+// Receiving side building blocks, and the shared receiver: one pipeline and
+// one rtpbin per port base, serving every source that attached to it. All
+// senders send to the same ports and are told apart by their SSRC, which is
+// the stream id a source attaches with.
+
+typedef struct receiver receiver_t;
+
+// One rtpbin output pad and what it is currently linked to.
+typedef struct
+{
+	GstPad *pad;
+	guint session;
+	guint32 ssrc;
+	// Simulcast layer of video, only layer 0 is handed over
+	gint layer;
+	GstElement *sink;
+	streaminsync_stream_t *stream;
+	// Held by the route list and by every swap in progress, see route_hold()
+	gint refcount;
+	// Pad gone while the route was held, the last holder removes the sink
+	gboolean removed;
+	// A sink is being swapped in, the next one waits in 'pending'
+	gboolean swapping;
+	GstElement *pending;
+} route_t;
+
+struct receiver
+{
+	gint port;
+	gboolean bundle;
+	gint refcount;
+	gint stopping;
+	GstElement *pipe;
+	GstElement *rtpbin;
+	GstElement *rtcp_sinks[2];
+	GstClock *clock;
+	GList *streams;
+	GList *routes;
+	GSource *watch;
+};
+
+struct streaminsync_stream
+{
+	receiver_t *receiver;
+	guint32 ssrc;
+	gchar *sender_ip;
+	gchar *decoder;
+	streaminsync_sink_t sink;
+};
+
+// Protects the receivers table as well as the stream and route lists of
+// every receiver.
+static GMutex receivers_mutex;
+static GHashTable *receivers;
+// Ports of receivers being torn down, which no new receiver may bind before
+// their sockets are closed. Signalled on receivers_cond once they are.
+static GHashTable *closing;
+static GCond receivers_cond;
+
+GstCaps *streaminsync_rtp_caps(guint session)
+{
+	if (session == STREAMINSYNC_SESSION_VIDEO)
+		return gst_caps_new_simple("application/x-rtp",
+								   "media", G_TYPE_STRING, "video",
+								   "clock-rate", G_TYPE_INT, 90000,
+								   "encoding-name", G_TYPE_STRING, "H264",
+								   "payload", G_TYPE_INT, STREAMINSYNC_VIDEO_PT,
+								   "extmap-" G_STRINGIFY(STREAMINSYNC_TWCC_ID),
+								   G_TYPE_STRING, STREAMINSYNC_TWCC_URI, NULL);
+
+	return gst_caps_new_simple("application/x-rtp",
+							   "media", G_TYPE_STRING, "audio",
+							   "clock-rate", G_TYPE_INT, 48000,
+							   "encoding-name", G_TYPE_STRING, "OPUS",
+							   "payload", G_TYPE_INT, STREAMINSYNC_AUDIO_PT,
+							   NULL);
+}
+
+// Media session a payload type of 'session' belongs to. Bundled streams
+// carry both media in the video session.
+static guint media_session(guint session, guint pt)
+{
+	if (session == STREAMINSYNC_SESSION_AUDIO ||
+		pt == STREAMINSYNC_AUDIO_PT || pt == STREAMINSYNC_AUDIO_RTX_PT)
+		return STREAMINSYNC_SESSION_AUDIO;
+
+	return STREAMINSYNC_SESSION_VIDEO;
+}
+
+// Caps for the payload types the udpsrc caps do not describe, which is all
+// of them on a bundled socket.
+static GstCaps *on_request_pt_map(GstElement *rtpbin, guint session,
+								  guint pt, gpointer user_data)
+{
+	GstCaps *caps = streaminsync_rtp_caps(media_session(session, pt));
+
+	gst_caps_set_simple(caps, "payload", G_TYPE_INT, pt, NULL);
+
+	return caps;
+}
+
+// rtprtxreceive in front of a session turns RTX packets back into the
+// original stream before the jitterbuffer sees them.
+static GstElement *on_request_aux_receiver(GstElement *rtpbin, guint session,
+										   gpointer user_data)
+{
+	GstElement *rtx = gst_element_factory_make("rtprtxreceive", NULL);
+	gchar *name;
+	GstPad *pad;
+
+	if (!rtx)
+	{
+		blog(LOG_WARNING, "rtprtxreceive missing, no retransmission");
+		return NULL;
+	}
+
+	GstElement *bin = gst_bin_new(NULL);
+
+	// Both media, either may come in a bundled session, and the video
+	// layers of a simulcast sender
+	GstStructure *map = gst_structure_new(
+		"application/x-rtp-pt-map",
+		G_STRINGIFY(STREAMINSYNC_VIDEO_PT), G_TYPE_UINT,
+		STREAMINSYNC_VIDEO_RTX_PT,
+		G_STRINGIFY(STREAMINSYNC_AUDIO_PT), G_TYPE_UINT,
+		STREAMINSYNC_AUDIO_RTX_PT, NULL);
+	for (gint layer = 1; layer < STREAMINSYNC_MAX_LAYERS; layer++)
+	{
+		gchar *pt = g_strdup_printf("%d", STREAMINSYNC_LAYER_PT(layer));
+		gst_structure_set(map, pt, G_TYPE_UINT,
+						  STREAMINSYNC_LAYER_RTX_PT(layer), NULL);
+		g_free(pt);
+	}
+	g_object_set(rtx, "payload-type-map", map, NULL);
+	gst_structure_free(map);
+
+	gst_bin_add(GST_BIN(bin), rtx);
+
+	pad = gst_element_get_static_pad(rtx, "src");
+	name = g_strdup_printf("src_%u", session);
+	gst_element_add_pad(bin, gst_ghost_pad_new(name, pad));
+	g_free(name);
+	gst_object_unref(pad);
+
+	pad = gst_element_get_static_pad(rtx, "sink");
+	name = g_strdup_printf("sink_%u", session);
+	gst_element_add_pad(bin, gst_ghost_pad_new(name, pad));
+	g_free(name);
+	gst_object_unref(pad);
+
+	return bin;
+}
+
+// rtpulpfecdec after the jitterbuffer rebuilds the packets it reports lost
+// from the FEC and media packets rtpbin keeps in the session's storage.
+// Without FEC from the sender it has nothing to do.
+static GstElement *on_request_fec_decoder(GstElement *rtpbin, guint session,
+										  gpointer user_data)
+{
+	GstElement *fecdec = gst_element_factory_make("rtpulpfecdec", NULL);
+	GObject *storage = NULL;
+
+	if (!fecdec)
+		return NULL;
+
+	g_signal_emit_by_name(rtpbin, "get-internal-storage", session, &storage);
+	g_object_set(fecdec, "pt", STREAMINSYNC_FEC_PT, "storage", storage,
+				 NULL);
+	if (storage)
+		g_object_unref(storage);
+
+	return fecdec;
+}
+
+// Keeps the received packets around for as long as they may be played out
+static void on_new_storage(GstElement *rtpbin, GstElement *storage,
+						   guint session, gpointer user_data)
+{
+	g_object_set(storage, "size-time",
+				 (guint64)STREAMINSYNC_LATENCY_MAX * GST_MSECOND, NULL);
+}
+
+// Round trip time in ms the retransmission budget was last computed with,
+// kept on the rtpbin for jitterbuffers created later on.
+#define RTX_RTT_KEY "streaminsync-rtx-rtt"
+
+static void set_rtx_budget(GstElement *jitterbuffer, gint latency, gint rtt)
+{
+	// A retransmission requested later than a round trip before the
+	// packet's playout time arrives too late to be used. Without that much
+	// room there is no point asking at all.
+	const gint period = latency - rtt;
+
+	if (period <= 0)
+	{
+		g_object_set(jitterbuffer, "do-retransmission", FALSE, NULL);
+		return;
+	}
+
+	g_object_set(jitterbuffer,
+				 "do-retransmission", TRUE,
+				 "rtx-retry-period", period,
+				 "rtx-deadline", latency,
+				 NULL);
+}
+
+static void on_new_jitterbuffer(GstElement *rtpbin, GstElement *jitterbuffer,
+								guint session, guint ssrc, gpointer user_data)
+{
+	guint latency;
+
+	g_object_get(rtpbin, "latency", &latency, NULL);
+	set_rtx_budget(jitterbuffer, latency,
+				   GPOINTER_TO_INT(g_object_get_data(G_OBJECT(rtpbin),
+													 RTX_RTT_KEY)));
+}
+
+// Fits the retransmission requests of every jitterbuffer of rtpbin into
+// 'latency', so that recovering a packet never delays playout further. 'rtt'
+// is what retransmissions took so far, 0 before the first one.
+void streaminsync_rtx_budget(GstElement *rtpbin, gint latency,
+							 GstClockTime rtt)
+{
+	const gint rtt_ms = (gint)(rtt / GST_MSECOND);
+	GstIterator *it = gst_bin_iterate_all_by_element_factory_name(
+		GST_BIN(rtpbin), "rtpjitterbuffer");
+	GValue item = G_VALUE_INIT;
+
+	g_object_set_data(G_OBJECT(rtpbin), RTX_RTT_KEY, GINT_TO_POINTER(rtt_ms));
+
+	while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+	{
+		set_rtx_budget(g_value_get_object(&item), latency, rtt_ms);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(it);
+}
+
+GstElement *streaminsync_rtpbin_new(gint latency)
+{
+	GstElement *rtpbin = gst_element_factory_make("rtpbin", NULL);
+	if (!rtpbin)
+		return NULL;
+
+	g_object_set(rtpbin, "latency", latency, NULL);
+	g_object_set(rtpbin, "rtp-profile", 3, NULL); // RTP/AVPF, early feedback
+	g_object_set(rtpbin, "ntp-time-source", 3, NULL); // clock-time
+	g_object_set(rtpbin, "ntp-sync", TRUE, NULL);
+	g_object_set(rtpbin, "buffer-mode", 4, NULL); // synced
+	// NACK lost packets, the sender answers with RTX
+	g_object_set(rtpbin, "do-retransmission", TRUE, NULL);
+	// Lost packet events, which trigger FEC recovery
+	g_object_set(rtpbin, "do-lost", TRUE, NULL);
+
+	g_signal_connect(rtpbin, "request-pt-map",
+					 G_CALLBACK(on_request_pt_map), NULL);
+	g_signal_connect(rtpbin, "request-aux-receiver",
+					 G_CALLBACK(on_request_aux_receiver), NULL);
+	g_signal_connect(rtpbin, "new-jitterbuffer",
+					 G_CALLBACK(on_new_jitterbuffer), NULL);
+	g_signal_connect(rtpbin, "request-fec-decoder",
+					 G_CALLBACK(on_request_fec_decoder), NULL);
+	g_signal_connect(rtpbin, "new-storage", G_CALLBACK(on_new_storage),
+					 NULL);
+
+	return rtpbin;
+}
+
+// A sender RTCP goes to in bundle mode
+typedef struct
+{
+	GInetAddress *address;
+	gchar *host;
+	gint port;
+	gint64 seen;
+} client_t;
+
+// Return path of a bundled socket: every address packets came from lately.
+typedef struct
+{
+	GstElement *sink;
+	GMutex mutex;
+	GList *clients;
+	gint64 pruned;
+} bundle_t;
+
+static void client_free(client_t *client)
+{
+	g_object_unref(client->address);
+	g_free(client->host);
+	g_free(client);
+}
+
+static void bundle_free(gpointer user_data)
+{
+	bundle_t *bundle = user_data;
+
+	g_list_free_full(bundle->clients, (GDestroyNotify)client_free);
+	gst_object_unref(bundle->sink);
+	g_mutex_clear(&bundle->mutex);
+	g_free(bundle);
+}
+
+// Forgets senders that went silent, called with the bundle locked.
+static void bundle_prune(bundle_t *bundle, gint64 now)
+{
+	GList *l = bundle->clients;
+
+	while (l != NULL)
+	{
+		GList *next = l->next;
+		client_t *client = l->data;
+
+		if (now - client->seen >
+			STREAMINSYNC_SILENCE_TIMEOUT * G_TIME_SPAN_MILLISECOND)
+		{
+			g_signal_emit_by_name(bundle->sink, "remove", client->host,
+								  client->port);
+			client_free(client);
+			bundle->clients = g_list_delete_link(bundle->clients, l);
+		}
+
+		l = next;
+	}
+}
+
+static GstPadProbeReturn bundle_probe(GstPad *pad, GstPadProbeInfo *info,
+									  gpointer user_data)
+{
+	bundle_t *bundle = user_data;
+	GstNetAddressMeta *meta =
+		gst_buffer_get_net_address_meta(GST_PAD_PROBE_INFO_BUFFER(info));
+
+	if (meta == NULL || !G_IS_INET_SOCKET_ADDRESS(meta->addr))
+		return GST_PAD_PROBE_OK;
+
+	GInetSocketAddress *from = G_INET_SOCKET_ADDRESS(meta->addr);
+	GInetAddress *address = g_inet_socket_address_get_address(from);
+	const gint port = g_inet_socket_address_get_port(from);
+	const gint64 now = g_get_monotonic_time();
+	client_t *client = NULL;
+
+	g_mutex_lock(&bundle->mutex);
+
+	// A handful of senders at most, no allocation per packet
+	for (GList *l = bundle->clients; l != NULL; l = l->next)
+	{
+		client_t *c = l->data;
+
+		if (c->port == port && g_inet_address_equal(c->address, address))
+		{
+			client = c;
+			break;
+		}
+	}
+
+	if (client == NULL)
+	{
+		client = g_new0(client_t, 1);
+		client->address = g_object_ref(address);
+		client->host = g_inet_address_to_string(address);
+		client->port = port;
+		bundle->clients = g_list_prepend(bundle->clients, client);
+
+		g_signal_emit_by_name(bundle->sink, "add", client->host,
+							  client->port);
+		blog(LOG_INFO, "Bundled sender %s:%d", client->host, client->port);
+	}
+
+	client->seen = now;
+
+	if (now - bundle->pruned > G_USEC_PER_SEC)
+	{
+		bundle_prune(bundle, now);
+		bundle->pruned = now;
+	}
+
+	g_mutex_unlock(&bundle->mutex);
+
+	return GST_PAD_PROBE_OK;
+}
+
+// Bundled transport for session 0 of rtpbin: RTP and RTCP of both media come
+// in on 'port' and RTCP goes back out of the same socket (RFC 5761 rtcp-mux,
+// rtpsession tells RTCP from RTP on its RTP pad). Elements are added to
+// 'bin', the udpsrc is returned under 'name', or NULL if the port cannot be
+// bound.
+GstElement *streaminsync_bundle_new(GstBin *bin, GstElement *rtpbin,
+									gint port, const gchar *name)
+{
+	GError *err = NULL;
+	GSocket *socket = g_socket_new(G_SOCKET_FAMILY_IPV4,
+								   G_SOCKET_TYPE_DATAGRAM,
+								   G_SOCKET_PROTOCOL_UDP, &err);
+
+	if (socket)
+	{
+		GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+		GSocketAddress *address = g_inet_socket_address_new(any, port);
+
+		if (!g_socket_bind(socket, address, TRUE, &err))
+			g_clear_object(&socket);
+
+		g_object_unref(address);
+		g_object_unref(any);
+	}
+
+	if (socket == NULL)
+	{
+		blog(LOG_ERROR, "Cannot bind the bundle port %d: %s", port,
+			 err->message);
+		g_error_free(err);
+		return NULL;
+	}
+
+	GstElement *udpsrc = gst_element_factory_make("udpsrc", name);
+	GstElement *udpsink = gst_element_factory_make("multiudpsink", NULL);
+	GstCaps *caps = gst_caps_new_empty_simple("application/x-rtp");
+
+	// The socket is ours, the elements only borrow it
+	g_object_set(udpsrc, "socket", socket, "close-socket", FALSE, "caps",
+				 caps, NULL);
+	g_object_set(udpsink, "socket", socket, "close-socket", FALSE, "sync",
+				 FALSE, "async", FALSE, NULL);
+	gst_caps_unref(caps);
+	g_object_unref(socket);
+
+	gst_bin_add_many(bin, udpsrc, udpsink, NULL);
+	gst_element_link_pads(udpsrc, "src", rtpbin, "recv_rtp_sink_0");
+	gst_element_link_pads(rtpbin, "send_rtcp_src_0", udpsink, "sink");
+
+	bundle_t *bundle = g_new0(bundle_t, 1);
+	bundle->sink = gst_object_ref(udpsink);
+	g_mutex_init(&bundle->mutex);
+
+	GstPad *pad = gst_element_get_static_pad(udpsrc, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, bundle_probe, bundle,
+					  NULL);
+	gst_object_unref(pad);
+
+	g_object_set_data_full(G_OBJECT(udpsrc), "streaminsync-bundle", bundle,
+						   bundle_free);
+
+	return udpsrc;
+}
+
+// Sends an upstream key unit request into rtpbin from one of its
+// recv_rtp_src pads. rtpbin turns it into a FIR to the sender of that pad's
+// SSRC, the sender's encoder answers with a keyframe.
+void streaminsync_request_keyframe(GstPad *pad)
+{
+	blog(LOG_INFO, "Requesting a keyframe for %s", GST_PAD_NAME(pad));
+
+	gst_pad_send_event(pad, gst_video_event_new_upstream_force_key_unit(
+								GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+// A new decoder has nothing to decode until the next keyframe, which may be
+// seconds away. Ask for one as soon as the branch gets a stream.
+static void on_branch_linked(GstPad *pad, GstPad *peer, gpointer user_data)
+{
+	streaminsync_request_keyframe(peer);
+}
+
+static void set_flag_if_exists(GstElement *element, const char *name)
+{
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), name))
+		g_object_set(element, name, TRUE, NULL);
+}
+
+// Depayload, decode and hand one session of a stream over to OBS. The
+// returned bin has a single "sink" pad to link an rtpbin pad to.
+GstElement *streaminsync_branch_new(guint session,
+									const streaminsync_sink_t *sink)
+{
+	GstElement *bin = gst_bin_new(NULL);
+	GstElement *appsink = gst_element_factory_make("appsink", "appsink");
+	GstElement *depay;
+	GstElement *dec;
+	gboolean linked;
+
+	if (session == STREAMINSYNC_SESSION_VIDEO)
+	{
+		depay = gst_element_factory_make("rtph264depay", NULL);
+		GstElement *parse = gst_element_factory_make("h264parse", NULL);
+		dec = streaminsync_decoder_make(
+			sink->decoder, sink->decoder_threads,
+			sink->decoder_thread_type, sink->active_sources);
+
+		if (!depay || !parse || !dec || !appsink)
+		{
+			blog(LOG_ERROR, "Not all video elements could be created");
+			gst_object_unref(bin);
+			return NULL;
+		}
+
+		gst_bin_add_many(GST_BIN(bin), depay, parse, dec, appsink, NULL);
+		linked = gst_element_link_many(depay, parse, dec, NULL) &&
+				 streaminsync_decoder_link(
+					 GST_BIN(bin), dec, appsink, sink->pipelined,
+					 sink->decoder_threads, sink->active_sources,
+					 sink->block_video);
+
+		gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &sink->video_cbs,
+								   sink->user_data, NULL);
+		if (sink->block_video)
+			g_object_set(appsink, "max-buffers", 1, NULL);
+
+		// On loss, skip to the next keyframe rather than showing corrupt
+		// frames, and have the depayloader and decoder ask for it.
+		if (sink->request_keyframes)
+		{
+			set_flag_if_exists(depay, "wait-for-keyframe");
+			set_flag_if_exists(depay, "request-keyframe");
+			set_flag_if_exists(dec, "discard-corrupted-frames");
+			set_flag_if_exists(dec, "automatic-request-sync-points");
+		}
+	}
+	else
+	{
+		depay = gst_element_factory_make("rtpopusdepay", NULL);
+		dec = gst_element_factory_make("opusdec", NULL);
+		GstElement *conv = gst_element_factory_make("audioconvert", NULL);
+		GstElement *resample =
+			gst_element_factory_make("audioresample", NULL);
+
+		if (!depay || !dec || !conv || !resample || !appsink)
+		{
+			blog(LOG_ERROR, "Not all audio elements could be created");
+			gst_object_unref(bin);
+			return NULL;
+		}
+
+		// Lost packets are concealed, from the FEC the next packet carries
+		// if the sender adds it
+		set_flag_if_exists(dec, "plc");
+		set_flag_if_exists(dec, "use-inband-fec");
+
+		// What the stretching works on
+		GstCaps *caps = gst_caps_new_simple(
+			"audio/x-raw", "format", G_TYPE_STRING, GST_AUDIO_NE(F32),
+			"layout", G_TYPE_STRING, "interleaved", NULL);
+		g_object_set(appsink, "caps", caps, NULL);
+		gst_caps_unref(caps);
+
+		gst_bin_add_many(GST_BIN(bin), depay, dec, conv, resample, appsink,
+						 NULL);
+		linked = gst_element_link_many(depay, dec, conv, resample, appsink,
+									   NULL);
+
+		gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &sink->audio_cbs,
+								   sink->user_data, NULL);
+		if (sink->block_audio)
+			g_object_set(appsink, "max-buffers", 1, NULL);
+	}
+
+	if (!linked)
+	{
+		blog(LOG_ERROR, "Can't link elements");
+		gst_object_unref(bin);
+		return NULL;
+	}
+
+	GstPad *pad = gst_element_get_static_pad(depay, "sink");
+	GstPad *ghost = gst_ghost_pad_new("sink", pad);
+	gst_element_add_pad(bin, ghost);
+	gst_object_unref(pad);
+
+	if (session == STREAMINSYNC_SESSION_VIDEO && sink->request_keyframes)
+		g_signal_connect(ghost, "linked", G_CALLBACK(on_branch_linked), NULL);
+
+	streaminsync_stats_attach(bin, dec, appsink);
+
+	if (session == STREAMINSYNC_SESSION_VIDEO)
+	{
+		streaminsync_stats_attach_stages(bin, dec);
+		streaminsync_standby_attach(bin, dec, sink->standby);
+	}
+
+	return bin;
+}
+
+// Pads nobody wants still need a sink, an unlinked rtpbin pad would stop
+// the whole session with not-linked.
+void streaminsync_discard_pad(GstBin *bin, GstPad *pad)
+{
+	GstElement *fakesink = gst_element_factory_make("fakesink", NULL);
+	g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+
+	gst_bin_add(bin, fakesink);
+	gst_element_sync_state_with_parent(fakesink);
+
+	GstPad *sinkpad = gst_element_get_static_pad(fakesink, "sink");
+	gst_pad_link(pad, sinkpad);
+	gst_object_unref(sinkpad);
+}
+
+// 'session' is the media session of the pad, also for audio coming in the
+// video session of a bundled stream.
+gboolean streaminsync_parse_pad_name(const gchar *name, guint *session,
+									 guint32 *ssrc, guint *pt)
+{
+	if (sscanf(name, "recv_rtp_src_%u_%u_%u", session, ssrc, pt) != 3)
+		return FALSE;
+
+	*session = media_session(*session, *pt);
+
+	return TRUE;
+}
+
+// Whether a jitterbuffer of rtpbin serves 'session' (G_MAXUINT for any) and
+// 'ssrc' (0 for any). Both are told by the caps it receives, which come from
+// our udpsrc caps plus the SSRC added by rtpssrcdemux.
+gboolean streaminsync_jitterbuffer_matches(GstElement *jitterbuffer,
+										   guint session, guint32 ssrc)
+{
+	GstPad *pad = gst_element_get_static_pad(jitterbuffer, "sink");
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	gboolean matches = FALSE;
+
+	gst_object_unref(pad);
+
+	if (caps == NULL)
+		return session == G_MAXUINT && ssrc == 0;
+
+	const GstStructure *s = gst_caps_get_structure(caps, 0);
+	const gchar *media = gst_structure_get_string(s, "media");
+	guint caps_ssrc = 0;
+
+	gst_structure_get_uint(s, "ssrc", &caps_ssrc);
+
+	matches = (ssrc == 0 || caps_ssrc == ssrc) &&
+			  (session == G_MAXUINT ||
+			   g_strcmp0(media, session == STREAMINSYNC_SESSION_VIDEO
+									? "video"
+									: "audio") == 0);
+
+	gst_caps_unref(caps);
+
+	return matches;
+}
+
+// A flush from the jitterbuffer down resets the depayloader and decoder
+// behind it and restarts the jitterbuffer task, while sockets, clock and RTP
+// session state stay as they are.
+static void flush_jitterbuffer(GstElement *jitterbuffer)
+{
+	GstPad *pad = gst_element_get_static_pad(jitterbuffer, "sink");
+
+	gst_pad_send_event(pad, gst_event_new_flush_start());
+	// Keep the running time, the pipeline is live and synced
+	gst_pad_send_event(pad, gst_event_new_flush_stop(FALSE));
+	gst_object_unref(pad);
+}
+
+void streaminsync_flush_session(GstElement *rtpbin, guint session,
+								guint32 ssrc)
+{
+	GstIterator *it = gst_bin_iterate_all_by_element_factory_name(
+		GST_BIN(rtpbin), "rtpjitterbuffer");
+	GValue item = G_VALUE_INIT;
+
+	while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+	{
+		GstElement *jitterbuffer = g_value_get_object(&item);
+
+		if (streaminsync_jitterbuffer_matches(jitterbuffer, session, ssrc))
+			flush_jitterbuffer(jitterbuffer);
+
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(it);
+}
+
+// The direct child of 'pipe' that 'object' is part of, or NULL.
+static GstObject *pipe_child(GstElement *pipe, GstObject *object)
+{
+	GstObject *child = gst_object_ref(object);
+	GstObject *parent;
+
+	while ((parent = gst_object_get_parent(child)) != NULL &&
+		   parent != GST_OBJECT(pipe))
+	{
+		gst_object_unref(child);
+		child = parent;
+	}
+
+	if (parent == NULL)
+	{
+		gst_object_unref(child);
+		return NULL;
+	}
+
+	gst_object_unref(parent);
+
+	return child;
+}
+
+static gboolean is_jitterbuffer(GstObject *object)
+{
+	if (!GST_IS_ELEMENT(object))
+		return FALSE;
+
+	GstElementFactory *factory = gst_element_get_factory(GST_ELEMENT(object));
+
+	return factory && g_strcmp0(gst_plugin_feature_get_name(
+									GST_PLUGIN_FEATURE(factory)),
+								"rtpjitterbuffer") == 0;
+}
+
+// Handles an error posted by 'src' without rebuilding 'pipe' if it can be
+// pinned down to one stream: an error in a decoding branch flushes the
+// session feeding it, and a jitterbuffer that stopped on a flow error from
+// downstream is flushed to restart it. Returns FALSE if a rebuild is needed.
+gboolean streaminsync_warm_reset(GstElement *pipe, GstElement *rtpbin,
+								 GstObject *src)
+{
+	if (is_jitterbuffer(src))
+	{
+		flush_jitterbuffer(GST_ELEMENT(src));
+		return TRUE;
+	}
+
+	GstObject *branch = pipe_child(pipe, src);
+	if (branch == NULL)
+		return FALSE;
+
+	// Branches have a single sink pad, fed by a recv_rtp_src pad of rtpbin
+	// that names the session and SSRC, video maybe through the simulcast
+	// layer selector.
+	GstPad *sinkpad = GST_IS_ELEMENT(branch) && branch != GST_OBJECT(rtpbin)
+						  ? gst_element_get_static_pad(GST_ELEMENT(branch),
+													   "sink")
+						  : NULL;
+	GstPad *peer = sinkpad ? gst_pad_get_peer(sinkpad) : NULL;
+	gboolean handled = FALSE;
+
+	// Video comes through the layer selector
+	if (peer)
+	{
+		GstPad *feed = streaminsync_layers_feed(peer);
+		gst_object_unref(peer);
+		peer = feed;
+	}
+	guint session, pt;
+	guint32 ssrc;
+
+	if (peer && streaminsync_parse_pad_name(GST_PAD_NAME(peer), &session,
+											&ssrc, &pt))
+	{
+		blog(LOG_INFO, "Resetting stream %u of session %u", ssrc, session);
+		streaminsync_flush_session(rtpbin, session, ssrc);
+		if (session == STREAMINSYNC_SESSION_VIDEO)
+			streaminsync_request_keyframe(peer);
+		handled = TRUE;
+	}
+
+	if (peer)
+		gst_object_unref(peer);
+	if (sinkpad)
+		gst_object_unref(sinkpad);
+	gst_object_unref(branch);
+
+	return handled;
+}
+
+static GstElement *fakesink_new(void)
+{
+	GstElement *fakesink = gst_element_factory_make("fakesink", NULL);
+	g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+
+	return fakesink;
+}
+
+// Stops handing anything over from the appsinks in 'element', whatever it
+// still has in flight.
+void streaminsync_silence(GstElement *element)
+{
+	static const GstAppSinkCallbacks none = {0};
+	GstIterator *it = GST_IS_BIN(element)
+						  ? gst_bin_iterate_recurse(GST_BIN(element))
+						  : NULL;
+	GValue item = G_VALUE_INIT;
+
+	if (GST_IS_APP_SINK(element))
+		gst_app_sink_set_callbacks(GST_APP_SINK(element), &none, NULL,
+								   NULL);
+
+	while (it && gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+	{
+		GstElement *child = g_value_get_object(&item);
+		if (GST_IS_APP_SINK(child))
+			gst_app_sink_set_callbacks(GST_APP_SINK(child), &none, NULL,
+									   NULL);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	if (it)
+		gst_iterator_free(it);
+}
+
+// Tears 'element' down on the worker thread, taking over the reference
+// passed in. Nothing reaches OBS through it afterwards.
+void streaminsync_dispose(GstElement *element)
+{
+	streaminsync_silence(element);
+	gstreamer_worker_dispose(element);
+}
+
+typedef struct
+{
+	GstElement *pipe;
+	GstElement *old;
+	GstElement *branch;
+	streaminsync_replaced_t done;
+	gpointer user_data;
+	gboolean replaced;
+} replace_t;
+
+static void replace_now(replace_t *replace, GstPad *pad)
+{
+	GstPad *sinkpad;
+
+	if (pad)
+	{
+		sinkpad = gst_element_get_static_pad(replace->old, "sink");
+		gst_pad_unlink(pad, sinkpad);
+		gst_object_unref(sinkpad);
+	}
+
+	// Out of the bin right away, the new branch may carry its name. The
+	// rest of the teardown waits for its queues' threads, the worker does
+	// it.
+	gst_object_ref(replace->old);
+	gst_bin_remove(GST_BIN(replace->pipe), replace->old);
+	streaminsync_dispose(replace->old);
+
+	gst_bin_add(GST_BIN(replace->pipe), gst_object_ref(replace->branch));
+	gst_element_sync_state_with_parent(replace->branch);
+
+	if (pad)
+	{
+		sinkpad = gst_element_get_static_pad(replace->branch, "sink");
+		gst_pad_link(pad, sinkpad);
+		gst_object_unref(sinkpad);
+	}
+
+	replace->replaced = TRUE;
+	if (replace->done)
+		replace->done(TRUE, replace->user_data);
+}
+
+static void replace_free(gpointer user_data)
+{
+	replace_t *replace = user_data;
+
+	// The pad went away before it ever was idle
+	if (!replace->replaced && replace->done)
+		replace->done(FALSE, replace->user_data);
+
+	gst_object_unref(replace->pipe);
+	gst_object_unref(replace->old);
+	gst_object_unref(replace->branch);
+	g_free(replace);
+}
+
+static GstPadProbeReturn replace_probe(GstPad *pad, GstPadProbeInfo *info,
+									   gpointer user_data)
+{
+	replace_now(user_data, pad);
+
+	return GST_PAD_PROBE_REMOVE;
+}
+
+// Replaces the branch 'old' of 'pipe' by 'branch' once no data flows into
+// it, then calls 'done', if any, on whichever thread that happens. It does
+// not wait for it, a pad that does not go idle would hold the caller up.
+// Everything upstream, sockets and jitterbuffers included, is left running.
+void streaminsync_branch_replace(GstElement *pipe, GstElement *old,
+								 GstElement *branch,
+								 streaminsync_replaced_t done,
+								 gpointer user_data)
+{
+	replace_t *replace = g_new0(replace_t, 1);
+
+	replace->pipe = gst_object_ref(pipe);
+	replace->old = gst_object_ref(old);
+	replace->branch = gst_object_ref_sink(branch);
+	replace->done = done;
+	replace->user_data = user_data;
+
+	GstPad *sinkpad = gst_element_get_static_pad(old, "sink");
+	GstPad *pad = gst_pad_get_peer(sinkpad);
+	gst_object_unref(sinkpad);
+
+	if (pad == NULL)
+	{
+		replace_now(replace, NULL);
+		replace_free(replace);
+		return;
+	}
+
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_IDLE, replace_probe, replace,
+					  replace_free);
+	gst_object_unref(pad);
+}
+
+// Keeps 'route' around while receivers_mutex is dropped, until route_swap().
+// Must be called with receivers_mutex.
+static route_t *route_hold(route_t *route)
+{
+	route->refcount++;
+	return route;
+}
+
+// Must be called with receivers_mutex.
+static void route_release(receiver_t *receiver, route_t *route)
+{
+	if (--route->refcount > 0)
+		return;
+
+	if (route->removed)
+	{
+		gst_object_ref(route->sink);
+		gst_bin_remove(GST_BIN(receiver->pipe), route->sink);
+		streaminsync_dispose(route->sink);
+	}
+
+	gst_object_unref(route->pad);
+	g_free(route);
+}
+
+typedef struct
+{
+	receiver_t *receiver;
+	route_t *route;
+	GstElement *sink;
+} swap_t;
+
+static void swap_start(swap_t *swap);
+
+static gboolean swap_pending(gpointer user_data)
+{
+	swap_start(user_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void on_swapped(gboolean replaced, gpointer user_data)
+{
+	swap_t *swap = user_data;
+	route_t *route = swap->route;
+	swap_t *next = NULL;
+
+	g_mutex_lock(&receivers_mutex);
+
+	if (replaced)
+		route->sink = swap->sink;
+	route->swapping = FALSE;
+
+	// The pending sink comes with a hold of its own, which the next swap
+	// takes over.
+	if (route->pending && !route->removed)
+	{
+		next = g_new0(swap_t, 1);
+		next->receiver = swap->receiver;
+		next->route = route;
+		next->sink = route->pending;
+		route->swapping = TRUE;
+	}
+	else if (route->pending)
+	{
+		gst_object_unref(route->pending);
+		route_release(swap->receiver, route);
+	}
+	route->pending = NULL;
+
+	route_release(swap->receiver, route);
+
+	g_mutex_unlock(&receivers_mutex);
+
+	gst_object_unref(swap->sink);
+	g_free(swap);
+
+	// Not from here, this may be the streaming thread of the very pad
+	if (next)
+		gstreamer_dispatcher_invoke(swap_pending, next);
+}
+
+static void swap_start(swap_t *swap)
+{
+	g_mutex_lock(&receivers_mutex);
+	const gboolean removed = swap->route->removed;
+	GstElement *old = removed ? NULL : gst_object_ref(swap->route->sink);
+	g_mutex_unlock(&receivers_mutex);
+
+	if (removed)
+	{
+		on_swapped(FALSE, swap);
+		return;
+	}
+
+	streaminsync_branch_replace(swap->receiver->pipe, old, swap->sink,
+								on_swapped, swap);
+	gst_object_unref(old);
+}
+
+// Links a held route to 'sink' instead, or only lets go of it with NULL. The
+// pad may have gone in the meantime, then 'sink' is dropped. The route is let
+// go of once the swap is done, which may be after this returns. A swap asked
+// for while another is in progress follows it, only the last one asked for
+// is kept. Must be called without receivers_mutex.
+static void route_swap(receiver_t *receiver, route_t *route, GstElement *sink)
+{
+	g_mutex_lock(&receivers_mutex);
+
+	if (sink == NULL || route->removed)
+	{
+		if (sink)
+			gst_object_unref(gst_object_ref_sink(sink));
+		route_release(receiver, route);
+		g_mutex_unlock(&receivers_mutex);
+		return;
+	}
+
+	if (route->swapping)
+	{
+		if (route->pending)
+		{
+			gst_object_unref(route->pending);
+			route_release(receiver, route);
+		}
+		route->pending = gst_object_ref_sink(sink);
+		g_mutex_unlock(&receivers_mutex);
+		return;
+	}
+
+	route->swapping = TRUE;
+	g_mutex_unlock(&receivers_mutex);
+
+	swap_t *swap = g_new0(swap_t, 1);
+	swap->receiver = receiver;
+	swap->route = route;
+	swap->sink = gst_object_ref_sink(sink);
+
+	swap_start(swap);
+}
+
+// Whether the appsink of a branch waits for OBS or drops when it falls
+// behind, and so do the stage queues in front of it.
+void streaminsync_branch_set_blocking(GstElement *branch, gboolean block)
+{
+	GstElement *appsink = gst_bin_get_by_name(GST_BIN(branch), "appsink");
+
+	streaminsync_decoder_set_blocking(GST_BIN(branch), block);
+
+	if (appsink == NULL)
+		return;
+
+	g_object_set(appsink, "max-buffers", block ? 1 : 0, NULL);
+	gst_object_unref(appsink);
+}
+
+// Stream id the pad of 'session' and 'ssrc' belongs to, see
+// STREAMINSYNC_BUNDLE_AUDIO_SSRC.
+static guint32 stream_id(receiver_t *receiver, guint session, guint32 ssrc)
+{
+	if (receiver->bundle && session == STREAMINSYNC_SESSION_AUDIO)
+		return ssrc - 1;
+
+	return ssrc;
+}
+
+static streaminsync_stream_t *find_stream(receiver_t *receiver, guint32 ssrc)
+{
+	for (GList *l = receiver->streams; l != NULL; l = l->next)
+	{
+		streaminsync_stream_t *stream = l->data;
+		if (stream->ssrc == ssrc)
+			return stream;
+	}
+
+	return NULL;
+}
+
+static void on_pad_added(GstElement *rtpbin, GstPad *pad, gpointer user_data)
+{
+	receiver_t *receiver = user_data;
+	guint session, pt;
+	guint32 ssrc;
+
+	if (g_atomic_int_get(&receiver->stopping) ||
+		!streaminsync_parse_pad_name(GST_PAD_NAME(pad), &session, &ssrc,
+									 &pt))
+		return;
+
+	g_mutex_lock(&receivers_mutex);
+
+	// Stopping is set with the lock held, the receiver may have started
+	// going away while this thread waited for it.
+	if (g_atomic_int_get(&receiver->stopping))
+	{
+		g_mutex_unlock(&receivers_mutex);
+		return;
+	}
+
+	route_t *route = g_new0(route_t, 1);
+	route->refcount = 1;
+	route->pad = gst_object_ref(pad);
+	route->session = session;
+	route->ssrc = ssrc;
+	route->layer = streaminsync_pt_layer(pt);
+	route->stream = route->layer > 0
+						? NULL
+						: find_stream(receiver,
+									  stream_id(receiver, session, ssrc));
+
+	if (route->stream)
+		route->sink = streaminsync_branch_new(session, &route->stream->sink);
+	else
+		blog(LOG_INFO, "Unclaimed stream %u (session %u) on port %d", ssrc,
+			 session, receiver->port);
+
+	if (route->sink == NULL)
+	{
+		route->stream = NULL;
+		route->sink = fakesink_new();
+	}
+
+	gst_bin_add(GST_BIN(receiver->pipe), route->sink);
+	gst_element_sync_state_with_parent(route->sink);
+
+	GstPad *sinkpad = gst_element_get_static_pad(route->sink, "sink");
+	gst_pad_link(pad, sinkpad);
+	gst_object_unref(sinkpad);
+
+	receiver->routes = g_list_append(receiver->routes, route);
+
+	g_mutex_unlock(&receivers_mutex);
+}
+
+static void on_pad_removed(GstElement *rtpbin, GstPad *pad,
+						   gpointer user_data)
+{
+	receiver_t *receiver = user_data;
+
+	// Pads also go away while the receiver is torn down, which owns the
+	// routes then.
+	if (g_atomic_int_get(&receiver->stopping))
+		return;
+
+	g_mutex_lock(&receivers_mutex);
+
+	if (g_atomic_int_get(&receiver->stopping))
+	{
+		g_mutex_unlock(&receivers_mutex);
+		return;
+	}
+
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		if (route->pad != pad)
+			continue;
+
+		receiver->routes = g_list_delete_link(receiver->routes, l);
+
+		// A swap in progress may still be linking a new sink, the sink
+		// is removed once it is done.
+		route->removed = TRUE;
+		route_release(receiver, route);
+		break;
+	}
+
+	g_mutex_unlock(&receivers_mutex);
+}
+
+static gboolean bus_callback(GstBus *bus, GstMessage *message,
+							 gpointer user_data)
+{
+	receiver_t *receiver = user_data;
+
+	switch (GST_MESSAGE_TYPE(message))
+	{
+	case GST_MESSAGE_ERROR:
+	{
+		GError *err;
+		gst_message_parse_error(message, &err, NULL);
+		blog(LOG_ERROR, "Shared receiver on port %d: %s", receiver->port,
+			 err->message);
+		g_error_free(err);
+
+		// A failing decoding branch only takes its own stream down, it
+		// is reset without touching the other senders.
+		streaminsync_warm_reset(receiver->pipe, receiver->rtpbin,
+								GST_MESSAGE_SRC(message));
+	}
+	break;
+	case GST_MESSAGE_WARNING:
+	{
+		GError *err;
+		gst_message_parse_warning(message, &err, NULL);
+		blog(LOG_WARNING, "Shared receiver on port %d: %s", receiver->port,
+			 err->message);
+		g_error_free(err);
+	}
+	break;
+	case GST_MESSAGE_LATENCY:
+		// The latency controller changed the jitterbuffers, the sinks
+		// sync on the new value once it is redistributed.
+		gst_bin_recalculate_latency(GST_BIN(receiver->pipe));
+		break;
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+// Runs on the dispatcher thread, so no bus callback can be in flight once
+// the watch is gone.
+static gboolean receiver_unwatch(gpointer user_data)
+{
+	receiver_t *receiver = user_data;
+
+	g_source_destroy(receiver->watch);
+	g_source_unref(receiver->watch);
+	receiver->watch = NULL;
+
+	return G_SOURCE_REMOVE;
+}
+
+static GstElement *udpsrc_new(gint port, GstCaps *caps)
+{
+	GstElement *udpsrc = gst_element_factory_make("udpsrc", NULL);
+
+	g_object_set(udpsrc, "port", port, NULL);
+	if (caps)
+	{
+		g_object_set(udpsrc, "caps", caps, NULL);
+		gst_caps_unref(caps);
+	}
+
+	return udpsrc;
+}
+
+static receiver_t *receiver_new(gint port, gboolean bundle,
+								const streaminsync_latency_t *latency,
+								const streaminsync_clock_config_t *clock)
+{
+	receiver_t *receiver = g_new0(receiver_t, 1);
+
+	receiver->port = port;
+	receiver->bundle = bundle;
+	receiver->pipe = gst_pipeline_new(NULL);
+	receiver->rtpbin =
+		streaminsync_rtpbin_new(streaminsync_latency_initial(latency));
+
+	receiver->clock = streaminsync_clock_acquire(clock);
+	gst_pipeline_use_clock(GST_PIPELINE(receiver->pipe), receiver->clock);
+
+	gst_bin_add(GST_BIN(receiver->pipe), receiver->rtpbin);
+
+	// RTCP goes back to whichever senders are sending, no client list
+	if (bundle && !streaminsync_bundle_new(GST_BIN(receiver->pipe),
+										   receiver->rtpbin, port, NULL))
+	{
+		blog(LOG_ERROR, "Shared receiver on port %d has no socket", port);
+		gst_object_unref(receiver->pipe);
+		streaminsync_clock_release(receiver->clock);
+		g_free(receiver);
+		return NULL;
+	}
+
+	for (guint session = 0; session < 2 && !bundle; session++)
+	{
+		const gint base = port + session * 3;
+
+		GstElement *rtpsrc =
+			udpsrc_new(base, streaminsync_rtp_caps(session));
+		GstElement *rtcpsrc = udpsrc_new(base + 1, NULL);
+
+		// Receiver reports go back to every attached sender
+		receiver->rtcp_sinks[session] =
+			gst_element_factory_make("multiudpsink", NULL);
+		g_object_set(receiver->rtcp_sinks[session], "sync", FALSE, "async",
+					 FALSE, NULL);
+
+		gst_bin_add_many(GST_BIN(receiver->pipe), rtpsrc, rtcpsrc,
+						 receiver->rtcp_sinks[session], NULL);
+
+		gchar *name = g_strdup_printf("recv_rtp_sink_%u", session);
+		gst_element_link_pads(rtpsrc, "src", receiver->rtpbin, name);
+		g_free(name);
+
+		name = g_strdup_printf("recv_rtcp_sink_%u", session);
+		gst_element_link_pads(rtcpsrc, "src", receiver->rtpbin, name);
+		g_free(name);
+
+		name = g_strdup_printf("send_rtcp_src_%u", session);
+		gst_element_link_pads(receiver->rtpbin, name,
+							  receiver->rtcp_sinks[session], "sink");
+		g_free(name);
+	}
+
+	g_signal_connect(receiver->rtpbin, "pad-added", G_CALLBACK(on_pad_added),
+					 receiver);
+	g_signal_connect(receiver->rtpbin, "pad-removed",
+					 G_CALLBACK(on_pad_removed), receiver);
+
+	// Bus messages are handled on the plugin-wide dispatcher thread
+	GstBus *bus = gst_element_get_bus(receiver->pipe);
+	receiver->watch = gst_bus_create_watch(bus);
+	g_source_set_callback(receiver->watch, (GSourceFunc)bus_callback,
+						  receiver, NULL);
+	g_source_attach(receiver->watch, gstreamer_dispatcher_get_context());
+	gst_object_unref(bus);
+
+	if (gst_element_set_state(receiver->pipe, GST_STATE_PLAYING) ==
+		GST_STATE_CHANGE_FAILURE)
+		blog(LOG_ERROR, "Shared receiver on port %d failed to start", port);
+
+	// The first stream attached decides on the latency bounds
+	streaminsync_latency_add(receiver->rtpbin, latency);
+
+	return receiver;
+}
+
+// Must be called without receivers_mutex, with stopping set and the bus
+// unwatched: the state change waits for the streaming threads, which may
+// want the lock.
+static void receiver_free(receiver_t *receiver)
+{
+	streaminsync_latency_remove(receiver->rtpbin);
+
+	gst_element_set_state(receiver->pipe, GST_STATE_NULL);
+
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+		route_release(receiver, l->data);
+	g_list_free(receiver->routes);
+
+	gst_object_unref(receiver->pipe);
+	streaminsync_clock_release(receiver->clock);
+	g_free(receiver);
+}
+
+// On the worker thread, the port is free again once it is done
+static gboolean receiver_close(gpointer user_data)
+{
+	receiver_t *receiver = user_data;
+	const gint port = receiver->port;
+
+	receiver_free(receiver);
+
+	g_mutex_lock(&receivers_mutex);
+	g_hash_table_remove(closing, GINT_TO_POINTER(port));
+	g_cond_broadcast(&receivers_cond);
+	g_mutex_unlock(&receivers_mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Whether the receiver on 'port' is still being torn down. Attaching to it
+// waits for it, which a caller on the dispatcher thread wants to avoid with
+// gstreamer_worker_then().
+gboolean streaminsync_receiver_closing(gint port)
+{
+	g_mutex_lock(&receivers_mutex);
+	const gboolean busy =
+		closing && g_hash_table_contains(closing, GINT_TO_POINTER(port));
+	g_mutex_unlock(&receivers_mutex);
+
+	return busy;
+}
+
+static void set_rtcp_client(receiver_t *receiver, const gchar *host,
+							const char *signal)
+{
+	if (host == NULL || *host == '\0' || receiver->bundle)
+		return;
+
+	for (guint session = 0; session < 2; session++)
+		g_signal_emit_by_name(receiver->rtcp_sinks[session], signal, host,
+							  receiver->port + session * 3 + 2);
+}
+
+streaminsync_stream_t *streaminsync_receiver_attach(
+	gint port, gboolean bundle, guint32 ssrc, const gchar *sender_ip,
+	const streaminsync_sink_t *sink, const streaminsync_latency_t *latency,
+	const streaminsync_clock_config_t *clock)
+{
+	g_mutex_lock(&receivers_mutex);
+
+	if (receivers == NULL)
+	{
+		receivers = g_hash_table_new(g_direct_hash, g_direct_equal);
+		closing = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	while (g_hash_table_contains(closing, GINT_TO_POINTER(port)))
+		g_cond_wait(&receivers_cond, &receivers_mutex);
+
+	receiver_t *receiver =
+		g_hash_table_lookup(receivers, GINT_TO_POINTER(port));
+
+	if (receiver && find_stream(receiver, ssrc))
+	{
+		g_mutex_unlock(&receivers_mutex);
+		blog(LOG_ERROR, "Stream %u on port %d is already in use", ssrc,
+			 port);
+		return NULL;
+	}
+
+	if (receiver && receiver->bundle != bundle)
+	{
+		g_mutex_unlock(&receivers_mutex);
+		blog(LOG_ERROR, "The shared receiver on port %d is %s", port,
+			 receiver->bundle ? "bundled" : "not bundled");
+		return NULL;
+	}
+
+	if (receiver == NULL)
+	{
+		// The first stream attached decides on the clock
+		receiver = receiver_new(port, bundle, latency, clock);
+		if (receiver == NULL)
+		{
+			g_mutex_unlock(&receivers_mutex);
+			return NULL;
+		}
+		g_hash_table_insert(receivers, GINT_TO_POINTER(port), receiver);
+	}
+
+	streaminsync_stream_t *stream = g_new0(streaminsync_stream_t, 1);
+	stream->receiver = receiver;
+	stream->ssrc = ssrc;
+	stream->sender_ip = g_strdup(sender_ip);
+	stream->decoder = g_strdup(sink->decoder);
+	stream->sink = *sink;
+	stream->sink.decoder = stream->decoder;
+
+	receiver->refcount++;
+	receiver->streams = g_list_append(receiver->streams, stream);
+
+	if (receiver->clock)
+		streaminsync_clock_require(receiver->clock, clock->threshold);
+
+	set_rtcp_client(receiver, stream->sender_ip, "add");
+
+	// The sender may already be streaming, claim its pads.
+	GList *claimed = NULL;
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		if (stream_id(receiver, route->session, route->ssrc) == ssrc &&
+			route->stream == NULL && route->layer <= 0)
+		{
+			route->stream = stream;
+			claimed = g_list_append(claimed, route_hold(route));
+		}
+	}
+
+	g_mutex_unlock(&receivers_mutex);
+
+	for (GList *l = claimed; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+		route_swap(receiver, route,
+				   streaminsync_branch_new(route->session, &stream->sink));
+	}
+	g_list_free(claimed);
+
+	blog(LOG_INFO, "Attached to stream %u on shared receiver port %d", ssrc,
+		 port);
+
+	return stream;
+}
+
+void streaminsync_receiver_detach(streaminsync_stream_t *stream)
+{
+	receiver_t *receiver = stream->receiver;
+	GList *released = NULL;
+
+	g_mutex_lock(&receivers_mutex);
+
+	receiver->streams = g_list_remove(receiver->streams, stream);
+	set_rtcp_client(receiver, stream->sender_ip, "remove");
+
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		if (route->stream == stream)
+		{
+			route->stream = NULL;
+			released = g_list_append(released, route_hold(route));
+		}
+	}
+
+	if (--receiver->refcount == 0)
+	{
+		// Nothing else swaps routes once the last stream is gone
+		for (GList *l = released; l != NULL; l = l->next)
+			route_release(receiver, l->data);
+
+		// The port stays taken until the sockets are closed, so that no
+		// other source binds it in between.
+		g_hash_table_remove(receivers, GINT_TO_POINTER(receiver->port));
+		g_hash_table_add(closing, GINT_TO_POINTER(receiver->port));
+		g_atomic_int_set(&receiver->stopping, TRUE);
+		g_mutex_unlock(&receivers_mutex);
+
+		// The state change waits for the streaming threads, the worker
+		// does it. The bus goes first, it is watched from the dispatcher.
+		streaminsync_silence(receiver->pipe);
+		gstreamer_dispatcher_invoke_sync(receiver_unwatch, receiver);
+		gstreamer_worker_invoke(receiver_close, receiver);
+	}
+	else
+	{
+		g_mutex_unlock(&receivers_mutex);
+
+		// Keep the pads flowing, the sender may still be sending.
+		for (GList *l = released; l != NULL; l = l->next)
+			route_swap(receiver, l->data, fakesink_new());
+	}
+	g_list_free(released);
+
+	g_free(stream->sender_ip);
+	g_free(stream->decoder);
+	g_free(stream);
+}
+
+// Applies new sink settings to a running stream. Decoder changes rebuild the
+// stream's branches in place, the rest is set on the running elements.
+void streaminsync_receiver_update(streaminsync_stream_t *stream,
+								  const streaminsync_sink_t *sink,
+								  gboolean rebuild,
+								  const streaminsync_latency_t *latency)
+{
+	receiver_t *receiver = stream->receiver;
+	GList *routes = NULL;
+
+	g_mutex_lock(&receivers_mutex);
+
+	// Branches made from now on pick the new settings up
+	g_free(stream->decoder);
+	stream->decoder = g_strdup(sink->decoder);
+	stream->sink = *sink;
+	stream->sink.decoder = stream->decoder;
+
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		if (route->stream != stream)
+			continue;
+
+		if (rebuild)
+			routes = g_list_append(routes, route_hold(route));
+		else
+			streaminsync_branch_set_blocking(
+				route->sink, route->session == STREAMINSYNC_SESSION_VIDEO
+								 ? sink->block_video
+								 : sink->block_audio);
+	}
+
+	g_mutex_unlock(&receivers_mutex);
+
+	streaminsync_latency_update(receiver->rtpbin, latency);
+
+	for (GList *l = routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		route_swap(receiver, route,
+				   streaminsync_branch_new(route->session, &stream->sink));
+	}
+
+	g_list_free(routes);
+}
+
+// Stops or resumes decoding of a stream, see streaminsync-standby.c.
+void streaminsync_receiver_set_standby(streaminsync_stream_t *stream,
+									   gboolean standby)
+{
+	receiver_t *receiver = stream->receiver;
+
+	g_mutex_lock(&receivers_mutex);
+
+	stream->sink.standby = standby;
+
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		if (route->stream == stream)
+			streaminsync_branch_set_standby(route->sink, standby);
+	}
+
+	g_mutex_unlock(&receivers_mutex);
+}
+
+void streaminsync_receiver_stats(streaminsync_stream_t *stream,
+								 streaminsync_stats_t *stats)
+{
+	GstElement *branches[2] = {NULL, NULL};
+	GList *counted = NULL;
+
+	g_mutex_lock(&receivers_mutex);
+
+	receiver_t *receiver = stream->receiver;
+
+	for (GList *l = receiver->routes; l != NULL; l = l->next)
+	{
+		route_t *route = l->data;
+
+		if (route->stream != stream || route->session >= 2)
+			continue;
+
+		if (branches[route->session] == NULL)
+			branches[route->session] = gst_object_ref(route->sink);
+
+		// Only the senders of this stream, with the audio SSRC of a bundle
+		// and every simulcast layer, each one once.
+		gboolean seen = FALSE;
+		for (GList *c = counted; c != NULL && !seen; c = c->next)
+		{
+			const route_t *other = c->data;
+			seen = other->session == route->session &&
+				   other->ssrc == route->ssrc;
+		}
+		if (seen)
+			continue;
+
+		counted = g_list_prepend(counted, route);
+		streaminsync_stats_rtp(receiver->rtpbin, route->session, route->ssrc,
+							   stats);
+	}
+	g_list_free(counted);
+
+	g_mutex_unlock(&receivers_mutex);
+
+	streaminsync_stats_branches(branches[STREAMINSYNC_SESSION_VIDEO],
+								branches[STREAMINSYNC_SESSION_AUDIO], stats);
+
+	for (guint session = 0; session < 2; session++)
+		if (branches[session])
+			gst_object_unref(branches[session]);
+}
@@ -0,0 +1,357 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Simulcast on the receiving side. A sender with layers sends the video in
+// several sizes, each on its own SSRC and payload type, and all of them are
+// received. An input-selector in front of the video branch picks the one that
+// is decoded: switching layers is switching its active pad, rtpbin and the
+// branch are left as they are and the decoder follows the new size from the
+// SPS. The switch waits for a keyframe of the new layer, asked for when the
+// switch is, so that the decoder is never fed frames it has no reference for.
+
+#include <gst/rtp/rtp.h>
+
+#include "streaminsync.h"
+
+#define LAYERS_KEY "streaminsync-layers"
+
+// Loss of a layer since the last pick, in percent, above which the next
+// smaller one is picked
+#define LAYER_LOSS_MAX 5
+
+// Picks in a row a bigger layer has to get before it is switched to, so that
+// a path at its limit does not keep switching up and down
+#define LAYER_HOLD 5
+
+// Longest wait for a keyframe of the layer switched to, in us. Past it the
+// switch happens anyway and the decoder recovers as from a loss.
+#define SWITCH_TIMEOUT (2 * G_USEC_PER_SEC)
+
+typedef struct
+{
+	GstElement *selector;
+	GstPad *pads[STREAMINSYNC_MAX_LAYERS];
+	GMutex mutex;
+	// Layer switched to on its next keyframe, -1 for none
+	gint pending;
+	gint64 pending_since;
+	// Counters of each layer at the last pick
+	guint32 ssrcs[STREAMINSYNC_MAX_LAYERS];
+	guint64 received[STREAMINSYNC_MAX_LAYERS];
+	guint64 lost[STREAMINSYNC_MAX_LAYERS];
+	// Bigger layer picked last, and how many times in a row
+	gint up;
+	gint up_count;
+} layers_t;
+
+static void layers_free(gpointer user_data)
+{
+	layers_t *layers = user_data;
+
+	g_mutex_clear(&layers->mutex);
+	g_free(layers);
+}
+
+// Layer of a video payload type, -1 for any other.
+gint streaminsync_pt_layer(guint pt)
+{
+	for (gint layer = 0; layer < STREAMINSYNC_MAX_LAYERS; layer++)
+	{
+		if (pt == STREAMINSYNC_LAYER_PT(layer))
+			return layer;
+	}
+
+	return -1;
+}
+
+// Whether an H.264 RTP packet starts an IDR frame or its SPS, which the
+// sender puts in front of every IDR frame.
+static gboolean starts_keyframe(GstBuffer *buffer)
+{
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+	if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+		return FALSE;
+
+	const guint8 *payload = gst_rtp_buffer_get_payload(&rtp);
+	const guint size = gst_rtp_buffer_get_payload_len(&rtp);
+	guint type = size > 0 ? payload[0] & 0x1f : 0;
+
+	// STAP-A carries its first NAL unit after a 16 bit size, FU-A has the
+	// type in the FU header, the first fragment has the start bit set.
+	if (type == 24)
+		type = size > 3 ? payload[3] & 0x1f : 0;
+	else if (type == 28)
+		type = size > 1 && (payload[1] & 0x80) ? payload[1] & 0x1f : 0;
+
+	gst_rtp_buffer_unmap(&rtp);
+
+	return type == 5 || type == 7;
+}
+
+// Runs on the packets of every layer, from the jitterbuffer threads.
+static GstPadProbeReturn switch_probe(GstPad *pad, GstPadProbeInfo *info,
+									  gpointer user_data)
+{
+	layers_t *layers = user_data;
+	gint layer = -1;
+
+	g_mutex_lock(&layers->mutex);
+
+	if (layers->pending >= 0 && layers->pads[layers->pending] == pad &&
+		(starts_keyframe(GST_PAD_PROBE_INFO_BUFFER(info)) ||
+		 g_get_monotonic_time() - layers->pending_since > SWITCH_TIMEOUT))
+	{
+		layer = layers->pending;
+		layers->pending = -1;
+	}
+
+	g_mutex_unlock(&layers->mutex);
+
+	// This packet already goes through as part of the new layer
+	if (layer >= 0)
+	{
+		blog(LOG_INFO, "Switched to simulcast layer %d", layer);
+		g_object_set(layers->selector, "active-pad", pad, NULL);
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+// Selector with a sink pad per layer, named sink_0 for layer 0 and so on,
+// layer 0 active. Its source pad goes to the video branch.
+GstElement *streaminsync_layers_new(void)
+{
+	GstElement *selector = gst_element_factory_make("input-selector", NULL);
+
+	if (selector == NULL)
+		return NULL;
+
+	// Layers are independent streams, none waits for the active one
+	g_object_set(selector, "sync-streams", FALSE, NULL);
+
+	layers_t *layers = g_new0(layers_t, 1);
+
+	layers->selector = selector;
+	layers->pending = -1;
+	g_mutex_init(&layers->mutex);
+
+	for (gint layer = 0; layer < STREAMINSYNC_MAX_LAYERS; layer++)
+	{
+		// Request pads stay with the selector until it goes
+		layers->pads[layer] =
+			gst_element_get_request_pad(selector, "sink_%u");
+		gst_pad_add_probe(layers->pads[layer], GST_PAD_PROBE_TYPE_BUFFER,
+						  switch_probe, layers, NULL);
+		gst_object_unref(layers->pads[layer]);
+	}
+
+	g_object_set(selector, "active-pad", layers->pads[0], NULL);
+	g_object_set_data_full(G_OBJECT(selector), LAYERS_KEY, layers,
+						   layers_free);
+
+	return selector;
+}
+
+// Sink pad of the layer of payload type 'pt', NULL if it is none.
+GstPad *streaminsync_layers_sink(GstElement *selector, guint pt)
+{
+	layers_t *layers = g_object_get_data(G_OBJECT(selector), LAYERS_KEY);
+	const gint layer = streaminsync_pt_layer(pt);
+
+	if (layers == NULL || layer < 0)
+		return NULL;
+
+	return gst_object_ref(layers->pads[layer]);
+}
+
+// What feeds 'pad': the rtpbin pad of the active layer for the source pad
+// of a selector from streaminsync_layers_new(), 'pad' itself otherwise.
+GstPad *streaminsync_layers_feed(GstPad *pad)
+{
+	GstElement *selector = gst_pad_get_parent_element(pad);
+	layers_t *layers =
+		selector ? g_object_get_data(G_OBJECT(selector), LAYERS_KEY) : NULL;
+	GstPad *feed = gst_object_ref(pad);
+
+	if (layers)
+	{
+		GstPad *active = NULL;
+
+		g_object_get(selector, "active-pad", &active, NULL);
+		if (active)
+		{
+			gst_object_unref(feed);
+			feed = gst_pad_get_peer(active);
+			gst_object_unref(active);
+		}
+	}
+
+	if (selector)
+		gst_object_unref(selector);
+
+	return feed;
+}
+
+static gint active_layer(layers_t *layers)
+{
+	GstPad *active = NULL;
+	gint layer = 0;
+
+	g_object_get(layers->selector, "active-pad", &active, NULL);
+	for (gint i = 0; active && i < STREAMINSYNC_MAX_LAYERS; i++)
+	{
+		if (layers->pads[i] == active)
+			layer = i;
+	}
+
+	if (active)
+		gst_object_unref(active);
+
+	return layer;
+}
+
+// Decodes 'layer' from its next keyframe on and asks the sender for one.
+// Nothing happens if the layer is not received.
+void streaminsync_layers_select(GstElement *selector, gint layer)
+{
+	layers_t *layers = g_object_get_data(G_OBJECT(selector), LAYERS_KEY);
+
+	if (layers == NULL || layer < 0 || layer >= STREAMINSYNC_MAX_LAYERS)
+		return;
+
+	GstPad *feed = gst_pad_get_peer(layers->pads[layer]);
+	if (feed == NULL)
+		return;
+
+	const gboolean active = active_layer(layers) == layer;
+	gboolean request = FALSE;
+
+	g_mutex_lock(&layers->mutex);
+
+	if (active)
+	{
+		layers->pending = -1;
+	}
+	else if (layers->pending != layer)
+	{
+		layers->pending = layer;
+		layers->pending_since = g_get_monotonic_time();
+		request = TRUE;
+	}
+
+	g_mutex_unlock(&layers->mutex);
+
+	if (request)
+		streaminsync_request_keyframe(feed);
+
+	gst_object_unref(feed);
+}
+
+// Picks the layer to decode and switches to it, 'layer' if it is not -1.
+// Otherwise the smallest layer at least 'height' tall, or a smaller one while
+// that one loses more than LAYER_LOSS_MAX percent of its packets.
+// 'decoded_height' is the height of what the active layer decodes to. Either
+// being 0 keeps the active layer. Meant to be called at regular intervals, a bigger layer
+// is only switched to after LAYER_HOLD picks.
+void streaminsync_layers_update(GstElement *selector, GstElement *rtpbin,
+								gint layer, gint height, gint decoded_height)
+{
+	layers_t *layers = g_object_get_data(G_OBJECT(selector), LAYERS_KEY);
+	gboolean linked[STREAMINSYNC_MAX_LAYERS] = {FALSE};
+	gint loss[STREAMINSYNC_MAX_LAYERS] = {0};
+
+	if (layers == NULL)
+		return;
+
+	for (gint i = 0; i < STREAMINSYNC_MAX_LAYERS; i++)
+	{
+		GstPad *feed = gst_pad_get_peer(layers->pads[i]);
+		streaminsync_stats_t stats = {0};
+		guint session, pt;
+		guint32 ssrc;
+
+		if (feed == NULL)
+			continue;
+
+		linked[i] = streaminsync_parse_pad_name(GST_PAD_NAME(feed), &session,
+												&ssrc, &pt);
+		gst_object_unref(feed);
+		if (!linked[i])
+			continue;
+
+		streaminsync_stats_rtp(rtpbin, session, ssrc, &stats);
+
+		// Counters start over with a new SSRC
+		if (ssrc == layers->ssrcs[i] && stats.received >= layers->received[i] &&
+			stats.lost >= layers->lost[i])
+		{
+			const guint64 received = stats.received - layers->received[i];
+			const guint64 lost = stats.lost - layers->lost[i];
+
+			loss[i] = received + lost ? lost * 100 / (received + lost) : 0;
+		}
+
+		layers->ssrcs[i] = ssrc;
+		layers->received[i] = stats.received;
+		layers->lost[i] = stats.lost;
+	}
+
+	// Nothing to go by yet
+	if (layer < 0 && (height <= 0 || decoded_height <= 0))
+		return;
+
+	const gint active = active_layer(layers);
+	gint pick = layer;
+
+	if (pick < 0)
+	{
+		const gint full_height = decoded_height << active;
+
+		pick = 0;
+		for (gint i = STREAMINSYNC_MAX_LAYERS - 1; i > 0; i--)
+		{
+			if (linked[i] && full_height >> i >= height)
+			{
+				pick = i;
+				break;
+			}
+		}
+
+		while (pick + 1 < STREAMINSYNC_MAX_LAYERS && linked[pick + 1] &&
+			   loss[pick] > LAYER_LOSS_MAX)
+			pick++;
+
+		if (pick < active)
+		{
+			layers->up_count = layers->up == pick ? layers->up_count + 1 : 1;
+			layers->up = pick;
+			if (layers->up_count < LAYER_HOLD)
+				return;
+		}
+	}
+
+	layers->up_count = 0;
+
+	if (pick >= STREAMINSYNC_MAX_LAYERS || !linked[pick])
+		return;
+
+	streaminsync_layers_select(selector, pick);
+}
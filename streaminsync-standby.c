@@ -0,0 +1,181 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Standby of hidden sources. The network, the jitterbuffers and RTCP keep
+// running and only video decoding stops, which is where the CPU goes. The
+// coded video since the last keyframe is kept all along, so that on show the
+// decoder catches up from that keyframe right away instead of waiting for
+// the next one.
+
+#include "streaminsync.h"
+
+#define STANDBY_KEY "streaminsync-standby"
+
+// Longest GOP kept, in buffers. Past it the cache is given up and a keyframe
+// is asked for on show.
+#define GOP_MAX 600
+
+typedef struct
+{
+	GstPad *decoder_sink;
+	GMutex mutex;
+	// Coded buffers since the last keyframe, if that one was seen
+	GQueue gop;
+	gboolean complete;
+	gboolean standby;
+	gboolean resume;
+	gboolean requested;
+} standby_t;
+
+static void clear_gop(standby_t *standby)
+{
+	g_queue_clear_full(&standby->gop, (GDestroyNotify)gst_buffer_unref);
+}
+
+static void standby_free(gpointer user_data)
+{
+	standby_t *standby = user_data;
+
+	clear_gop(standby);
+	gst_object_unref(standby->decoder_sink);
+	g_mutex_clear(&standby->mutex);
+	g_free(standby);
+}
+
+// Runs on what the decoder is fed with, from the parser's streaming thread.
+static GstPadProbeReturn gop_probe(GstPad *pad, GstPadProbeInfo *info,
+								   gpointer user_data)
+{
+	standby_t *standby = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GQueue missed = G_QUEUE_INIT;
+	gboolean request = FALSE;
+	GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+
+	g_mutex_lock(&standby->mutex);
+
+	if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+	{
+		clear_gop(standby);
+		standby->complete = TRUE;
+	}
+
+	if (standby->complete && standby->gop.length >= GOP_MAX)
+	{
+		clear_gop(standby);
+		standby->complete = FALSE;
+	}
+
+	if (standby->complete)
+		g_queue_push_tail(&standby->gop, gst_buffer_ref(buffer));
+
+	if (standby->standby)
+	{
+		ret = GST_PAD_PROBE_DROP;
+	}
+	else if (standby->resume && !standby->complete)
+	{
+		// Nothing to start from, wait for the keyframe asked for
+		request = !standby->requested;
+		standby->requested = TRUE;
+		ret = GST_PAD_PROBE_DROP;
+	}
+	else if (standby->resume)
+	{
+		// Everything before this buffer, which goes through as usual. The
+		// decoder drops what it decodes from these instead of outputting it.
+		for (GList *l = standby->gop.head; l && l->next; l = l->next)
+		{
+			GstBuffer *copy = gst_buffer_copy(l->data);
+			GST_BUFFER_FLAG_SET(copy, GST_BUFFER_FLAG_DECODE_ONLY);
+			g_queue_push_tail(&missed, copy);
+		}
+
+		standby->resume = FALSE;
+	}
+
+	g_mutex_unlock(&standby->mutex);
+
+	if (missed.length > 0)
+		blog(LOG_INFO, "Resuming decoding from a keyframe %u frames back",
+			 missed.length);
+
+	GstBuffer *copy;
+	while ((copy = g_queue_pop_head(&missed)))
+		gst_pad_chain(standby->decoder_sink, copy);
+
+	if (request)
+		gst_pad_push_event(standby->decoder_sink,
+						   gst_video_event_new_upstream_force_key_unit(
+							   GST_CLOCK_TIME_NONE, TRUE, 0));
+
+	return ret;
+}
+
+// Keeps the GOP of a video branch whose decoder is linked already.
+void streaminsync_standby_attach(GstElement *branch, GstElement *decoder,
+								 gboolean standby)
+{
+	GstPad *sink = gst_element_get_static_pad(decoder, "sink");
+	GstPad *feed = gst_pad_get_peer(sink);
+
+	if (feed == NULL)
+	{
+		gst_object_unref(sink);
+		return;
+	}
+
+	standby_t *state = g_new0(standby_t, 1);
+
+	state->decoder_sink = sink;
+	g_mutex_init(&state->mutex);
+	g_queue_init(&state->gop);
+	state->standby = standby;
+	state->resume = standby;
+
+	gst_pad_add_probe(feed, GST_PAD_PROBE_TYPE_BUFFER, gop_probe, state,
+					  NULL);
+	gst_object_unref(feed);
+
+	g_object_set_data_full(G_OBJECT(branch), STANDBY_KEY, state,
+						   standby_free);
+}
+
+// Stops or resumes decoding on a branch, audio branches are left alone.
+void streaminsync_branch_set_standby(GstElement *branch, gboolean standby)
+{
+	standby_t *state = g_object_get_data(G_OBJECT(branch), STANDBY_KEY);
+
+	if (state == NULL)
+		return;
+
+	g_mutex_lock(&state->mutex);
+
+	if (standby && !state->standby)
+		blog(LOG_INFO, "Video decoding in standby");
+
+	// Resuming only matters after standby, a resume pending from an
+	// earlier one carries on
+	state->resume = state->resume || (state->standby && !standby);
+	state->requested = state->requested && state->resume;
+	state->standby = standby;
+
+	g_mutex_unlock(&state->mutex);
+}
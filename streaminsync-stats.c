@@ -0,0 +1,429 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Receiver statistics, gathered from rtpbin and from counters kept on the
+// decoding branches.
+
+#include "streaminsync.h"
+
+#define COUNTERS_KEY "streaminsync-counters"
+
+// Frames in flight a stage remembers the entry time of. Frames the stage
+// drops are overwritten eventually.
+#define STAGE_SLOTS 32
+
+// Weight of a new sample in the smoothed stage latency, 1/n
+#define STAGE_SMOOTHING 8
+
+typedef enum
+{
+	STAGE_DECODE,
+	STAGE_DECODED_QUEUE,
+	STAGE_CONVERT,
+	STAGE_CONVERTED_QUEUE,
+	STAGES,
+} stage_id_t;
+
+// Time frames spend in one element of the chain. Frames are matched by PTS
+// on the way out, decoders reorder and queues may drop.
+typedef struct
+{
+	GMutex mutex;
+	struct
+	{
+		GstClockTime pts;
+		gint64 entered;
+	} slots[STAGE_SLOTS];
+	guint next;
+	// Smoothed, in us
+	gint latency;
+} stage_t;
+
+// Updated from the streaming threads of one branch
+typedef struct
+{
+	GstElement *appsink;
+	gint decoder_in;
+	gint decoder_out;
+	// How long before its render time the last buffer reached the sink, ms
+	gint ahead;
+	stage_t stages[STAGES];
+} counters_t;
+
+static GstPadProbeReturn count_probe(GstPad *pad, GstPadProbeInfo *info,
+									 gpointer user_data)
+{
+	g_atomic_int_inc((gint *)user_data);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn ahead_probe(GstPad *pad, GstPadProbeInfo *info,
+									 gpointer user_data)
+{
+	counters_t *counters = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+	if (!GST_BUFFER_PTS_IS_VALID(buffer))
+		return GST_PAD_PROBE_OK;
+
+	GstClock *clock = gst_element_get_clock(counters->appsink);
+	GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+
+	if (clock && event)
+	{
+		const GstSegment *segment;
+		gst_event_parse_segment(event, &segment);
+
+		const GstClockTime running = gst_segment_to_running_time(
+			segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+
+		if (GST_CLOCK_TIME_IS_VALID(running))
+			g_atomic_int_set(
+				&counters->ahead,
+				GST_CLOCK_DIFF(gst_clock_get_time(clock),
+							   running + gst_element_get_base_time(
+											 counters->appsink)) /
+					GST_MSECOND);
+	}
+
+	if (event)
+		gst_event_unref(event);
+	if (clock)
+		gst_object_unref(clock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn stage_in_probe(GstPad *pad, GstPadProbeInfo *info,
+										gpointer user_data)
+{
+	stage_t *stage = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+	if (!GST_BUFFER_PTS_IS_VALID(buffer))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock(&stage->mutex);
+	stage->slots[stage->next].pts = GST_BUFFER_PTS(buffer);
+	stage->slots[stage->next].entered = g_get_monotonic_time();
+	stage->next = (stage->next + 1) % STAGE_SLOTS;
+	g_mutex_unlock(&stage->mutex);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn stage_out_probe(GstPad *pad, GstPadProbeInfo *info,
+										 gpointer user_data)
+{
+	stage_t *stage = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	gint64 entered = 0;
+
+	if (!GST_BUFFER_PTS_IS_VALID(buffer))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock(&stage->mutex);
+	for (guint i = 0; i < STAGE_SLOTS; i++)
+	{
+		if (stage->slots[i].pts == GST_BUFFER_PTS(buffer))
+		{
+			entered = stage->slots[i].entered;
+			stage->slots[i].pts = GST_CLOCK_TIME_NONE;
+			break;
+		}
+	}
+	g_mutex_unlock(&stage->mutex);
+
+	if (entered == 0)
+		return GST_PAD_PROBE_OK;
+
+	// Only this thread writes it
+	const gint latency = g_atomic_int_get(&stage->latency);
+	const gint sample = g_get_monotonic_time() - entered;
+
+	g_atomic_int_set(&stage->latency,
+					 latency + (sample - latency) / STAGE_SMOOTHING);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static void add_probe(GstElement *element, const gchar *name,
+					  GstPadProbeCallback callback, gpointer user_data)
+{
+	GstPad *pad = gst_element_get_static_pad(element, name);
+
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data,
+					  NULL);
+	gst_object_unref(pad);
+}
+
+static void counters_free(gpointer data)
+{
+	counters_t *counters = data;
+
+	for (gint i = 0; i < STAGES; i++)
+		g_mutex_clear(&counters->stages[i].mutex);
+
+	g_free(counters);
+}
+
+// Counts the frames going in and out of the decoder of a branch and how
+// early they reach its appsink. The counters live as long as the branch.
+void streaminsync_stats_attach(GstElement *branch, GstElement *decoder,
+							   GstElement *appsink)
+{
+	counters_t *counters = g_new0(counters_t, 1);
+
+	counters->appsink = appsink;
+
+	add_probe(decoder, "sink", count_probe, &counters->decoder_in);
+	add_probe(decoder, "src", count_probe, &counters->decoder_out);
+	add_probe(appsink, "sink", ahead_probe, counters);
+
+	for (gint i = 0; i < STAGES; i++)
+	{
+		g_mutex_init(&counters->stages[i].mutex);
+		for (guint j = 0; j < STAGE_SLOTS; j++)
+			counters->stages[i].slots[j].pts = GST_CLOCK_TIME_NONE;
+	}
+
+	g_object_set_data_full(G_OBJECT(branch), COUNTERS_KEY, counters,
+						   counters_free);
+}
+
+static void attach_stage(counters_t *counters, stage_id_t id,
+						 GstElement *element)
+{
+	if (element == NULL)
+		return;
+
+	add_probe(element, "sink", stage_in_probe, &counters->stages[id]);
+	add_probe(element, "src", stage_out_probe, &counters->stages[id]);
+}
+
+// Times each stage of the chain made by streaminsync_decoder_link, after
+// streaminsync_stats_attach. Serial chains have no queues to time.
+void streaminsync_stats_attach_stages(GstElement *branch, GstElement *decoder)
+{
+	counters_t *counters = g_object_get_data(G_OBJECT(branch), COUNTERS_KEY);
+	static const struct
+	{
+		stage_id_t id;
+		const gchar *name;
+	} named[] = {
+		{STAGE_DECODED_QUEUE, "decoded"},
+		{STAGE_CONVERT, "convert"},
+		{STAGE_CONVERTED_QUEUE, "converted"},
+	};
+
+	if (counters == NULL)
+		return;
+
+	attach_stage(counters, STAGE_DECODE, decoder);
+
+	for (gsize i = 0; i < G_N_ELEMENTS(named); i++)
+	{
+		GstElement *element =
+			gst_bin_get_by_name(GST_BIN(branch), named[i].name);
+
+		attach_stage(counters, named[i].id, element);
+		if (element)
+			gst_object_unref(element);
+	}
+}
+
+static void add_jitterbuffer_stats(GstElement *jitterbuffer, guint session,
+								   guint32 ssrc, streaminsync_stats_t *stats)
+{
+	GstStructure *s = NULL;
+	guint64 value;
+
+	if (!streaminsync_jitterbuffer_matches(jitterbuffer, session, ssrc))
+		return;
+
+	g_object_get(jitterbuffer, "stats", &s, NULL);
+	if (s == NULL)
+		return;
+
+	if (gst_structure_get_uint64(s, "num-late", &value))
+		stats->late += value;
+	if (gst_structure_get_uint64(s, "avg-jitter", &value))
+		stats->jitter = MAX(stats->jitter, value);
+	// A receive-only session gets no report blocks about itself, so the
+	// round trip is the one retransmissions take, from request to arrival.
+	if (gst_structure_get_uint64(s, "rtx-rtt", &value))
+		stats->rtt = MAX(stats->rtt, value);
+
+	gst_structure_free(s);
+}
+
+static void add_session_stats(GstElement *rtpbin, guint session, guint32 ssrc,
+							  streaminsync_stats_t *stats)
+{
+	GObject *internal = NULL;
+	GstStructure *s = NULL;
+
+	g_signal_emit_by_name(rtpbin, "get-internal-session", session, &internal);
+	if (internal == NULL)
+		return;
+
+	g_object_get(internal, "stats", &s, NULL);
+	g_object_unref(internal);
+	if (s == NULL)
+		return;
+
+	const GValue *value = gst_structure_get_value(s, "source-stats");
+	GValueArray *sources = value ? g_value_get_boxed(value) : NULL;
+
+	for (guint i = 0; sources != NULL && i < sources->n_values; i++)
+	{
+		const GstStructure *source =
+			g_value_get_boxed(&sources->values[i]);
+		gboolean internal_source = FALSE;
+		guint source_ssrc = 0;
+		guint64 received;
+		gint lost;
+
+		gst_structure_get_boolean(source, "internal", &internal_source);
+		gst_structure_get_uint(source, "ssrc", &source_ssrc);
+
+		if (internal_source || (ssrc != 0 && source_ssrc != ssrc))
+			continue;
+
+		if (gst_structure_get_uint64(source, "packets-received", &received))
+			stats->received += received;
+		if (gst_structure_get_int(source, "packets-lost", &lost) && lost > 0)
+			stats->lost += lost;
+	}
+
+	gst_structure_free(s);
+}
+
+// rtpbin gives each sender a decoder of its own, after its jitterbuffer and
+// with the same caps.
+static void add_fec_stats(GstElement *fecdec, guint session, guint32 ssrc,
+						  streaminsync_stats_t *stats)
+{
+	guint recovered = 0;
+
+	if (!streaminsync_jitterbuffer_matches(fecdec, session, ssrc))
+		return;
+
+	g_object_get(fecdec, "recovered", &recovered, NULL);
+	stats->recovered += recovered;
+}
+
+// Network side of the stats: packets, jitter, round trip and latency. Only
+// the sender 'ssrc' is accounted for, or all of them with 0, in 'session', or
+// all of them with G_MAXUINT.
+void streaminsync_stats_rtp(GstElement *rtpbin, guint session, guint32 ssrc,
+							streaminsync_stats_t *stats)
+{
+	GstIterator *it = gst_bin_iterate_all_by_element_factory_name(
+		GST_BIN(rtpbin), "rtpjitterbuffer");
+	GValue item = G_VALUE_INIT;
+
+	while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+	{
+		add_jitterbuffer_stats(g_value_get_object(&item), session, ssrc,
+							   stats);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(it);
+
+	it = gst_bin_iterate_all_by_element_factory_name(GST_BIN(rtpbin),
+													 "rtpulpfecdec");
+	while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+	{
+		add_fec_stats(g_value_get_object(&item), session, ssrc, stats);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(it);
+
+	if (session != STREAMINSYNC_SESSION_AUDIO)
+		add_session_stats(rtpbin, STREAMINSYNC_SESSION_VIDEO, ssrc, stats);
+	if (session != STREAMINSYNC_SESSION_VIDEO)
+		add_session_stats(rtpbin, STREAMINSYNC_SESSION_AUDIO, ssrc, stats);
+
+	guint latency = 0;
+	g_object_get(rtpbin, "latency", &latency, NULL);
+	stats->latency = latency;
+}
+
+// Decoding side of the stats, from branches made by streaminsync_branch_new.
+// Either may be NULL or a branch without counters.
+void streaminsync_stats_branches(GstElement *video, GstElement *audio,
+								 streaminsync_stats_t *stats)
+{
+	counters_t *v = video ? g_object_get_data(G_OBJECT(video), COUNTERS_KEY)
+						  : NULL;
+	counters_t *a = audio ? g_object_get_data(G_OBJECT(audio), COUNTERS_KEY)
+						  : NULL;
+
+	if (v)
+	{
+		const gint in = g_atomic_int_get(&v->decoder_in);
+		const gint out = g_atomic_int_get(&v->decoder_out);
+		GstStructure *s = NULL;
+		guint64 dropped = 0;
+
+		g_object_get(v->appsink, "stats", &s, NULL);
+		if (s)
+		{
+			gst_structure_get_uint64(s, "dropped", &dropped);
+			gst_structure_free(s);
+		}
+
+		// Frames still in the decoder count as dropped until they are out
+		stats->decoded = out;
+		stats->dropped = MAX(in - out, 0) + dropped;
+
+		stats->decode_us = g_atomic_int_get(&v->stages[STAGE_DECODE].latency);
+		stats->convert_us =
+			g_atomic_int_get(&v->stages[STAGE_CONVERT].latency);
+		stats->queue_us =
+			g_atomic_int_get(&v->stages[STAGE_DECODED_QUEUE].latency) +
+			g_atomic_int_get(&v->stages[STAGE_CONVERTED_QUEUE].latency);
+	}
+
+	if (v && a)
+		stats->av_offset =
+			g_atomic_int_get(&v->ahead) - g_atomic_int_get(&a->ahead);
+}
+
+// One line of key=value pairs, meant for parsing the OBS log.
+gchar *streaminsync_stats_format(const streaminsync_stats_t *stats)
+{
+	return g_strdup_printf(
+		"received=%" G_GUINT64_FORMAT " lost=%" G_GUINT64_FORMAT
+		" recovered=%" G_GUINT64_FORMAT " late=%" G_GUINT64_FORMAT " jitter_ms=%" G_GUINT64_FORMAT
+		" rtt_ms=%" G_GUINT64_FORMAT " latency_ms=%d"
+		" decoded=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT
+		" av_offset_ms=%d ttff_ms=%d stretched=%" G_GUINT64_FORMAT
+		" decode_us=%d queue_us=%d convert_us=%d",
+		stats->received, stats->lost, stats->recovered, stats->late,
+		stats->jitter / GST_MSECOND, stats->rtt / GST_MSECOND,
+		stats->latency, stats->decoded, stats->dropped, stats->av_offset,
+		stats->ttff, stats->stretched, stats->decode_us, stats->queue_us,
+		stats->convert_us);
+}
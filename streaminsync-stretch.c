@@ -0,0 +1,228 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Audio time-stretching. With scheduled playout every audio buffer comes with
+// its own deadline, which moves whenever the latency is adapted or the clock
+// corrected. Played out as they come, those moves are gaps and overlaps and
+// can be heard as clicks. Instead audio is kept on a continuous timeline and
+// brought back to the deadline by dropping or repeating a single pitch period
+// at a time, where it is least audible, like the accelerate and preemptive
+// expand operations of WebRTC's NetEQ. Lost packets are concealed before,
+// by the Opus decoder.
+
+#include <string.h>
+
+#include "streaminsync.h"
+
+// Range of the pitch periods looked for, 2.5 to 10 ms
+#define PERIOD_MIN_HZ 400
+#define PERIOD_MAX_HZ 100
+
+// How alike two periods have to be to splice them unnoticed, as a squared
+// normalised correlation
+#define CORRELATION_MIN 0.5f
+
+// Mean square below which audio counts as silence, spliced anywhere
+#define SILENCE 1e-6f
+
+// Deadlines moving further than this are jumped to, stretching would take
+// too long to catch up
+#define RESYNC (100 * GST_MSECOND)
+
+struct streaminsync_stretch
+{
+	gint rate;
+	gint channels;
+	// Start of the continuous timeline and the frames played out since
+	guint64 base;
+	guint64 frames;
+	gfloat *out;
+	gsize out_frames;
+	gint stretched;
+};
+
+streaminsync_stretch_t *streaminsync_stretch_new(void)
+{
+	return g_new0(streaminsync_stretch_t, 1);
+}
+
+void streaminsync_stretch_free(streaminsync_stretch_t *stretch)
+{
+	if (stretch == NULL)
+		return;
+
+	g_free(stretch->out);
+	g_free(stretch);
+}
+
+void streaminsync_stretch_reset(streaminsync_stretch_t *stretch)
+{
+	stretch->base = 0;
+	stretch->frames = 0;
+}
+
+gint streaminsync_stretch_count(streaminsync_stretch_t *stretch)
+{
+	return g_atomic_int_get(&stretch->stretched);
+}
+
+// The period in [min, max] frames the audio repeats best at, and how well
+// it does.
+static guint32 best_period(const gfloat *in, gint channels, guint32 min,
+						   guint32 max, gfloat *correlation)
+{
+	guint32 best = max;
+
+	*correlation = -1.0f;
+
+	for (guint32 period = min; period <= max; period++)
+	{
+		const guint32 samples = period * channels;
+		const gfloat *a = in;
+		const gfloat *b = in + samples;
+		gfloat ab = 0.0f;
+		gfloat aa = 0.0f;
+		gfloat bb = 0.0f;
+
+		for (guint32 i = 0; i < samples; i++)
+		{
+			ab += a[i] * b[i];
+			aa += a[i] * a[i];
+			bb += b[i] * b[i];
+		}
+
+		if (aa + bb < SILENCE * 2 * samples)
+		{
+			*correlation = 1.0f;
+			return period;
+		}
+
+		const gfloat score = ab > 0.0f ? ab * ab / (aa * bb) : 0.0f;
+
+		if (score > *correlation)
+		{
+			*correlation = score;
+			best = period;
+		}
+	}
+
+	return best;
+}
+
+// Repeats (expand) or drops the first period of 'in', cross-fading the
+// period into the one next to it. 'frames' has to be at least two periods.
+static guint32 splice(streaminsync_stretch_t *stretch, const gfloat *in,
+					  guint32 frames, guint32 period, gboolean expand)
+{
+	const gint channels = stretch->channels;
+	const guint32 length = expand ? frames + period : frames - period;
+
+	if (stretch->out_frames < length)
+	{
+		stretch->out = g_renew(gfloat, stretch->out, length * channels);
+		stretch->out_frames = length;
+	}
+
+	gfloat *out = stretch->out;
+
+	if (expand)
+	{
+		memcpy(out, in, period * channels * sizeof(gfloat));
+		out += period * channels;
+	}
+
+	// From the first period into the second one when dropping, back from
+	// the second into the first when repeating
+	const gfloat *from = expand ? in + period * channels : in;
+	const gfloat *to = expand ? in : in + period * channels;
+
+	for (guint32 i = 0; i < period; i++)
+	{
+		const gfloat weight = (i + 1) / (gfloat)(period + 1);
+
+		for (gint c = 0; c < channels; c++)
+		{
+			const guint32 n = i * channels + c;
+			out[n] = from[n] * (1.0f - weight) + to[n] * weight;
+		}
+	}
+	out += period * channels;
+
+	const guint32 rest = expand ? period : 2 * period;
+	memcpy(out, in + rest * channels,
+		   (frames - rest) * channels * sizeof(gfloat));
+
+	return length;
+}
+
+guint32 streaminsync_stretch_process(streaminsync_stretch_t *stretch,
+									 const gfloat *in, guint32 frames,
+									 gint rate, gint channels, guint64 due,
+									 const gfloat **out, guint64 *timestamp)
+{
+	*out = in;
+
+	if (rate != stretch->rate || channels != stretch->channels)
+	{
+		stretch->rate = rate;
+		stretch->channels = channels;
+		streaminsync_stretch_reset(stretch);
+	}
+
+	const guint64 next =
+		stretch->base +
+		gst_util_uint64_scale(stretch->frames, GST_SECOND, rate);
+	const GstClockTimeDiff error = GST_CLOCK_DIFF(next, due);
+
+	if (stretch->base == 0 || ABS(error) > RESYNC)
+	{
+		stretch->base = due;
+		stretch->frames = frames;
+		*timestamp = due;
+		return frames;
+	}
+
+	*timestamp = next;
+
+	// A period longer than the error would overshoot, a deadline closer
+	// than the shortest period is met
+	const guint32 min = rate / PERIOD_MIN_HZ;
+	const guint32 max =
+		MIN(MIN(rate / PERIOD_MAX_HZ, frames / 2),
+			gst_util_uint64_scale(ABS(error), rate, GST_SECOND));
+
+	if (min > 0 && max >= min)
+	{
+		gfloat correlation;
+		const guint32 period =
+			best_period(in, channels, min, max, &correlation);
+
+		if (correlation >= CORRELATION_MIN)
+		{
+			frames = splice(stretch, in, frames, period, error > 0);
+			*out = stretch->out;
+			g_atomic_int_inc(&stretch->stretched);
+		}
+	}
+
+	stretch->frames += frames;
+
+	return frames;
+}
@@ -23,24 +23,250 @@
 #include <gst/video/video.h>
 #include <gst/audio/audio.h>
 #include <gst/app/app.h>
-#include <gst/net/gstnet.h>
 
+#include "streaminsync.h"
+
+// Typed copy of the source settings. A new one is built on every create and
+// update and published with an atomic pointer swap, so the streaming and bus
+// threads never have to go through the obs_data_t lookups.
 typedef struct
 {
+	gchar *sender_ip;
+	gint port;
+	gboolean use_timestamps_video;
+	gboolean use_timestamps_audio;
+	gboolean scheduled_playout;
+	gboolean audio_stretch;
+	gboolean restart_on_eos;
+	gboolean restart_on_error;
+	guint restart_timeout;
+	gboolean stop_on_hide;
+	gboolean standby_on_hide;
+	gboolean block_video;
+	gboolean block_audio;
+	gboolean clear_on_end;
+	gboolean request_keyframes;
+	gchar *decoder;
+	gint decoder_threads;
+	gint decoder_thread_type;
+	gboolean pipelined_decode;
+	// Simulcast layer to decode, -1 to pick from the render size and loss
+	gint simulcast_layer;
+	gboolean shared_receiver;
+	gboolean bundle;
+	guint32 stream_id;
+	streaminsync_latency_t latency;
+	gchar *ntp_server;
+	streaminsync_clock_config_t clock;
+} settings_t;
+
+// Where a source is in its life. Pipelines are only ever built, changed and
+// torn down on the dispatcher thread, the OBS callbacks queue the work there
+// and return, so that loading many sources does not hold OBS up. The state
+// is what has been asked for last, STARTING settles on the result once the
+// start has run.
+typedef enum
+{
+	STATE_STOPPED,
+	STATE_STARTING,
+	STATE_RUNNING,
+	STATE_FAILED,
+} state_t;
+
+typedef struct
+{
+	gint state;
 	GstElement *pipe;
+	GstElement *rtpbin;
+	GstClock *clock;
 	obs_source_t *source;
 	obs_data_t *settings;
-	gint64 frame_count;
-	gint64 audio_count;
+	// The latest settings, see settings_acquire()
+	settings_t *snapshot;
+	GMutex snapshot_mutex;
+	// What the running pipeline or receiver was set up with, held
+	const settings_t *applied;
+	streaminsync_stream_t *stream;
+	guint64 frame_count;
+	guint64 audio_frames;
+	GstCaps *video_caps;
+	GstVideoInfo video_info;
+	struct obs_source_frame video_template;
+	// Size of the last video, for the placeholder
+	gint last_width;
+	gint last_height;
+	GstCaps *audio_caps;
+	GstAudioInfo audio_info;
+	struct obs_source_audio audio_template;
+	streaminsync_stretch_t *stretch;
 	GSource *timeout;
-	GThread *thread;
-	GMainLoop *loop;
-	GMutex mutex;
-	GCond cond;
+	gboolean running;
+	GSource *stats_timer;
+	GSource *layers_timer;
+	GMutex stats_mutex;
+	streaminsync_stats_t stats;
+	// Time to first frame, measured from a (re)start or from the first
+	// packet after the sender went silent.
+	gint64 restart_at;
+	gint restart_pending;
+	gint ttff;
+	gint warm_resets;
+	gint silent;
+	// Hidden with standby_on_hide, video is not decoded
+	gint standby;
+	// Tallest the source is drawn, kept up from the video tick for the
+	// layer selection, see gstreamer_source_video_tick()
+	gint render_height;
+	gfloat since_render_height;
 } data_t;
 
+// Names of the decoding branches in the pipeline, by session
+static const gchar *const branch_names[2] = {"video", "audio"};
+
+// Name of the simulcast layer selector in front of the video branch
+#define LAYERS_NAME "layers"
+
+// Placeholder size until a source has had video, that of the sender's
+// default
+#define PLACEHOLDER_WIDTH 1920
+#define PLACEHOLDER_HEIGHT 1080
+
+// Warm resets of a stream before it gets rebuilt, if no frame got through in
+// between
+#define WARM_RESETS_MAX 3
+
+// How often the receiver stats are gathered and logged
+#define STATS_INTERVAL_MS 5000
+
+// How often the simulcast layer to decode is picked
+#define LAYERS_INTERVAL_MS 1000
+
+// Number of sources with a running pipeline, used to share the cores
+// between the decoders.
+static gint active_sources;
+
 static void create_pipeline(data_t *data);
 
+static settings_t *settings_new(obs_data_t *settings)
+{
+	settings_t *snapshot = g_atomic_rc_box_new0(settings_t);
+
+	snapshot->sender_ip =
+		g_strdup(obs_data_get_string(settings, "sender_ip"));
+	snapshot->port = obs_data_get_int(settings, "port");
+	snapshot->use_timestamps_video =
+		obs_data_get_bool(settings, "use_timestamps_video");
+	snapshot->use_timestamps_audio =
+		obs_data_get_bool(settings, "use_timestamps_audio");
+	snapshot->scheduled_playout =
+		obs_data_get_bool(settings, "scheduled_playout");
+	snapshot->audio_stretch = obs_data_get_bool(settings, "audio_stretch");
+	snapshot->restart_on_eos = obs_data_get_bool(settings, "restart_on_eos");
+	snapshot->restart_on_error =
+		obs_data_get_bool(settings, "restart_on_error");
+	snapshot->restart_timeout =
+		obs_data_get_int(settings, "restart_timeout");
+	snapshot->stop_on_hide = obs_data_get_bool(settings, "stop_on_hide");
+	snapshot->standby_on_hide =
+		obs_data_get_bool(settings, "standby_on_hide");
+	snapshot->block_video = obs_data_get_bool(settings, "block_video");
+	snapshot->block_audio = obs_data_get_bool(settings, "block_audio");
+	snapshot->clear_on_end = obs_data_get_bool(settings, "clear_on_end");
+	snapshot->request_keyframes =
+		obs_data_get_bool(settings, "request_keyframes");
+	snapshot->decoder = g_strdup(obs_data_get_string(settings, "decoder"));
+	snapshot->decoder_threads =
+		obs_data_get_int(settings, "decoder_threads");
+	snapshot->decoder_thread_type =
+		obs_data_get_int(settings, "decoder_thread_type");
+	snapshot->pipelined_decode =
+		obs_data_get_bool(settings, "pipelined_decode");
+	snapshot->simulcast_layer = obs_data_get_int(settings, "simulcast_layer");
+	snapshot->shared_receiver =
+		obs_data_get_bool(settings, "shared_receiver");
+	snapshot->bundle = obs_data_get_bool(settings, "bundle");
+	snapshot->stream_id = obs_data_get_int(settings, "stream_id");
+	snapshot->latency.latency = obs_data_get_int(settings, "latency");
+	snapshot->latency.min = obs_data_get_int(settings, "latency_min");
+	snapshot->latency.max = obs_data_get_int(settings, "latency_max");
+	snapshot->latency.adaptive =
+		obs_data_get_bool(settings, "latency_adaptive");
+	snapshot->ntp_server =
+		g_strdup(obs_data_get_string(settings, "ntp_server"));
+	snapshot->clock.source = obs_data_get_int(settings, "clock_source");
+	snapshot->clock.address = snapshot->ntp_server;
+	snapshot->clock.port =
+		snapshot->clock.source == STREAMINSYNC_CLOCK_NTP
+			? obs_data_get_int(settings, "ntp_port")
+			: obs_data_get_int(settings, "clock_port");
+	snapshot->clock.threshold =
+		obs_data_get_int(settings, "clock_threshold");
+
+	return snapshot;
+}
+
+static void settings_clear(gpointer user_data)
+{
+	settings_t *snapshot = user_data;
+
+	g_free(snapshot->sender_ip);
+	g_free(snapshot->decoder);
+	g_free(snapshot->ntp_server);
+}
+
+// Snapshots are reference counted. Any thread takes the latest one with
+// settings_acquire() and gives it back with settings_release(), so that a
+// snapshot replaced meanwhile lives on until its last reader is done.
+static const settings_t *settings_acquire(data_t *data)
+{
+	g_mutex_lock(&data->snapshot_mutex);
+	const settings_t *snapshot = g_atomic_rc_box_acquire(data->snapshot);
+	g_mutex_unlock(&data->snapshot_mutex);
+
+	return snapshot;
+}
+
+static void settings_release(const settings_t *snapshot)
+{
+	g_atomic_rc_box_release_full((gpointer)snapshot, settings_clear);
+}
+
+static void publish_settings(data_t *data, obs_data_t *settings)
+{
+	settings_t *snapshot = settings_new(settings);
+
+	g_mutex_lock(&data->snapshot_mutex);
+	settings_t *old = data->snapshot;
+	data->snapshot = snapshot;
+	g_mutex_unlock(&data->snapshot_mutex);
+
+	if (old)
+		settings_release(old);
+}
+
+static void mark_restart(data_t *data)
+{
+	data->restart_at = g_get_monotonic_time();
+	g_atomic_int_set(&data->restart_pending, TRUE);
+}
+
+static void record_first_frame(data_t *data)
+{
+	if (!g_atomic_int_compare_and_exchange(&data->restart_pending, TRUE,
+										   FALSE))
+		return;
+
+	const gint ttff =
+		(g_get_monotonic_time() - data->restart_at) / G_TIME_SPAN_MILLISECOND;
+
+	g_atomic_int_set(&data->ttff, ttff);
+	g_atomic_int_set(&data->warm_resets, 0);
+
+	const settings_t *settings = settings_acquire(data);
+	blog(LOG_INFO, "First frame on port %d after %d ms", settings->port, ttff);
+	settings_release(settings);
+}
+
 static void timeout_destroy(gpointer user_data)
 {
 	data_t *data = user_data;
@@ -50,10 +276,22 @@ static void timeout_destroy(gpointer user_data)
 	data->timeout = NULL;
 }
 
+static void release_rtpbin(data_t *data)
+{
+	if (data->rtpbin == NULL)
+		return;
+
+	streaminsync_latency_remove(data->rtpbin);
+	gst_object_unref(data->rtpbin);
+	data->rtpbin = NULL;
+}
+
 static gboolean start_pipe(gpointer user_data)
 {
 	data_t *data = user_data;
 
+	release_rtpbin(data);
+
 	GstBus *bus = gst_element_get_bus(data->pipe);
 	gst_bus_remove_watch(bus);
 	gst_object_unref(bus);
@@ -65,6 +303,9 @@ static gboolean start_pipe(gpointer user_data)
 
 	if (data->pipe)
 		gst_element_set_state(data->pipe, GST_STATE_PLAYING);
+	else
+		g_atomic_int_compare_and_exchange(&data->state, STATE_RUNNING,
+										  STATE_FAILED);
 
 	return G_SOURCE_REMOVE;
 }
@@ -73,6 +314,7 @@ static gboolean bus_callback(GstBus *bus, GstMessage *message,
 							 gpointer user_data)
 {
 	data_t *data = user_data;
+	const settings_t *settings = settings_acquire(data);
 
 	switch (GST_MESSAGE_TYPE(message))
 	{
@@ -82,20 +324,30 @@ static gboolean bus_callback(GstBus *bus, GstMessage *message,
 		gst_message_parse_error(message, &err, NULL);
 		blog(LOG_ERROR, "%s", err->message);
 		g_error_free(err);
+
+		// Try resetting just the failed stream first, a rebuild rebinds
+		// the sockets and loses the jitterbuffer and session state.
+		if (data->rtpbin &&
+			g_atomic_int_get(&data->warm_resets) < WARM_RESETS_MAX &&
+			streaminsync_warm_reset(data->pipe, data->rtpbin,
+									GST_MESSAGE_SRC(message)))
+		{
+			g_atomic_int_inc(&data->warm_resets);
+			mark_restart(data);
+			break;
+		}
 	} // fallthrough
 	case GST_MESSAGE_EOS:
 		gst_element_set_state(data->pipe, GST_STATE_NULL);
-		if (obs_data_get_bool(data->settings, "clear_on_end"))
+		if (settings->clear_on_end)
 			obs_source_output_video(data->source, NULL);
-		if (obs_data_get_bool(data->settings,
-							  GST_MESSAGE_TYPE(message) ==
-									  GST_MESSAGE_ERROR
-								  ? "restart_on_error"
-								  : "restart_on_eos") &&
+		if ((GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR
+				 ? settings->restart_on_error
+				 : settings->restart_on_eos) &&
 			data->timeout == NULL)
 		{
-			data->timeout = g_timeout_source_new(obs_data_get_int(
-				data->settings, "restart_timeout"));
+			data->timeout =
+				g_timeout_source_new(settings->restart_timeout);
 			g_source_set_callback(data->timeout, start_pipe, data,
 								  timeout_destroy);
 			g_source_attach(data->timeout,
@@ -110,106 +362,128 @@ static gboolean bus_callback(GstBus *bus, GstMessage *message,
 		g_error_free(err);
 	}
 	break;
+	case GST_MESSAGE_LATENCY:
+		// Posted by the jitterbuffers when the latency controller changes
+		// them, the sinks only sync on the new value once redistributed.
+		gst_bin_recalculate_latency(GST_BIN(data->pipe));
+		break;
+	case GST_MESSAGE_ELEMENT:
+		// Posted by the video udpsrc for as long as nothing arrives. The
+		// pipeline keeps running and picks up again by itself.
+		if (gst_message_has_name(message, "GstUDPSrcTimeout") &&
+			g_atomic_int_compare_and_exchange(&data->silent, FALSE, TRUE))
+		{
+			blog(LOG_WARNING,
+				 "No packets from %s on port %d, waiting for the sender",
+				 settings->sender_ip, settings->port);
+			if (settings->clear_on_end)
+				obs_source_output_video(data->source, NULL);
+		}
+		break;
 	default:
 		break;
 	}
 
+	settings_release(settings);
+
 	return TRUE;
 }
 
-static GstFlowReturn video_new_sample(GstAppSink *appsink, gpointer user_data)
+static GstPadProbeReturn rtp_probe(GstPad *pad, GstPadProbeInfo *info,
+								   gpointer user_data)
 {
 	data_t *data = user_data;
-	GstSample *sample = gst_app_sink_pull_sample(appsink);
-	GstBuffer *buffer = gst_sample_get_buffer(sample);
-	GstCaps *caps = gst_sample_get_caps(sample);
-	GstMapInfo info;
-	GstVideoInfo video_info;
 
-	gst_video_info_from_caps(&video_info, caps);
-	gst_buffer_map(buffer, &info, GST_MAP_READ);
+	if (g_atomic_int_get(&data->silent) &&
+		g_atomic_int_compare_and_exchange(&data->silent, TRUE, FALSE))
+	{
+		const settings_t *settings = settings_acquire(data);
+		blog(LOG_INFO, "Sender %s is back on port %d", settings->sender_ip,
+			 settings->port);
+		settings_release(settings);
+		mark_restart(data);
+	}
 
-	struct obs_source_frame frame = {};
+	return GST_PAD_PROBE_OK;
+}
 
-	frame.timestamp =
-		obs_data_get_bool(data->settings, "use_timestamps_video")
-			? GST_BUFFER_PTS(buffer)
-			: data->frame_count++;
+// Scheduled playout hands OBS the common deadline on its own timeline. The
+// fallbacks pace video by the frame rate and audio by the samples so far, so
+// that neither drifts from the other.
+static guint64 video_timestamp(data_t *data, GstAppSink *appsink,
+							   GstSample *sample)
+{
+	const settings_t *settings = settings_acquire(data);
+	const gboolean scheduled = settings->scheduled_playout;
+	const gboolean use_timestamps = settings->use_timestamps_video;
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
 
-	frame.width = video_info.width;
-	frame.height = video_info.height;
-	frame.linesize[0] = video_info.stride[0];
-	frame.linesize[1] = video_info.stride[1];
-	frame.linesize[2] = video_info.stride[2];
-	frame.data[0] = info.data + video_info.offset[0];
-	frame.data[1] = info.data + video_info.offset[1];
-	frame.data[2] = info.data + video_info.offset[2];
+	settings_release(settings);
 
-	enum video_range_type range = VIDEO_RANGE_DEFAULT;
-	switch (video_info.colorimetry.range)
+	if (scheduled)
 	{
-	case GST_VIDEO_COLOR_RANGE_0_255:
-		range = VIDEO_RANGE_FULL;
-		frame.full_range = 1;
-		break;
-	case GST_VIDEO_COLOR_RANGE_16_235:
-		range = VIDEO_RANGE_PARTIAL;
-		break;
-	default:
-		break;
+		const guint64 due = streaminsync_playout_time(appsink, sample);
+		if (due)
+			return due;
 	}
 
-	enum video_colorspace cs = VIDEO_CS_DEFAULT;
-	switch (video_info.colorimetry.matrix)
-	{
-	case GST_VIDEO_COLOR_MATRIX_BT709:
-		cs = VIDEO_CS_709;
-		break;
-	case GST_VIDEO_COLOR_MATRIX_BT601:
-		cs = VIDEO_CS_601;
-		break;
-	default:
-		break;
-	}
+	if (use_timestamps || data->video_info.fps_n <= 0)
+		return GST_BUFFER_PTS(buffer);
+
+	return gst_util_uint64_scale(data->frame_count++,
+								 GST_SECOND * data->video_info.fps_d,
+								 data->video_info.fps_n);
+}
+
+static guint64 audio_timestamp(data_t *data, GstBuffer *buffer,
+							   guint32 frames)
+{
+	const settings_t *settings = settings_acquire(data);
+	const gboolean use_timestamps = settings->use_timestamps_audio;
+	settings_release(settings);
+
+	if (use_timestamps)
+		return GST_BUFFER_PTS(buffer);
+
+	const guint64 timestamp = gst_util_uint64_scale(
+		data->audio_frames, GST_SECOND, data->audio_info.rate);
+	data->audio_frames += frames;
+
+	return timestamp;
+}
+
+static GstFlowReturn video_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+	data_t *data = user_data;
+	GstSample *sample = gst_app_sink_pull_sample(appsink);
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstCaps *caps = gst_sample_get_caps(sample);
+	GstMapInfo info;
 
-	video_format_get_parameters(cs, range, frame.color_matrix,
-								frame.color_range_min,
-								frame.color_range_max);
+	if (g_atomic_int_get(&data->restart_pending))
+		record_first_frame(data);
 
-	switch (video_info.finfo->format)
+	// Caps only change on renegotiation, everything derived from them is
+	// cached in the frame template until a sample arrives with new caps.
+	if (caps != data->video_caps)
 	{
-	case GST_VIDEO_FORMAT_I420:
-		frame.format = VIDEO_FORMAT_I420;
-		break;
-	case GST_VIDEO_FORMAT_NV12:
-		frame.format = VIDEO_FORMAT_NV12;
-		break;
-	case GST_VIDEO_FORMAT_BGRA:
-		frame.format = VIDEO_FORMAT_BGRA;
-		break;
-	case GST_VIDEO_FORMAT_BGRx:
-		frame.format = VIDEO_FORMAT_BGRX;
-		break;
-	case GST_VIDEO_FORMAT_RGBx:
-	case GST_VIDEO_FORMAT_RGBA:
-		frame.format = VIDEO_FORMAT_RGBA;
-		break;
-	case GST_VIDEO_FORMAT_UYVY:
-		frame.format = VIDEO_FORMAT_UYVY;
-		break;
-	case GST_VIDEO_FORMAT_YUY2:
-		frame.format = VIDEO_FORMAT_YUY2;
-		break;
-	case GST_VIDEO_FORMAT_YVYU:
-		frame.format = VIDEO_FORMAT_YVYU;
-		break;
-	default:
-		frame.format = VIDEO_FORMAT_NONE;
-		blog(LOG_ERROR, "Unknown video format: %s",
-			 video_info.finfo->name);
-		break;
+		gst_caps_replace(&data->video_caps, caps);
+		streaminsync_video_template(caps, &data->video_info,
+									&data->video_template);
+		g_atomic_int_set(&data->last_width, data->video_info.width);
+		g_atomic_int_set(&data->last_height, data->video_info.height);
 	}
 
+	gst_buffer_map(buffer, &info, GST_MAP_READ);
+
+	struct obs_source_frame frame = data->video_template;
+
+	frame.timestamp = video_timestamp(data, appsink, sample);
+
+	frame.data[0] = info.data + data->video_info.offset[0];
+	frame.data[1] = info.data + data->video_info.offset[1];
+	frame.data[2] = info.data + data->video_info.offset[2];
+
 	obs_source_output_video(data->source, &frame);
 
 	gst_buffer_unmap(buffer, &info);
@@ -225,72 +499,46 @@ static GstFlowReturn audio_new_sample(GstAppSink *appsink, gpointer user_data)
 	GstBuffer *buffer = gst_sample_get_buffer(sample);
 	GstCaps *caps = gst_sample_get_caps(sample);
 	GstMapInfo info;
-	GstAudioInfo audio_info;
 
-	gst_audio_info_from_caps(&audio_info, caps);
+	if (caps != data->audio_caps)
+	{
+		gst_caps_replace(&data->audio_caps, caps);
+		streaminsync_audio_template(caps, &data->audio_info,
+									&data->audio_template);
+	}
+
 	gst_buffer_map(buffer, &info, GST_MAP_READ);
 
-	struct obs_source_audio audio = {};
+	struct obs_source_audio audio = data->audio_template;
 
-	audio.frames = info.size / audio_info.bpf;
-	audio.samples_per_sec = audio_info.rate;
+	audio.frames = info.size / data->audio_info.bpf;
 	audio.data[0] = info.data;
 
-	audio.timestamp =
-		obs_data_get_bool(data->settings, "use_timestamps_audio")
-			? GST_BUFFER_PTS(buffer)
-			: data->audio_count++ * GST_SECOND *
-				  (audio.frames / (double)audio_info.rate);
+	const settings_t *settings = settings_acquire(data);
+	const gboolean scheduled = settings->scheduled_playout;
+	const gboolean stretch = settings->audio_stretch;
+	settings_release(settings);
 
-	switch (audio_info.channels)
+	const guint64 due =
+		scheduled ? streaminsync_playout_time(appsink, sample) : 0;
+
+	// Stretched onto a continuous timeline, or played out at the deadline
+	// as it comes
+	if (due && stretch &&
+		GST_AUDIO_INFO_FORMAT(&data->audio_info) == GST_AUDIO_FORMAT_F32)
 	{
-	case 1:
-		audio.speakers = SPEAKERS_MONO;
-		break;
-	case 2:
-		audio.speakers = SPEAKERS_STEREO;
-		break;
-	case 3:
-		audio.speakers = SPEAKERS_2POINT1;
-		break;
-	case 4:
-		audio.speakers = SPEAKERS_4POINT0;
-		break;
-	case 5:
-		audio.speakers = SPEAKERS_4POINT1;
-		break;
-	case 6:
-		audio.speakers = SPEAKERS_5POINT1;
-		break;
-	case 8:
-		audio.speakers = SPEAKERS_7POINT1;
-		break;
-	default:
-		audio.speakers = SPEAKERS_UNKNOWN;
-		blog(LOG_ERROR, "Unsupported channel count: %d",
-			 audio_info.channels);
-		break;
-	}
+		const gfloat *out;
 
-	switch (audio_info.finfo->format)
+		audio.frames = streaminsync_stretch_process(
+			data->stretch, (const gfloat *)info.data, audio.frames,
+			data->audio_info.rate, data->audio_info.channels, due, &out,
+			&audio.timestamp);
+		audio.data[0] = (const uint8_t *)out;
+	}
+	else
 	{
-	case GST_AUDIO_FORMAT_U8:
-		audio.format = AUDIO_FORMAT_U8BIT;
-		break;
-	case GST_AUDIO_FORMAT_S16LE:
-		audio.format = AUDIO_FORMAT_16BIT;
-		break;
-	case GST_AUDIO_FORMAT_S32LE:
-		audio.format = AUDIO_FORMAT_32BIT;
-		break;
-	case GST_AUDIO_FORMAT_F32LE:
-		audio.format = AUDIO_FORMAT_FLOAT;
-		break;
-	default:
-		audio.format = AUDIO_FORMAT_UNKNOWN;
-		blog(LOG_ERROR, "Unknown audio format: %s",
-			 audio_info.finfo->name);
-		break;
+		audio.timestamp =
+			due ? due : audio_timestamp(data, buffer, audio.frames);
 	}
 
 	obs_source_output_audio(data->source, &audio);
@@ -306,140 +554,217 @@ const char *gstreamer_source_get_name(void *type_data)
 	return "GStreamer Source";
 }
 
-static gboolean loop_startup(gpointer user_data)
+static gboolean loop_teardown(gpointer user_data)
 {
 	data_t *data = user_data;
 
-	create_pipeline(data);
+	// The restart timeout lives on the shared context, it does not go away
+	// with the pipeline on its own.
+	if (data->timeout != NULL)
+		g_source_destroy(data->timeout);
 
-	g_mutex_lock(&data->mutex);
-	g_cond_signal(&data->cond);
-	g_mutex_unlock(&data->mutex);
+	release_rtpbin(data);
 
-	if (data->pipe)
-		gst_element_set_state(data->pipe, GST_STATE_PLAYING);
+	if (data->pipe != NULL)
+	{
+		GstBus *bus = gst_element_get_bus(data->pipe);
+		gst_bus_remove_watch(bus);
+		gst_object_unref(bus);
+
+		// Stopping waits for the streaming threads, not on the dispatcher
+		streaminsync_dispose(data->pipe);
+		data->pipe = NULL;
+	}
+
+	streaminsync_clock_release(data->clock);
+	data->clock = NULL;
 
 	return G_SOURCE_REMOVE;
 }
 
-#define NB_PORTS 6
-
 typedef struct
 {
-	const gchar *clock_ip;
-	const gint clock_port;
+	GstClock *clock;
 	const gint latency;
-	// Used ports, in order:
-	// 0: video
-	// 1: video
-	// 2: video
-	// 3: audio
-	// 4: audio
-	// 5: audio
 	const gint ports[NB_PORTS];
+	const gboolean bundle;
 	const gchar *dest;
+	const streaminsync_sink_t *sink;
 } config_t;
 
-typedef struct
+// Links every rtpbin pad to the branch of its session, video through the
+// layer selector. A sender only has one SSRC per session and layer, a new one
+// means it restarted: the branch moves over to it and the old pad is left to
+// a fakesink until rtpbin times it out.
+static void cb_new_pad(GstElement *element, GstPad *pad, gpointer data)
 {
-	GstElement *pipe;
-	GstElement *vsink;
-	GstElement *asink;
-} pipeline_t;
+	guint session, pt;
+	guint32 ssrc;
 
-static void cb_new_pad(GstElement *element, GstPad *pad, gpointer data)
+	if (!streaminsync_parse_pad_name(GST_PAD_NAME(pad), &session, &ssrc,
+									 &pt))
+		return;
+
+	GstElement *pipe = GST_ELEMENT(gst_element_get_parent(element));
+	GstPad *sink = NULL;
+
+	if (session == STREAMINSYNC_SESSION_VIDEO)
+	{
+		GstElement *layers = gst_bin_get_by_name(GST_BIN(pipe), LAYERS_NAME);
+
+		sink = layers ? streaminsync_layers_sink(layers, pt) : NULL;
+		if (layers)
+			gst_object_unref(layers);
+	}
+	else if (session < 2)
+	{
+		// Looked up by name, branches get replaced on live changes
+		GstElement *branch =
+			gst_bin_get_by_name(GST_BIN(pipe), branch_names[session]);
+
+		sink = branch ? gst_element_get_static_pad(branch, "sink") : NULL;
+		if (branch)
+			gst_object_unref(branch);
+	}
+
+	if (sink)
+	{
+		GstPad *old = gst_pad_get_peer(sink);
+		if (old)
+		{
+			gst_pad_unlink(old, sink);
+			streaminsync_discard_pad(GST_BIN(pipe), old);
+			gst_object_unref(old);
+		}
+
+		gst_pad_link(pad, sink);
+		gst_object_unref(sink);
+	}
+	else
+	{
+		streaminsync_discard_pad(GST_BIN(pipe), pad);
+	}
+
+	gst_object_unref(pipe);
+}
+
+// One socket for everything, see streaminsync_bundle_new(). Same element
+// names as the pipeline below.
+static GstElement *create_bundle_pipeline(config_t *config)
 {
-	gchar *name;
-	GstPad *sink = data;
+	GstElement *pipe = gst_pipeline_new("pipe");
+
+	gst_pipeline_use_clock(GST_PIPELINE(pipe), config->clock);
+
+	GstElement *rtpbin = streaminsync_rtpbin_new(config->latency);
+	GstElement *layers = streaminsync_layers_new();
+	GstElement *vbranch =
+		streaminsync_branch_new(STREAMINSYNC_SESSION_VIDEO, config->sink);
+	GstElement *abranch =
+		streaminsync_branch_new(STREAMINSYNC_SESSION_AUDIO, config->sink);
+
+	if (!pipe || !rtpbin || !layers || !vbranch || !abranch)
+	{
+		GST_WARNING("Not all elements could be created.\n");
+		return NULL;
+	}
+
+	gst_element_set_name(rtpbin, "rtpbin");
+	gst_element_set_name(layers, LAYERS_NAME);
+	gst_element_set_name(vbranch, branch_names[STREAMINSYNC_SESSION_VIDEO]);
+	gst_element_set_name(abranch, branch_names[STREAMINSYNC_SESSION_AUDIO]);
+
+	gst_bin_add_many(GST_BIN(pipe), rtpbin, layers, vbranch, abranch, NULL);
+	gst_element_link(layers, vbranch);
+
+	GstElement *udpsrc = streaminsync_bundle_new(GST_BIN(pipe), rtpbin,
+												 config->ports[0], "video_rtp");
+	if (!udpsrc)
+	{
+		gst_object_unref(pipe);
+		return NULL;
+	}
+
+	g_object_set(udpsrc, "timeout",
+				 (guint64)STREAMINSYNC_SILENCE_TIMEOUT * GST_MSECOND, NULL);
 
-	name = gst_pad_get_name(pad);
-	g_print("A new pad %s was created for %s\n", name, gst_element_get_name(element));
-	g_free(name);
+	g_signal_connect(rtpbin, "pad-added", G_CALLBACK(cb_new_pad), NULL);
 
-	g_print("element %s will be linked to %s\n",
-			gst_element_get_name(element),
-			gst_element_get_name(sink));
-	gst_pad_link(pad, sink);
-	// gst_element_link(element, sink);
+	return pipe;
 }
 
-static pipeline_t *create_streaminsync_pipeline(config_t *config)
+static GstElement *create_streaminsync_pipeline(config_t *config)
 {
 	if (!config)
 		return NULL;
-	if (!config->clock_ip || !config->ports)
+	if (!config->clock)
 		return NULL;
+	if (config->bundle)
+		return create_bundle_pipeline(config);
 
 	GstElement *pipe = gst_pipeline_new("pipe");
 
-	GstClock *clock = gst_ntp_clock_new("main_ntp_clock", config->clock_ip, config->clock_port, 0);
-	gst_pipeline_use_clock(GST_PIPELINE(pipe), clock);
+	gst_pipeline_use_clock(GST_PIPELINE(pipe), config->clock);
 
-	GstElement *rtpbin = gst_element_factory_make("rtpbin", NULL);
-	g_object_set(rtpbin, "latency", config->latency, NULL);
-	// g_object_set(rtpbin, "ntp-time-source", "clock-time", NULL);
-	g_object_set(rtpbin, "ntp-time-source", 3, NULL);
-	g_object_set(rtpbin, "ntp-sync", TRUE, NULL);
-	g_object_set(rtpbin, "buffer-mode", 4, NULL); // synced
+	GstElement *rtpbin = streaminsync_rtpbin_new(config->latency);
+	if (rtpbin)
+		gst_element_set_name(rtpbin, "rtpbin");
 
 	// Video
-	GstElement *vudpsrc = gst_element_factory_make("udpsrc", NULL);
-	GstCaps *vcaps = gst_caps_new_simple("application/x-rtp",
-										 "media", G_TYPE_STRING, "video",
-										 "clock-rate", G_TYPE_INT, 90000,
-										 "encoding-name", G_TYPE_STRING, "H264",
-										 "payload", G_TYPE_INT, 96,
-										 NULL);
+	GstElement *vudpsrc = gst_element_factory_make("udpsrc", "video_rtp");
+	GstCaps *vcaps = streaminsync_rtp_caps(STREAMINSYNC_SESSION_VIDEO);
 
 	g_object_set(vudpsrc, "caps", vcaps, NULL);
 	g_object_set(vudpsrc, "port", config->ports[0], NULL);
+	g_object_set(vudpsrc, "timeout",
+				 (guint64)STREAMINSYNC_SILENCE_TIMEOUT * GST_MSECOND, NULL);
 
-	GstElement *vdepay = gst_element_factory_make("rtph264depay", NULL);
-	GstElement *vparse = gst_element_factory_make("h264parse", NULL);
-	GstElement *vdec = gst_element_factory_make("avdec_h264", NULL);
-	GstElement *vconv = gst_element_factory_make("videoconvert", NULL);
-	GstElement *vsink = gst_element_factory_make("appsink", NULL);
-	// GstElement *vsink = gst_element_factory_make("autovideosink", NULL);
+	GstElement *layers = streaminsync_layers_new();
+	if (layers)
+		gst_element_set_name(layers, LAYERS_NAME);
+
+	GstElement *vbranch =
+		streaminsync_branch_new(STREAMINSYNC_SESSION_VIDEO, config->sink);
+	if (vbranch)
+		gst_element_set_name(vbranch,
+							 branch_names[STREAMINSYNC_SESSION_VIDEO]);
 
 	GstElement *vudpsrc_1 = gst_element_factory_make("udpsrc", NULL);
 	g_object_set(vudpsrc_1, "port", config->ports[1], NULL);
 
 	GstElement *vudpsink = gst_element_factory_make("udpsink", NULL);
-	g_object_set(vudpsrc_1, "port", config->ports[2], NULL);
+	g_object_set(vudpsink, "port", config->ports[2], NULL);
 	g_object_set(vudpsink, "host", config->dest, NULL);
 	g_object_set(vudpsink, "sync", FALSE, NULL);
 	g_object_set(vudpsink, "async", FALSE, NULL);
 
 	// Audio
 	GstElement *audpsrc = gst_element_factory_make("udpsrc", NULL);
-	GstCaps *acaps = gst_caps_new_simple("application/x-rtp",
-										 "media", G_TYPE_STRING, "audio",
-										 "clock-rate", G_TYPE_INT, 48000,
-										 "encoding-name", G_TYPE_STRING, "OPUS",
-										 "payload", G_TYPE_INT, 96,
-										 NULL);
+	GstCaps *acaps = streaminsync_rtp_caps(STREAMINSYNC_SESSION_AUDIO);
 
 	g_object_set(audpsrc, "caps", acaps, NULL);
 	g_object_set(audpsrc, "port", config->ports[3], NULL);
 
-	GstElement *adepay = gst_element_factory_make("rtpopusdepay", NULL);
-	GstElement *adec = gst_element_factory_make("opusdec", NULL);
-	GstElement *aconv = gst_element_factory_make("audioconvert", NULL);
-	GstElement *aresample = gst_element_factory_make("audioresample", NULL);
-	GstElement *asink = gst_element_factory_make("appsink", NULL);
+	GstElement *abranch =
+		streaminsync_branch_new(STREAMINSYNC_SESSION_AUDIO, config->sink);
+	if (abranch)
+		gst_element_set_name(abranch,
+							 branch_names[STREAMINSYNC_SESSION_AUDIO]);
 
 	GstElement *audpsrc_1 = gst_element_factory_make("udpsrc", NULL);
 	g_object_set(audpsrc_1, "port", config->ports[4], NULL);
 
 	GstElement *audpsink = gst_element_factory_make("udpsink", NULL);
-	g_object_set(audpsrc_1, "port", config->ports[5], NULL);
+	g_object_set(audpsink, "port", config->ports[5], NULL);
 	g_object_set(audpsink, "host", config->dest, NULL);
 	g_object_set(audpsink, "sync", FALSE, NULL);
 	g_object_set(audpsink, "async", FALSE, NULL);
 
-	if (!pipe || !rtpbin || !vudpsrc || !vdepay || !vparse || !vdec || !vconv || !vsink ||
-		!vudpsrc_1 || !vudpsink || !audpsrc || !adepay || !adec || !aconv || !aresample || !asink ||
-		!audpsrc_1 || !audpsink)
+	gst_caps_unref(vcaps);
+	gst_caps_unref(acaps);
+
+	if (!pipe || !rtpbin || !vudpsrc || !layers || !vbranch || !vudpsrc_1 ||
+		!vudpsink || !audpsrc || !abranch || !audpsrc_1 || !audpsink)
 	{
 		GST_WARNING("Not all elements could be created.\n");
 		return NULL;
@@ -449,30 +774,18 @@ static pipeline_t *create_streaminsync_pipeline(config_t *config)
 					 rtpbin,
 					 // video
 					 vudpsrc,
-					 vdepay,
-					 vparse,
-					 vdec,
-					 vconv,
 					 vudpsrc_1,
 					 vudpsink,
-					 vsink,
+					 layers,
+					 vbranch,
 					 // audio
 					 audpsrc,
-					 adepay,
-					 adec,
-					 aconv,
-					 aresample,
 					 audpsrc_1,
 					 audpsink,
-					 asink,
+					 abranch,
 					 NULL);
-	if (!gst_element_link_many(vdepay, vparse, vdec, vconv, vsink, NULL) //
-		|| !gst_element_link_many(adepay, adec, aconv, aresample, asink, NULL))
-	{
-		GST_WARNING("can't link elements");
-		return NULL;
-	}
-	// linking
+
+	gst_element_link(layers, vbranch);
 
 	// RTP bin pads
 	gst_element_link_pads(vudpsrc, "src", rtpbin, "recv_rtp_sink_0");
@@ -482,36 +795,61 @@ static pipeline_t *create_streaminsync_pipeline(config_t *config)
 	gst_element_link_pads(audpsrc_1, "src", rtpbin, "recv_rtcp_sink_1");
 	gst_element_link_pads(rtpbin, "send_rtcp_src_1", audpsink, "sink");
 
-	GstPad *vdepay_pad = gst_element_get_static_pad(vdepay, "sink");
-	GstPad *adepay_pad = gst_element_get_static_pad(adepay, "sink");
-	g_signal_connect(rtpbin, "pad-added", G_CALLBACK(cb_new_pad), vdepay_pad);
-	g_signal_connect(rtpbin, "pad-added", G_CALLBACK(cb_new_pad), adepay_pad);
-	// gst_object_unref(vdepay_pad);
-	// gst_object_unref(adepay_pad);
+	g_signal_connect(rtpbin, "pad-added", G_CALLBACK(cb_new_pad), NULL);
+
+	return pipe;
+}
+
+// What the appsinks of this source hand their samples to.
+static streaminsync_sink_t make_sink(data_t *data,
+									 const settings_t *settings)
+{
+	streaminsync_sink_t sink = {
+		.decoder = settings->decoder,
+		.decoder_threads = settings->decoder_threads,
+		.decoder_thread_type = settings->decoder_thread_type,
+		.active_sources = g_atomic_int_get(&active_sources),
+		.pipelined = settings->pipelined_decode,
+		.block_video = settings->block_video,
+		.block_audio = settings->block_audio,
+		.request_keyframes = settings->request_keyframes,
+		.standby = g_atomic_int_get(&data->standby),
+		.video_cbs = {NULL, NULL, video_new_sample},
+		.audio_cbs = {NULL, NULL, audio_new_sample},
+		.user_data = data,
+	};
+
+	return sink;
+}
 
-	// create the pipeline_t struct
-	pipeline_t *pipeline = malloc(sizeof(pipeline_t));
-	pipeline->pipe = pipe;
-	pipeline->vsink = vsink;
-	pipeline->asink = asink;
+static void reset_counters(data_t *data)
+{
+	data->frame_count = 0;
+	data->audio_frames = 0;
+	streaminsync_stretch_reset(data->stretch);
 
-	return pipeline;
+	gst_caps_replace(&data->video_caps, NULL);
+	gst_caps_replace(&data->audio_caps, NULL);
 }
 
 static void create_pipeline(data_t *data)
 {
-	GError *err = NULL;
+	const settings_t *settings = data->applied;
 
-	int port;
-	const char *ip;
-	ip = obs_data_get_string(data->settings, "client_ip");
-	port = obs_data_get_int(data->settings, "port");
+	const gint port = settings->port;
+	const gchar *ip = settings->sender_ip;
+	const streaminsync_sink_t sink = make_sink(data, settings);
+
+	// Kept across restarts of the pipeline, released on teardown
+	if (data->clock == NULL)
+		data->clock = streaminsync_clock_acquire(&settings->clock);
 
 	config_t config = {
-		.clock_ip = "45.159.204.28",
-		.clock_port = 123,
-		.latency = 500,
+		.clock = data->clock,
+		.latency = streaminsync_latency_initial(&settings->latency),
+		.bundle = settings->bundle,
 		.dest = ip,
+		.sink = &sink,
 		.ports = {
 			port,
 			port + 1,
@@ -520,116 +858,390 @@ static void create_pipeline(data_t *data)
 			port + 4,
 			port + 5}};
 
-	pipeline_t *pipeline = create_streaminsync_pipeline(&config);
-	if (!pipeline)
+	data->pipe = create_streaminsync_pipeline(&config);
+	if (!data->pipe)
 	{
-		blog(LOG_ERROR, "Pipelining failed (it is null)");
-		g_error_free(err);
+		blog(LOG_ERROR, "Cannot create the stream-in-sync pipeline");
+
+		obs_source_output_video(data->source, NULL);
 
 		return;
 	}
 
-	data->pipe = pipeline->pipe;
+	reset_counters(data);
+
+	data->rtpbin = gst_bin_get_by_name(GST_BIN(data->pipe), "rtpbin");
+	streaminsync_latency_add(data->rtpbin, &settings->latency);
+
+	GstElement *rtpsrc = gst_bin_get_by_name(GST_BIN(data->pipe), "video_rtp");
+	GstPad *pad = gst_element_get_static_pad(rtpsrc, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, rtp_probe, data, NULL);
+	gst_object_unref(pad);
+	gst_object_unref(rtpsrc);
+
+	g_atomic_int_set(&data->silent, FALSE);
+	mark_restart(data);
+
+	GstBus *bus = gst_element_get_bus(data->pipe);
+	gst_bus_add_watch(bus, bus_callback, data);
+	gst_object_unref(bus);
+}
+
+// Runs on the dispatcher thread, like everything touching the pipeline.
+static gboolean poll_stats(gpointer user_data)
+{
+	data_t *data = user_data;
+	streaminsync_stats_t stats = {0};
+
+	if (data->stream)
+	{
+		streaminsync_receiver_stats(data->stream, &stats);
+	}
+	else if (data->pipe && data->rtpbin)
+	{
+		GstElement *video = gst_bin_get_by_name(
+			GST_BIN(data->pipe), branch_names[STREAMINSYNC_SESSION_VIDEO]);
+		GstElement *audio = gst_bin_get_by_name(
+			GST_BIN(data->pipe), branch_names[STREAMINSYNC_SESSION_AUDIO]);
+
+		streaminsync_stats_rtp(data->rtpbin, G_MAXUINT, 0, &stats);
+		streaminsync_stats_branches(video, audio, &stats);
+
+		if (video)
+			gst_object_unref(video);
+		if (audio)
+			gst_object_unref(audio);
+	}
+
+	stats.ttff = g_atomic_int_get(&data->ttff);
+	stats.stretched = streaminsync_stretch_count(data->stretch);
+
+	g_mutex_lock(&data->stats_mutex);
+	data->stats = stats;
+	g_mutex_unlock(&data->stats_mutex);
+
+	gchar *line = streaminsync_stats_format(&stats);
+	blog(LOG_INFO, "[streaminsync-stats] source=\"%s\" port=%d %s",
+		 obs_source_get_name(data->source), data->applied->port, line);
+	g_free(line);
 
-	if (err != NULL)
+	return G_SOURCE_CONTINUE;
+}
+
+typedef struct
+{
+	obs_source_t *source;
+	gdouble height;
+} render_height_t;
+
+static bool add_item_height(obs_scene_t *scene, obs_sceneitem_t *item,
+							void *param)
+{
+	render_height_t *render = param;
+	struct vec2 size;
+
+	if (obs_sceneitem_get_source(item) != render->source ||
+		!obs_sceneitem_visible(item))
+		return true;
+
+	if (obs_sceneitem_get_bounds_type(item) != OBS_BOUNDS_NONE)
 	{
-		blog(LOG_ERROR, "Cannot start GStreamer: %s", err->message);
-		g_error_free(err);
+		obs_sceneitem_get_bounds(item, &size);
+	}
+	else
+	{
+		obs_sceneitem_get_scale(item, &size);
+		size.y *= obs_source_get_height(render->source);
+	}
 
-		obs_source_output_video(data->source, NULL);
+	render->height = MAX(render->height, ABS(size.y));
+
+	return true;
+}
+
+static bool add_scene_height(void *param, obs_source_t *source)
+{
+	obs_scene_t *scene = obs_scene_from_source(source);
+
+	if (scene)
+		obs_scene_enum_items(scene, add_item_height, param);
+
+	return true;
+}
+
+// Tallest the source is drawn in any scene, in output pixels, 0 if it is in
+// none. Groups and nested scenes are not looked into.
+static gint render_height(obs_source_t *source)
+{
+	render_height_t render = {source, 0.0};
+	struct obs_video_info ovi;
+
+	obs_enum_scenes(add_scene_height, &render);
+
+	if (obs_get_video_info(&ovi) && ovi.base_height > 0)
+		render.height = render.height * ovi.output_height / ovi.base_height;
+
+	return (gint)render.height;
+}
+
+// Walking the scenes is only safe with them held still, so the height is
+// taken from the video tick, on the graphics thread, as often as the layers
+// are picked.
+void gstreamer_source_video_tick(void *user_data, float seconds)
+{
+	data_t *data = user_data;
 
+	data->since_render_height += seconds;
+	if (data->since_render_height * 1000 < LAYERS_INTERVAL_MS)
 		return;
-	}
 
-	GstAppSinkCallbacks video_cbs = {NULL, NULL, video_new_sample};
+	data->since_render_height = 0;
+	g_atomic_int_set(&data->render_height, render_height(data->source));
+}
 
-	gst_app_sink_set_callbacks(GST_APP_SINK(pipeline->vsink), &video_cbs, data,
-							   NULL);
+// Only single pipelines have layers, a shared receiver hands over the full
+// size of each stream.
+static gboolean poll_layers(gpointer user_data)
+{
+	data_t *data = user_data;
+	GstElement *layers =
+		data->pipe ? gst_bin_get_by_name(GST_BIN(data->pipe), LAYERS_NAME)
+				   : NULL;
 
-	if (obs_data_get_bool(data->settings, "block_video"))
-		g_object_set(pipeline->vsink, "max-buffers", 1, NULL);
+	if (layers == NULL)
+		return G_SOURCE_CONTINUE;
 
-	// check if connected and remove if not
-	GstPad *pad = gst_element_get_static_pad(pipeline->vsink, "sink");
-	if (!gst_pad_is_linked(pad))
-		gst_bin_remove(GST_BIN(data->pipe), pipeline->vsink);
-	gst_object_unref(pad);
-	// gst_object_unref(pipeline->vsink);
+	streaminsync_layers_update(layers, data->rtpbin,
+							   data->applied->simulcast_layer,
+							   g_atomic_int_get(&data->render_height),
+							   g_atomic_int_get(&data->last_height));
+	gst_object_unref(layers);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void start_stats(data_t *data)
+{
+	data->stats_timer = g_timeout_source_new(STATS_INTERVAL_MS);
+	g_source_set_callback(data->stats_timer, poll_stats, data, NULL);
+	g_source_attach(data->stats_timer, gstreamer_dispatcher_get_context());
 
-	// gst_object_unref(appsink);
+	data->layers_timer = g_timeout_source_new(LAYERS_INTERVAL_MS);
+	g_source_set_callback(data->layers_timer, poll_layers, data, NULL);
+	g_source_attach(data->layers_timer, gstreamer_dispatcher_get_context());
+}
 
-	GstAppSinkCallbacks audio_cbs = {NULL, NULL, audio_new_sample};
+static gboolean stop_stats(gpointer user_data)
+{
+	data_t *data = user_data;
 
-	gst_app_sink_set_callbacks(GST_APP_SINK(pipeline->asink), &audio_cbs, data,
-							   NULL);
+	g_source_destroy(data->stats_timer);
+	g_source_unref(data->stats_timer);
+	data->stats_timer = NULL;
 
-	if (obs_data_get_bool(data->settings, "block_audio"))
-		g_object_set(pipeline->asink, "max-buffers", 1, NULL);
+	g_source_destroy(data->layers_timer);
+	g_source_unref(data->layers_timer);
+	data->layers_timer = NULL;
 
-	// check if connected and remove if not
-	// sink = gst_bin_get_by_name(GST_BIN(data->pipe), "audio");
-	pad = gst_element_get_static_pad(pipeline->asink, "sink");
-	if (!gst_pad_is_linked(pad))
-		gst_bin_remove(GST_BIN(data->pipe), pipeline->asink);
-	gst_object_unref(pad);
-	// gst_object_unref(sink);
+	return G_SOURCE_REMOVE;
+}
 
-	// gst_object_unref(pipeline->asink);
+// Tears down what runs, TRUE if there was anything.
+static gboolean teardown(data_t *data)
+{
+	// Gone before the pipeline so that no poll can run into a half torn
+	// down source.
+	if (data->stats_timer)
+		stop_stats(data);
 
-	data->frame_count = 0;
-	data->audio_count = 0;
+	if (data->stream)
+	{
+		streaminsync_receiver_detach(data->stream);
+		data->stream = NULL;
+	}
+	else if (data->running)
+	{
+		loop_teardown(data);
+		data->running = FALSE;
+	}
+	else
+	{
+		return FALSE;
+	}
 
-	GstBus *bus = gst_element_get_bus(data->pipe);
-	gst_bus_add_watch(bus, bus_callback, data);
-	gst_object_unref(bus);
+	g_atomic_int_add(&active_sources, -1);
+
+	if (data->applied)
+		settings_release(data->applied);
+	data->applied = NULL;
+
+	return TRUE;
+}
+
+// A start only settles the state when nothing else has been asked for since.
+static void set_started(data_t *data, gboolean started)
+{
+	g_atomic_int_compare_and_exchange(&data->state, STATE_STARTING,
+									  started ? STATE_RUNNING : STATE_FAILED);
+}
+
+static gboolean loop_start(gpointer user_data);
+
+static gboolean loop_start_deferred(gpointer user_data)
+{
+	data_t *data = user_data;
 
-	free(pipeline);
+	if (g_atomic_int_get(&data->state) != STATE_STOPPED)
+		loop_start(data);
+
+	return G_SOURCE_REMOVE;
 }
 
-static gpointer _start(gpointer user_data)
+static gboolean loop_start(gpointer user_data)
 {
 	data_t *data = user_data;
 
-	GMainContext *context = g_main_context_new();
+	// What is left of a failed start or of the previous settings. Its
+	// sockets close on the worker thread, the new pipeline binds them once
+	// that is done.
+	if (teardown(data))
+	{
+		gstreamer_worker_then(loop_start_deferred, data);
+		return G_SOURCE_REMOVE;
+	}
 
-	g_main_context_push_thread_default(context);
+	const settings_t *settings = settings_acquire(data);
 
-	data->loop = g_main_loop_new(context, FALSE);
+	if (settings->shared_receiver &&
+		streaminsync_receiver_closing(settings->port))
+	{
+		settings_release(settings);
+		gstreamer_worker_then(loop_start_deferred, data);
+		return G_SOURCE_REMOVE;
+	}
 
-	GSource *source = g_idle_source_new();
-	g_source_set_callback(source, loop_startup, data, NULL);
-	g_source_attach(source, context);
+	g_atomic_int_inc(&active_sources);
+	data->applied = settings;
 
-	g_main_loop_run(data->loop);
+	if (settings->shared_receiver)
+	{
+		reset_counters(data);
 
-	if (data->pipe != NULL)
+		const streaminsync_sink_t sink = make_sink(data, settings);
+		data->stream = streaminsync_receiver_attach(
+			settings->port, settings->bundle, settings->stream_id,
+			settings->sender_ip, &sink, &settings->latency,
+			&settings->clock);
+
+		if (data->stream == NULL)
+		{
+			g_atomic_int_add(&active_sources, -1);
+			settings_release(data->applied);
+			data->applied = NULL;
+			set_started(data, FALSE);
+			return G_SOURCE_REMOVE;
+		}
+
+		mark_restart(data);
+	}
+	else
 	{
-		gst_element_set_state(data->pipe, GST_STATE_NULL);
+		create_pipeline(data);
 
-		GstBus *bus = gst_element_get_bus(data->pipe);
-		gst_bus_remove_watch(bus);
-		gst_object_unref(bus);
+		if (data->pipe)
+			gst_element_set_state(data->pipe, GST_STATE_PLAYING);
 
-		gst_object_unref(data->pipe);
-		data->pipe = NULL;
+		data->running = TRUE;
+	}
+
+	start_stats(data);
+	set_started(data, data->stream != NULL || data->pipe != NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean loop_stop(gpointer user_data)
+{
+	data_t *data = user_data;
+
+	if (teardown(data))
+		obs_source_output_video(data->source, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Shown from when a start is asked for until the first frame, at the size
+// of the last video so that the scene does not jump around.
+static void output_placeholder(data_t *data)
+{
+	const gint width = g_atomic_int_get(&data->last_width);
+	const gint height = g_atomic_int_get(&data->last_height);
+	struct obs_source_frame frame;
+
+	streaminsync_placeholder_frame(width > 0 ? width : PLACEHOLDER_WIDTH,
+								   height > 0 ? height : PLACEHOLDER_HEIGHT,
+								   &frame);
+	obs_source_output_video(data->source, &frame);
+	g_free(frame.data[0]);
+}
+
+static void request_start(data_t *data)
+{
+	g_atomic_int_set(&data->state, STATE_STARTING);
+	output_placeholder(data);
+	gstreamer_dispatcher_invoke(loop_start, data);
+}
+
+static void request_stop(data_t *data)
+{
+	g_atomic_int_set(&data->state, STATE_STOPPED);
+	gstreamer_dispatcher_invoke(loop_stop, data);
+}
+
+static gboolean apply_standby(gpointer user_data)
+{
+	data_t *data = user_data;
+	const gboolean standby = g_atomic_int_get(&data->standby);
+
+	if (data->stream)
+	{
+		streaminsync_receiver_set_standby(data->stream, standby);
+		return G_SOURCE_REMOVE;
 	}
 
-	g_main_loop_unref(data->loop);
-	data->loop = NULL;
+	if (data->pipe == NULL)
+		return G_SOURCE_REMOVE;
+
+	GstElement *branch = gst_bin_get_by_name(
+		GST_BIN(data->pipe), branch_names[STREAMINSYNC_SESSION_VIDEO]);
+	if (branch == NULL)
+		return G_SOURCE_REMOVE;
+
+	streaminsync_branch_set_standby(branch, standby);
+	gst_object_unref(branch);
+
+	return G_SOURCE_REMOVE;
+}
 
-	g_main_context_unref(context);
+static void set_standby(data_t *data, gboolean standby)
+{
+	if (g_atomic_int_get(&data->standby) == standby)
+		return;
 
-	return NULL;
+	g_atomic_int_set(&data->standby, standby);
+	gstreamer_dispatcher_invoke(apply_standby, data);
 }
 
-static void start(data_t *data)
+static gboolean wants_standby(data_t *data)
 {
-	g_mutex_lock(&data->mutex);
+	const settings_t *settings = settings_acquire(data);
+	const gboolean standby = settings->standby_on_hide &&
+							 !settings->stop_on_hide &&
+							 !obs_source_showing(data->source);
 
-	data->thread = g_thread_new("GStreamer Source", _start, data);
+	settings_release(settings);
 
-	g_cond_wait(&data->cond, &data->mutex);
-	g_mutex_unlock(&data->mutex);
+	return standby;
 }
 
 void *gstreamer_source_create(obs_data_t *settings, obs_source_t *source)
@@ -638,37 +1250,49 @@ void *gstreamer_source_create(obs_data_t *settings, obs_source_t *source)
 
 	data->source = source;
 	data->settings = settings;
+	data->stretch = streaminsync_stretch_new();
+	// Taken on the first tick already
+	data->since_render_height = LAYERS_INTERVAL_MS / 1000.0f;
 
-	g_mutex_init(&data->mutex);
-	g_cond_init(&data->cond);
+	// Stats text that earlier versions saved with the scene
+	obs_data_erase(settings, "stats");
 
-	if (obs_data_get_bool(settings, "stop_on_hide") == false)
-		start(data);
+	g_mutex_init(&data->snapshot_mutex);
+	g_mutex_init(&data->stats_mutex);
 
-	return data;
-}
+	publish_settings(data, settings);
+	const settings_t *now = settings_acquire(data);
 
-static void stop(data_t *data)
-{
-	if (data->thread == NULL)
-		return;
+	obs_source_set_async_unbuffered(source, now->scheduled_playout);
+	data->standby = wants_standby(data);
 
-	g_main_loop_quit(data->loop);
+	if (now->stop_on_hide == false)
+		request_start(data);
 
-	g_thread_join(data->thread);
-	data->thread = NULL;
+	settings_release(now);
 
-	obs_source_output_video(data->source, NULL);
+	return data;
 }
 
 void gstreamer_source_destroy(void *user_data)
 {
 	data_t *data = user_data;
 
-	stop(data);
+	// Behind whatever is still queued for this source, then behind the
+	// starts deferred until the worker is done with the old pipeline.
+	g_atomic_int_set(&data->state, STATE_STOPPED);
+	gstreamer_dispatcher_invoke_sync(loop_stop, data);
+	gstreamer_worker_drain();
+	gstreamer_dispatcher_invoke_sync(loop_stop, data);
+
+	settings_release(data->snapshot);
 
-	g_mutex_clear(&data->mutex);
-	g_cond_clear(&data->cond);
+	gst_caps_replace(&data->video_caps, NULL);
+	gst_caps_replace(&data->audio_caps, NULL);
+	streaminsync_stretch_free(data->stretch);
+
+	g_mutex_clear(&data->stats_mutex);
+	g_mutex_clear(&data->snapshot_mutex);
 
 	g_free(data);
 }
@@ -682,9 +1306,36 @@ void gstreamer_source_get_defaults(obs_data_t *settings)
 	obs_data_set_default_bool(settings, "restart_on_error", false);
 	obs_data_set_default_int(settings, "restart_timeout", 2000);
 	obs_data_set_default_bool(settings, "stop_on_hide", true);
+	obs_data_set_default_bool(settings, "standby_on_hide", true);
 	obs_data_set_default_bool(settings, "block_video", false);
 	obs_data_set_default_bool(settings, "block_audio", false);
 	obs_data_set_default_bool(settings, "clear_on_end", true);
+	obs_data_set_default_string(settings, "decoder", "avdec_h264");
+	obs_data_set_default_int(settings, "decoder_threads", 0);
+	obs_data_set_default_int(settings, "decoder_thread_type", 0);
+	obs_data_set_default_bool(settings, "pipelined_decode", false);
+	obs_data_set_default_int(settings, "simulcast_layer", -1);
+	obs_data_set_default_bool(settings, "request_keyframes", true);
+	obs_data_set_default_bool(settings, "shared_receiver", false);
+	obs_data_set_default_int(settings, "stream_id", 0);
+	obs_data_set_default_bool(settings, "bundle", false);
+	obs_data_set_default_bool(settings, "latency_adaptive", true);
+	obs_data_set_default_bool(settings, "scheduled_playout", true);
+	obs_data_set_default_bool(settings, "audio_stretch", true);
+	obs_data_set_default_int(settings, "latency", STREAMINSYNC_LATENCY);
+	obs_data_set_default_int(settings, "latency_min",
+							 STREAMINSYNC_LATENCY_MIN);
+	obs_data_set_default_int(settings, "latency_max",
+							 STREAMINSYNC_LATENCY_MAX);
+	obs_data_set_default_int(settings, "clock_source",
+							 STREAMINSYNC_CLOCK_NTP);
+	obs_data_set_default_string(settings, "ntp_server",
+								STREAMINSYNC_NTP_SERVER);
+	obs_data_set_default_int(settings, "ntp_port", STREAMINSYNC_NTP_PORT);
+	obs_data_set_default_int(settings, "clock_port",
+							 STREAMINSYNC_CLOCK_PORT);
+	obs_data_set_default_int(settings, "clock_threshold",
+							 STREAMINSYNC_CLOCK_THRESHOLD);
 }
 
 void gstreamer_source_update(void *data, obs_data_t *settings);
@@ -697,6 +1348,27 @@ static bool on_apply_clicked(obs_properties_t *props, obs_property_t *property,
 	return false;
 }
 
+// The last stats gathered, one key=value per line, shown by the "stats"
+// info property. Not kept in the settings, which OBS saves.
+static void update_stats_text(data_t *data, obs_property_t *property)
+{
+	g_mutex_lock(&data->stats_mutex);
+	gchar *text = streaminsync_stats_format(&data->stats);
+	g_mutex_unlock(&data->stats_mutex);
+
+	g_strdelimit(text, " ", '\n');
+	obs_property_set_description(property, text);
+	g_free(text);
+}
+
+static bool on_refresh_stats_clicked(obs_properties_t *props,
+									 obs_property_t *property, void *data)
+{
+	update_stats_text(data, obs_properties_get(props, "stats"));
+
+	return true;
+}
+
 obs_properties_t *gstreamer_source_get_properties(void *data)
 {
 	obs_properties_t *props = obs_properties_create();
@@ -707,6 +1379,67 @@ obs_properties_t *gstreamer_source_get_properties(void *data)
 							OBS_TEXT_DEFAULT);
 	obs_properties_add_int(props, "port", "The first port to use",
 						   1000, 65535, 1);
+	obs_property_t *shared = obs_properties_add_bool(
+		props, "shared_receiver", "Share the receiver with other sources");
+	obs_property_set_long_description(
+		shared,
+		"All sources using the same first port share one receiving pipeline. "
+		"Senders then all send to that port and are told apart by their SSRC.");
+	obs_properties_add_int(props, "stream_id", "Stream id (sender SSRC)", 0,
+						   G_MAXUINT32, 1);
+	obs_property_t *bundle = obs_properties_add_bool(
+		props, "bundle", "Bundle audio, video and RTCP on one port");
+	obs_property_set_long_description(
+		bundle,
+		"Uses the first port only, the sender has to be started with "
+		"--bundle as well.");
+
+	obs_property_t *adaptive = obs_properties_add_bool(
+		props, "latency_adaptive", "Adapt the latency to the network");
+	obs_property_set_long_description(
+		adaptive,
+		"The latency follows the jitter of all senders between the minimum "
+		"and the maximum, and is the same for all of them to keep them in "
+		"sync.");
+	obs_properties_add_int(props, "latency", "Latency (ms)", 0, 10000, 10);
+	obs_properties_add_int(props, "latency_min", "Minimum latency (ms)", 0,
+						   10000, 10);
+	obs_properties_add_int(props, "latency_max", "Maximum latency (ms)", 0,
+						   10000, 10);
+	obs_property_t *playout = obs_properties_add_bool(
+		props, "scheduled_playout", "Play out at the common deadline");
+	obs_property_set_long_description(
+		playout,
+		"Video and audio of all sources on the same clock are handed to OBS "
+		"when due, and OBS shows them without buffering of its own.");
+	obs_property_t *stretch = obs_properties_add_bool(
+		props, "audio_stretch", "Stretch audio to follow the deadline");
+	obs_property_set_long_description(
+		stretch,
+		"Needs scheduled playout. Audio stays continuous when the latency "
+		"changes, by dropping or repeating single pitch periods, instead of "
+		"clicking.");
+
+	obs_property_t *clock = obs_properties_add_list(
+		props, "clock_source", "Clock", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(clock, "NTP server", STREAMINSYNC_CLOCK_NTP);
+	obs_property_list_add_int(clock, "Provide the clock to the senders",
+							  STREAMINSYNC_CLOCK_HOST);
+	obs_property_list_add_int(clock, "PTP", STREAMINSYNC_CLOCK_PTP);
+	obs_property_set_long_description(
+		clock,
+		"With the clock provided, senders are started with --clock net "
+		"and this machine's address and clock port. The clock is shared "
+		"by all sources using the same one.");
+	obs_properties_add_text(props, "ntp_server", "NTP server",
+							OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, "ntp_port", "NTP port", 1, 65535, 1);
+	obs_properties_add_int(props, "clock_port",
+						   "Clock port (PTP: domain)", 0, 65535, 1);
+	obs_properties_add_int(props, "clock_threshold",
+						   "Report the clock synchronised below (us)", 1,
+						   1000000, 100);
 
 	obs_properties_add_bool(props, "restart_on_eos",
 							"Try to restart when end of stream is reached");
@@ -717,6 +1450,13 @@ obs_properties_t *gstreamer_source_get_properties(void *data)
 						   0, 10000, 100);
 	obs_properties_add_bool(props, "stop_on_hide",
 							"Stop pipeline when hidden");
+	obs_property_t *standby = obs_properties_add_bool(
+		props, "standby_on_hide", "Only stop decoding video when hidden");
+	obs_property_set_long_description(
+		standby,
+		"When the pipeline is not stopped, the stream keeps being received "
+		"and synchronised. Decoding picks up from the last keyframe on "
+		"show.");
 	obs_properties_add_bool(props, "block_video",
 							"Block video path when sink not fast enough");
 	obs_properties_add_bool(props, "block_audio",
@@ -724,34 +1464,227 @@ obs_properties_t *gstreamer_source_get_properties(void *data)
 	obs_properties_add_bool(
 		props, "clear_on_end",
 		"Clear image data after end-of-stream or error");
+	obs_properties_add_bool(
+		props, "request_keyframes",
+		"Ask the sender for a keyframe on start and on packet loss");
+
+	obs_property_t *prop = obs_properties_add_list(
+		props, "decoder", "Video decoder", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_STRING);
+	streaminsync_decoder_add_list(prop);
+	prop = obs_properties_add_int(props, "decoder_threads",
+								  "Decoder threads (0 = automatic)", 0, 64,
+								  1);
+	obs_property_set_long_description(
+		prop,
+		"Automatic splits the CPU cores between all running sources.");
+	prop = obs_properties_add_list(props, "decoder_thread_type",
+								   "Decoder threading", OBS_COMBO_TYPE_LIST,
+								   OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(prop, "Automatic", 0);
+	obs_property_list_add_int(prop, "Frame (throughput)", 1);
+	obs_property_list_add_int(prop, "Slice (low latency)", 2);
+	prop = obs_properties_add_bool(props, "pipelined_decode",
+								   "Decode and convert on separate threads");
+	obs_property_set_long_description(
+		prop,
+		"Queues decoding, colour conversion and the hand-off to OBS so "
+		"that each runs on its own core, and converts with as many threads "
+		"as the decoder. Helps 4K or high frame rate streams keep up, at "
+		"the cost of a few more threads per source.");
+	prop = obs_properties_add_list(props, "simulcast_layer",
+								   "Simulcast layer", OBS_COMBO_TYPE_LIST,
+								   OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(prop, "Automatic", -1);
+	obs_property_list_add_int(prop, "Full size", 0);
+	obs_property_list_add_int(prop, "Half size", 1);
+	obs_property_list_add_int(prop, "Quarter size", 2);
+	obs_property_set_long_description(
+		prop,
+		"For senders with --layers. Automatic decodes the smallest layer "
+		"that fills the source as drawn in the scenes, and a smaller one "
+		"while packets get lost. Switches happen on a keyframe, without "
+		"restarting the stream. Not available with a shared receiver.");
+
 	obs_properties_add_button2(props, "apply", "Apply", on_apply_clicked,
 							   data);
 
+	if (data)
+	{
+		prop = obs_properties_add_text(props, "stats", "Statistics",
+									   OBS_TEXT_INFO);
+		update_stats_text(data, prop);
+		obs_properties_add_button2(props, "refresh_stats",
+								   "Refresh statistics",
+								   on_refresh_stats_clicked, data);
+	}
+
 	return props;
 }
 
-void gstreamer_source_update(void *data, obs_data_t *settings)
+// Settings that need new sockets, everything else is changed on the
+// running pipeline.
+static gboolean needs_rebuild(const settings_t *old, const settings_t *now)
+{
+	return g_strcmp0(old->sender_ip, now->sender_ip) != 0 ||
+		   old->port != now->port ||
+		   old->shared_receiver != now->shared_receiver ||
+		   old->bundle != now->bundle ||
+		   old->clock.source != now->clock.source ||
+		   old->clock.port != now->clock.port ||
+		   old->clock.threshold != now->clock.threshold ||
+		   g_strcmp0(old->ntp_server, now->ntp_server) != 0 ||
+		   old->stream_id != now->stream_id;
+}
+
+static gboolean decoder_changed(const settings_t *old, const settings_t *now)
+{
+	return g_strcmp0(old->decoder, now->decoder) != 0 ||
+		   old->decoder_threads != now->decoder_threads ||
+		   old->decoder_thread_type != now->decoder_thread_type ||
+		   old->pipelined_decode != now->pipelined_decode ||
+		   old->request_keyframes != now->request_keyframes;
+}
+
+// Settings the running pipeline or receiver takes as it is, from
+// data->applied.
+static void apply_live(data_t *data, gboolean rebuild_decoder)
+{
+	const settings_t *settings = data->applied;
+	const streaminsync_sink_t sink = make_sink(data, settings);
+
+	if (data->stream)
+	{
+		streaminsync_receiver_update(data->stream, &sink, rebuild_decoder,
+									 &settings->latency);
+		return;
+	}
+
+	// Without a pipeline the next restart picks the settings up
+	if (data->pipe == NULL)
+		return;
+
+	streaminsync_latency_update(data->rtpbin, &settings->latency);
+
+	for (guint session = 0; session < 2; session++)
+	{
+		GstElement *branch =
+			gst_bin_get_by_name(GST_BIN(data->pipe), branch_names[session]);
+		if (branch == NULL)
+			continue;
+
+		// Decoders only take their threading on opening, the video branch
+		// is rebuilt behind the running jitterbuffer instead.
+		GstElement *replacement =
+			session == STREAMINSYNC_SESSION_VIDEO && rebuild_decoder
+				? streaminsync_branch_new(session, &sink)
+				: NULL;
+
+		if (replacement)
+		{
+			gst_element_set_name(replacement, branch_names[session]);
+			streaminsync_branch_replace(data->pipe, branch, replacement, NULL,
+										NULL);
+		}
+		else
+		{
+			streaminsync_branch_set_blocking(
+				branch, session == STREAMINSYNC_SESSION_VIDEO
+							? settings->block_video
+							: settings->block_audio);
+		}
+
+		gst_object_unref(branch);
+	}
+
+	// A layer chosen by hand is switched to right away
+	poll_layers(data);
+}
+
+static gboolean loop_update(gpointer user_data)
+{
+	data_t *data = user_data;
+	const settings_t *old = data->applied;
+
+	// Not started, the start picks the settings up
+	if (old == NULL)
+		return G_SOURCE_REMOVE;
+
+	const settings_t *now = settings_acquire(data);
+
+	if (needs_rebuild(old, now))
+	{
+		settings_release(now);
+
+		const gint state = g_atomic_int_get(&data->state);
+		if (state != STATE_STOPPED)
+			g_atomic_int_compare_and_exchange(&data->state, state,
+											  STATE_STARTING);
+
+		output_placeholder(data);
+		return loop_start(data);
+	}
+
+	const gboolean rebuild_decoder = decoder_changed(old, now);
+
+	data->applied = now;
+	apply_live(data, rebuild_decoder);
+	settings_release(old);
+
+	return G_SOURCE_REMOVE;
+}
+
+void gstreamer_source_update(void *user_data, obs_data_t *settings)
 {
-	stop(data);
+	data_t *data = user_data;
+
+	publish_settings(data, settings);
+	const settings_t *now = settings_acquire(data);
+	const gboolean stop_on_hide = now->stop_on_hide;
+
+	obs_source_set_async_unbuffered(data->source, now->scheduled_playout);
+	settings_release(now);
+	set_standby(data, wants_standby(data));
 
 	// Don't start the pipeline if source is hidden and 'stop_on_hide' is set.
 	// From GUI this is probably irrelevant but works around some quirks when
 	// controlled from script.
-	if (obs_data_get_bool(settings, "stop_on_hide") &&
-		!obs_source_showing(((data_t *)data)->source))
+	if (stop_on_hide && !obs_source_showing(data->source))
+	{
+		request_stop(data);
 		return;
+	}
 
-	start(data);
+	switch (g_atomic_int_get(&data->state))
+	{
+	case STATE_STOPPED:
+	case STATE_FAILED:
+		request_start(data);
+		break;
+	default:
+		gstreamer_dispatcher_invoke(loop_update, data);
+		break;
+	}
 }
 
 void gstreamer_source_show(void *data)
 {
-	if (((data_t *)data)->pipe == NULL)
-		start(data);
+	// Stopped on hide, or a source whose pipeline failed to build
+	const gint state = g_atomic_int_get(&((data_t *)data)->state);
+	if (state == STATE_STOPPED || state == STATE_FAILED)
+		request_start(data);
+
+	set_standby(data, FALSE);
 }
 
 void gstreamer_source_hide(void *data)
 {
-	if (obs_data_get_bool(((data_t *)data)->settings, "stop_on_hide"))
-		stop(data);
+	const settings_t *settings = settings_acquire(data);
+
+	if (settings->stop_on_hide)
+		request_stop(data);
+	else if (settings->standby_on_hide)
+		set_standby(data, TRUE);
+
+	settings_release(settings);
 }
@@ -0,0 +1,311 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Internal interfaces shared by the streaminsync*.c files.
+
+#ifndef STREAMINSYNC_H
+#define STREAMINSYNC_H
+
+#include <obs/obs-module.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/audio/audio.h>
+#include <gst/app/app.h>
+
+// RTP sessions used between sender and receiver
+#define STREAMINSYNC_SESSION_VIDEO 0
+#define STREAMINSYNC_SESSION_AUDIO 1
+
+// Payload types, distinct so that audio and video can share a session in
+// bundle mode. Retransmissions (RFC 4588 RTX) come with their own payload
+// type and SSRC, forward error correction (RFC 5109 ULPFEC) with its own
+// payload type and the media's SSRC.
+#define STREAMINSYNC_VIDEO_PT 96
+#define STREAMINSYNC_VIDEO_RTX_PT 97
+#define STREAMINSYNC_FEC_PT 98
+#define STREAMINSYNC_AUDIO_PT 100
+#define STREAMINSYNC_AUDIO_RTX_PT 101
+
+// Simulcast: the sender may send the video a second and third time, each at
+// half the size of the one before, on their own SSRC and payload type. Layer
+// 0 is the full size, the others take the payload types after audio.
+#define STREAMINSYNC_MAX_LAYERS 3
+#define STREAMINSYNC_LAYER_PT(layer) \
+	((layer) == 0 ? STREAMINSYNC_VIDEO_PT : 100 + 2 * (layer))
+#define STREAMINSYNC_LAYER_RTX_PT(layer) (STREAMINSYNC_LAYER_PT(layer) + 1)
+
+// Transport-wide congestion control (TWCC): the sender numbers its video
+// packets in this RTP header extension, rtpbin answers with feedback on when
+// each one arrived, which the sender's bandwidth estimator works from.
+#define STREAMINSYNC_TWCC_URI \
+	"http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
+#define STREAMINSYNC_TWCC_ID 5
+
+// Ports used from the port base, in order:
+// 0: video RTP
+// 1: video RTCP from the sender
+// 2: video RTCP to the sender
+// 3: audio RTP
+// 4: audio RTCP from the sender
+// 5: audio RTCP to the sender
+// In bundle mode the port base alone carries RTP and RTCP of both media, the
+// receiver sends its RTCP back to where the sender's packets come from.
+#define NB_PORTS 6
+
+// In bundle mode both media share one session, audio goes out with the
+// stream id plus one as its SSRC.
+#define STREAMINSYNC_BUNDLE_AUDIO_SSRC(id) ((guint32)(id) + 1)
+
+// Defaults of the receiving side
+#define STREAMINSYNC_NTP_SERVER "45.159.204.28"
+#define STREAMINSYNC_NTP_PORT 123
+#define STREAMINSYNC_CLOCK_PORT 5999
+// Clock offset in us below which a clock counts as synchronised
+#define STREAMINSYNC_CLOCK_THRESHOLD 1000
+#define STREAMINSYNC_LATENCY 500
+#define STREAMINSYNC_LATENCY_MIN 50
+#define STREAMINSYNC_LATENCY_MAX 1000
+// Without packets for this many ms a sender is considered silent
+#define STREAMINSYNC_SILENCE_TIMEOUT 2000
+
+// gstreamer-dispatcher.c
+GMainContext *gstreamer_dispatcher_get_context(void);
+void gstreamer_dispatcher_invoke(GSourceFunc func, gpointer user_data);
+void gstreamer_dispatcher_invoke_sync(GSourceFunc func, gpointer user_data);
+void gstreamer_dispatcher_shutdown(void);
+void gstreamer_worker_invoke(GSourceFunc func, gpointer user_data);
+void gstreamer_worker_then(GSourceFunc func, gpointer user_data);
+void gstreamer_worker_drain(void);
+void gstreamer_worker_dispose(GstElement *element);
+
+// streaminsync-caps.c
+bool streaminsync_video_template(GstCaps *caps, GstVideoInfo *video_info,
+								 struct obs_source_frame *frame);
+bool streaminsync_audio_template(GstCaps *caps, GstAudioInfo *audio_info,
+								 struct obs_source_audio *audio);
+void streaminsync_placeholder_frame(guint32 width, guint32 height,
+									struct obs_source_frame *frame);
+
+// streaminsync-clock.c
+
+// Where the pipeline clock comes from: an NTP server at address:port, our own
+// clock provided to the senders on port, or PTP domain port.
+enum
+{
+	STREAMINSYNC_CLOCK_NTP,
+	STREAMINSYNC_CLOCK_HOST,
+	STREAMINSYNC_CLOCK_PTP,
+};
+
+typedef struct
+{
+	gint source;
+	const gchar *address;
+	gint port;
+	// Offset in us to report synchronisation at, the smallest of the
+	// sources sharing a clock
+	gint threshold;
+} streaminsync_clock_config_t;
+
+GstClock *streaminsync_clock_acquire(const streaminsync_clock_config_t *config);
+void streaminsync_clock_release(GstClock *clock);
+void streaminsync_clock_require(GstClock *clock, gint threshold);
+void streaminsync_clock_cleanup(void);
+
+// streaminsync-decoder.c
+void streaminsync_decoder_add_list(obs_property_t *prop);
+gint streaminsync_decoder_auto_threads(gint active_sources);
+GstElement *streaminsync_decoder_make(const char *name, gint threads,
+									  gint thread_type, gint active_sources);
+gboolean streaminsync_decoder_link(GstBin *bin, GstElement *decoder,
+								   GstElement *sink, gboolean pipelined,
+								   gint threads, gint active_sources,
+								   gboolean block);
+void streaminsync_decoder_set_blocking(GstBin *bin, gboolean block);
+
+// streaminsync-latency.c
+
+// Playout latency of a pipeline, in ms. When adaptive it follows the jitter
+// of all running pipelines between 'min' and 'max', starting at 'latency'.
+// Otherwise it stays at 'latency'.
+typedef struct
+{
+	gint latency;
+	gint min;
+	gint max;
+	gboolean adaptive;
+} streaminsync_latency_t;
+
+gint streaminsync_latency_initial(const streaminsync_latency_t *config);
+void streaminsync_latency_add(GstElement *rtpbin,
+							  const streaminsync_latency_t *config);
+void streaminsync_latency_update(GstElement *rtpbin,
+								 const streaminsync_latency_t *config);
+void streaminsync_latency_remove(GstElement *rtpbin);
+
+// streaminsync-playout.c
+
+// When a sample is due for playout, on the os_gettime_ns() timeline of OBS.
+// 0 if that is not known yet.
+guint64 streaminsync_playout_time(GstAppSink *appsink, GstSample *sample);
+
+// streaminsync-stretch.c
+
+// Keeps audio on a continuous timeline following the playout deadlines.
+typedef struct streaminsync_stretch streaminsync_stretch_t;
+
+streaminsync_stretch_t *streaminsync_stretch_new(void);
+void streaminsync_stretch_free(streaminsync_stretch_t *stretch);
+void streaminsync_stretch_reset(streaminsync_stretch_t *stretch);
+// Number of periods dropped or repeated so far
+gint streaminsync_stretch_count(streaminsync_stretch_t *stretch);
+// Takes 'frames' of interleaved float audio due at 'due' and returns how
+// many frames to play out instead, from '*out' at '*timestamp'. '*out'
+// stays valid until the next call.
+guint32 streaminsync_stretch_process(streaminsync_stretch_t *stretch,
+									 const gfloat *in, guint32 frames,
+									 gint rate, gint channels, guint64 due,
+									 const gfloat **out, guint64 *timestamp);
+
+// streaminsync-standby.c
+
+void streaminsync_standby_attach(GstElement *branch, GstElement *decoder,
+								 gboolean standby);
+void streaminsync_branch_set_standby(GstElement *branch, gboolean standby);
+
+// streaminsync-simulcast.c
+
+gint streaminsync_pt_layer(guint pt);
+GstElement *streaminsync_layers_new(void);
+GstPad *streaminsync_layers_sink(GstElement *selector, guint pt);
+GstPad *streaminsync_layers_feed(GstPad *pad);
+void streaminsync_layers_select(GstElement *selector, gint layer);
+void streaminsync_layers_update(GstElement *selector, GstElement *rtpbin,
+								gint layer, gint height, gint decoded_height);
+
+// streaminsync-stats.c
+
+// Counts are totals since the pipeline started, jitter and rtt are the worst
+// of the senders accounted for in ns. rtt is the average time a retransmission took, 0 until
+// one was requested. av_offset is how much earlier video reaches its sink
+// than audio, relative to their render time, in ms. ttff is the time to the
+// first frame after the last (re)start, in ms. lost counts the packets
+// missing before FEC, recovered the ones FEC brought back.
+// stretched counts the audio periods dropped or repeated to follow the
+// playout deadline. decode_us, queue_us and convert_us are the smoothed time
+// a frame spends in each stage of the video chain, queue_us being 0 unless
+// it is pipelined.
+typedef struct
+{
+	guint64 received;
+	guint64 lost;
+	guint64 recovered;
+	guint64 late;
+	guint64 jitter;
+	guint64 rtt;
+	gint latency;
+	guint64 decoded;
+	guint64 dropped;
+	gint av_offset;
+	gint ttff;
+	guint64 stretched;
+	gint decode_us;
+	gint queue_us;
+	gint convert_us;
+} streaminsync_stats_t;
+
+void streaminsync_stats_attach(GstElement *branch, GstElement *decoder,
+							   GstElement *appsink);
+void streaminsync_stats_attach_stages(GstElement *branch, GstElement *decoder);
+void streaminsync_stats_rtp(GstElement *rtpbin, guint session, guint32 ssrc,
+							streaminsync_stats_t *stats);
+void streaminsync_stats_branches(GstElement *video, GstElement *audio,
+								 streaminsync_stats_t *stats);
+gchar *streaminsync_stats_format(const streaminsync_stats_t *stats);
+
+// streaminsync-receiver.c
+
+// Where and how the decoded media of one stream is handed to OBS.
+typedef struct
+{
+	const gchar *decoder;
+	gint decoder_threads;
+	gint decoder_thread_type;
+	gint active_sources;
+	// Decoding, conversion and hand-off each on their own thread
+	gboolean pipelined;
+	gboolean block_video;
+	gboolean block_audio;
+	gboolean request_keyframes;
+	// Video decoding stopped, while the source is hidden
+	gboolean standby;
+	GstAppSinkCallbacks video_cbs;
+	GstAppSinkCallbacks audio_cbs;
+	gpointer user_data;
+} streaminsync_sink_t;
+
+typedef struct streaminsync_stream streaminsync_stream_t;
+
+GstCaps *streaminsync_rtp_caps(guint session);
+GstElement *streaminsync_rtpbin_new(gint latency);
+GstElement *streaminsync_bundle_new(GstBin *bin, GstElement *rtpbin,
+									gint port, const gchar *name);
+void streaminsync_rtx_budget(GstElement *rtpbin, gint latency,
+							 GstClockTime rtt);
+GstElement *streaminsync_branch_new(guint session,
+									const streaminsync_sink_t *sink);
+void streaminsync_request_keyframe(GstPad *pad);
+void streaminsync_discard_pad(GstBin *bin, GstPad *pad);
+gboolean streaminsync_parse_pad_name(const gchar *name, guint *session,
+									 guint32 *ssrc, guint *pt);
+gboolean streaminsync_jitterbuffer_matches(GstElement *jitterbuffer,
+										   guint session, guint32 ssrc);
+void streaminsync_flush_session(GstElement *rtpbin, guint session,
+								guint32 ssrc);
+gboolean streaminsync_warm_reset(GstElement *pipe, GstElement *rtpbin,
+								 GstObject *src);
+// Called once a branch replacement is done, or with FALSE if it never
+// happened because the pad went away first.
+typedef void (*streaminsync_replaced_t)(gboolean replaced, gpointer user_data);
+
+void streaminsync_silence(GstElement *element);
+void streaminsync_dispose(GstElement *element);
+void streaminsync_branch_replace(GstElement *pipe, GstElement *old,
+								 GstElement *branch,
+								 streaminsync_replaced_t done,
+								 gpointer user_data);
+void streaminsync_branch_set_blocking(GstElement *branch, gboolean block);
+
+streaminsync_stream_t *streaminsync_receiver_attach(
+	gint port, gboolean bundle, guint32 ssrc, const gchar *sender_ip,
+	const streaminsync_sink_t *sink, const streaminsync_latency_t *latency,
+	const streaminsync_clock_config_t *clock);
+void streaminsync_receiver_detach(streaminsync_stream_t *stream);
+gboolean streaminsync_receiver_closing(gint port);
+void streaminsync_receiver_update(streaminsync_stream_t *stream,
+								  const streaminsync_sink_t *sink,
+								  gboolean rebuild,
+								  const streaminsync_latency_t *latency);
+void streaminsync_receiver_set_standby(streaminsync_stream_t *stream,
+									   gboolean standby);
+void streaminsync_receiver_stats(streaminsync_stream_t *stream,
+								 streaminsync_stats_t *stats);
+
+#endif
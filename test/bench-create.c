@@ -0,0 +1,184 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Time the OBS threads calling into the streaminsync source spend there,
+// with N sources created, updated, hidden, shown and destroyed as when a
+// scene collection is loaded and used. Pipelines are built and torn down on
+// the plugin's dispatcher thread, so only destroying, which waits for the
+// teardown, should take longer with more sources.
+// Usage: bench-create [SOURCES]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <obs/obs.h>
+#include <gst/gst.h>
+
+#include "../streaminsync.h"
+
+// Ports between two sources. A source moves up by NB_PORTS on update while
+// the next one still holds its own, so they must not overlap either way.
+#define PORT_STRIDE (2 * NB_PORTS)
+
+// streaminsync.c
+extern void *gstreamer_source_create(obs_data_t *settings,
+                                     obs_source_t *source);
+extern void gstreamer_source_destroy(void *data);
+extern void gstreamer_source_get_defaults(obs_data_t *settings);
+extern void gstreamer_source_update(void *data, obs_data_t *settings);
+extern void gstreamer_source_show(void *data);
+extern void gstreamer_source_hide(void *data);
+
+// The OBS side of the sources, the streaminsync callbacks are called
+// directly to time them one by one.
+static const char *host_get_name(void *type_data)
+{
+    return "Benchmark host";
+}
+
+static void *host_create(obs_data_t *settings, obs_source_t *source)
+{
+    return source;
+}
+
+static void host_destroy(void *data)
+{
+}
+
+static struct obs_source_info host_info = {
+    .id = "bench-create-host",
+    .type = OBS_SOURCE_TYPE_INPUT,
+    .output_flags = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_AUDIO,
+    .get_name = host_get_name,
+    .create = host_create,
+    .destroy = host_destroy,
+};
+
+typedef struct
+{
+    double total;
+    double max;
+} timing_t;
+
+static void add(timing_t *timing, gint64 since)
+{
+    const double ms = (g_get_monotonic_time() - since) / 1000.0;
+
+    timing->total += ms;
+    timing->max = MAX(timing->max, ms);
+}
+
+static void print(const char *name, const timing_t *timing, int sources)
+{
+    printf("%8s %10.1f %10.2f %10.2f\n", name, timing->total, timing->total / sources, timing->max);
+}
+
+int main(int argc, char **argv)
+{
+    const int sources = argc > 1 ? atoi(argv[1]) : 20;
+
+    gst_init(&argc, &argv);
+    obs_startup("en-US", NULL, NULL);
+    obs_register_source(&host_info);
+
+    obs_source_t **hosts = g_new0(obs_source_t *, sources);
+    obs_data_t **settings = g_new0(obs_data_t *, sources);
+    void **data = g_new0(void *, sources);
+    timing_t create = {0};
+    timing_t update = {0};
+    timing_t hide = {0};
+    timing_t show = {0};
+    timing_t destroy = {0};
+
+    // Started on creation, like sources that are not stopped when hidden,
+    // on a clock that does not need the network
+    for (int i = 0; i < sources; i++)
+    {
+        gchar *name = g_strdup_printf("source %d", i);
+
+        hosts[i] = obs_source_create_private(host_info.id, name, NULL);
+        settings[i] = obs_data_create();
+        gstreamer_source_get_defaults(settings[i]);
+        obs_data_set_int(settings[i], "port", 6000 + PORT_STRIDE * i);
+        obs_data_set_bool(settings[i], "stop_on_hide", false);
+        obs_data_set_int(settings[i], "clock_source", STREAMINSYNC_CLOCK_HOST);
+
+        const gint64 start = g_get_monotonic_time();
+        data[i] = gstreamer_source_create(settings[i], hosts[i]);
+        add(&create, start);
+
+        g_free(name);
+    }
+
+    // A new port rebuilds the pipeline
+    for (int i = 0; i < sources; i++)
+    {
+        obs_data_set_int(settings[i], "port", 6000 + PORT_STRIDE * i + NB_PORTS);
+
+        const gint64 start = g_get_monotonic_time();
+        gstreamer_source_update(data[i], settings[i]);
+        add(&update, start);
+    }
+
+    // Stopped and started again on hide
+    for (int i = 0; i < sources; i++)
+    {
+        obs_data_set_bool(settings[i], "stop_on_hide", true);
+        gstreamer_source_update(data[i], settings[i]);
+
+        gint64 start = g_get_monotonic_time();
+        gstreamer_source_hide(data[i]);
+        add(&hide, start);
+
+        start = g_get_monotonic_time();
+        gstreamer_source_show(data[i]);
+        add(&show, start);
+    }
+
+    for (int i = 0; i < sources; i++)
+    {
+        const gint64 start = g_get_monotonic_time();
+        gstreamer_source_destroy(data[i]);
+        add(&destroy, start);
+
+        obs_data_release(settings[i]);
+        obs_source_release(hosts[i]);
+    }
+
+    // As on module unload, clocks stop watching their statistics on the
+    // dispatcher thread
+    streaminsync_clock_cleanup();
+    gstreamer_dispatcher_shutdown();
+
+    printf("%d sources\n", sources);
+    printf("%8s %10s %10s %10s\n", "", "total ms", "mean ms", "max ms");
+    print("create", &create, sources);
+    print("update", &update, sources);
+    print("hide", &hide, sources);
+    print("show", &show, sources);
+    print("destroy", &destroy, sources);
+
+    g_free(hosts);
+    g_free(settings);
+    g_free(data);
+
+    obs_shutdown();
+
+    return 0;
+}
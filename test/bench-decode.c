@@ -0,0 +1,177 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// H.264 decode throughput of the decoders picked by the streaminsync source,
+// for several thread counts and threading types, then of the whole chain
+// down to BGRA, serial and pipelined. Runs on the CPU only unless a hardware
+// decoder is named. Usage: bench-decode [DECODER] [FRAMES]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <obs/obs.h>
+#include <gst/gst.h>
+#include <gst/app/app.h>
+
+#include "../streaminsync.h"
+
+// Encodes 'frames' frames of 1080p test video once, with several slices per
+// frame so that slice threading has something to work on.
+static GList *encode(int frames, GstCaps **caps)
+{
+    gchar *desc = g_strdup_printf(
+        "videotestsrc num-buffers=%d pattern=ball ! video/x-raw, width=1920, height=1080, framerate=60/1 ! "
+        "x264enc speed-preset=veryfast tune=zerolatency sliced-threads=true threads=4 key-int-max=60 ! "
+        "h264parse ! video/x-h264, stream-format=byte-stream, alignment=au ! appsink name=sink sync=false",
+        frames);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipe), "sink");
+    GList *buffers = NULL;
+
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+
+    GstSample *sample;
+    while ((sample = gst_app_sink_pull_sample(GST_APP_SINK(sink))) != NULL)
+    {
+        if (*caps == NULL)
+            *caps = gst_caps_ref(gst_sample_get_caps(sample));
+        buffers = g_list_prepend(buffers, gst_buffer_ref(gst_sample_get_buffer(sample)));
+        gst_sample_unref(sample);
+    }
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipe);
+
+    return g_list_reverse(buffers);
+}
+
+// Frames per second through the decoder, or through the decoder and the
+// conversion to BGRA with 'pipelined' 0 (serial) or 1.
+static double decode(GList *buffers, GstCaps *caps, const char *decoder,
+                     int threads, int thread_type, int pipelined)
+{
+    GstElement *pipe = gst_pipeline_new(NULL);
+    GstElement *src = gst_element_factory_make("appsrc", NULL);
+    GstElement *parse = gst_element_factory_make("h264parse", NULL);
+    GstElement *dec = streaminsync_decoder_make(decoder, threads, thread_type, 1);
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+
+    g_object_set(src, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+    g_object_set(sink, "sync", FALSE, NULL);
+
+    gst_bin_add_many(GST_BIN(pipe), src, parse, dec, NULL);
+    gst_element_link_many(src, parse, dec, NULL);
+
+    if (pipelined < 0)
+    {
+        gst_bin_add(GST_BIN(pipe), sink);
+        gst_element_link(dec, sink);
+    }
+    else
+    {
+        GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+        GstCaps *bgra = gst_caps_from_string("video/x-raw, format=BGRA");
+
+        g_object_set(filter, "caps", bgra, NULL);
+        gst_caps_unref(bgra);
+
+        gst_bin_add_many(GST_BIN(pipe), filter, sink, NULL);
+        gst_element_link(filter, sink);
+        streaminsync_decoder_link(GST_BIN(pipe), dec, filter, pipelined, threads, 1, TRUE);
+    }
+
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+
+    gint64 start = g_get_monotonic_time();
+
+    for (GList *l = buffers; l != NULL; l = l->next)
+        gst_app_src_push_buffer(GST_APP_SRC(src), gst_buffer_ref(l->data));
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+
+    GstBus *bus = gst_element_get_bus(pipe);
+    GstMessage *msg = gst_bus_timed_pop_filtered(
+        bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+        elapsed = 0;
+
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+
+    return elapsed > 0 ? g_list_length(buffers) * (double)G_USEC_PER_SEC / elapsed : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *decoder = argc > 1 ? argv[1] : "avdec_h264";
+    int frames = argc > 2 ? atoi(argv[2]) : 600;
+
+    gst_init(&argc, &argv);
+
+    GstCaps *caps = NULL;
+    GList *buffers = encode(frames, &caps);
+
+    static const int thread_counts[] = {1, 2, 4, 8, 0};
+    static const char *thread_types[] = {"auto", "frame", "slice"};
+
+    printf("decoder: %s, %u frames of 1080p60\n", decoder, g_list_length(buffers));
+    printf("%8s %8s %10s\n", "threads", "type", "fps");
+
+    for (size_t t = 0; t < G_N_ELEMENTS(thread_types); t++)
+    {
+        for (size_t i = 0; i < G_N_ELEMENTS(thread_counts); i++)
+        {
+            double fps = decode(buffers, caps, decoder, thread_counts[i], t, -1);
+
+            if (thread_counts[i] == 0)
+                printf("%8s %8s %10.1f\n", "auto", thread_types[t], fps);
+            else
+                printf("%8d %8s %10.1f\n", thread_counts[i], thread_types[t], fps);
+        }
+    }
+
+    static const char *modes[] = {"serial", "pipelined"};
+
+    printf("\ndecode and convert to BGRA\n");
+    printf("%8s %10s %10s\n", "threads", "mode", "fps");
+
+    for (size_t i = 0; i < G_N_ELEMENTS(thread_counts); i++)
+    {
+        for (size_t m = 0; m < G_N_ELEMENTS(modes); m++)
+        {
+            double fps = decode(buffers, caps, decoder, thread_counts[i], 0, m);
+
+            if (thread_counts[i] == 0)
+                printf("%8s %10s %10.1f\n", "auto", modes[m], fps);
+            else
+                printf("%8d %10s %10.1f\n", thread_counts[i], modes[m], fps);
+        }
+    }
+
+    g_list_free_full(buffers, (GDestroyNotify)gst_buffer_unref);
+    gst_caps_unref(caps);
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Per-sample cost of turning an appsink sample into an OBS frame, comparing
+// parsing the caps on every sample with the cached template used by the
+// streaminsync source. Usage: bench-sample [ITERATIONS]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <obs/obs.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/audio/audio.h>
+
+#include "../streaminsync.h"
+
+// Keeps the compiler from optimising the loops away.
+static volatile uint64_t sink;
+
+static GstSample *make_sample(GstCaps *caps, gsize size)
+{
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    GstSample *sample = gst_sample_new(buffer, caps, NULL, NULL);
+    gst_buffer_unref(buffer);
+
+    return sample;
+}
+
+static double bench_video(GstSample *sample, int iterations, bool cached)
+{
+    GstCaps *cached_caps = NULL;
+    GstVideoInfo video_info;
+    struct obs_source_frame template;
+
+    gint64 start = g_get_monotonic_time();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        GstCaps *caps = gst_sample_get_caps(sample);
+        GstMapInfo info;
+
+        if (!cached || caps != cached_caps)
+        {
+            cached_caps = caps;
+            streaminsync_video_template(caps, &video_info, &template);
+        }
+
+        gst_buffer_map(buffer, &info, GST_MAP_READ);
+
+        struct obs_source_frame frame = template;
+        frame.timestamp = i;
+        frame.data[0] = info.data + video_info.offset[0];
+        frame.data[1] = info.data + video_info.offset[1];
+        frame.data[2] = info.data + video_info.offset[2];
+        sink += (uintptr_t)frame.data[2] + frame.format;
+
+        gst_buffer_unmap(buffer, &info);
+    }
+
+    return (g_get_monotonic_time() - start) * 1000.0 / iterations;
+}
+
+static double bench_audio(GstSample *sample, int iterations, bool cached)
+{
+    GstCaps *cached_caps = NULL;
+    GstAudioInfo audio_info;
+    struct obs_source_audio template;
+
+    gint64 start = g_get_monotonic_time();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        GstCaps *caps = gst_sample_get_caps(sample);
+        GstMapInfo info;
+
+        if (!cached || caps != cached_caps)
+        {
+            cached_caps = caps;
+            streaminsync_audio_template(caps, &audio_info, &template);
+        }
+
+        gst_buffer_map(buffer, &info, GST_MAP_READ);
+
+        struct obs_source_audio audio = template;
+        audio.frames = info.size / audio_info.bpf;
+        audio.data[0] = info.data;
+        audio.timestamp = i;
+        sink += audio.frames + audio.format;
+
+        gst_buffer_unmap(buffer, &info);
+    }
+
+    return (g_get_monotonic_time() - start) * 1000.0 / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    gst_init(&argc, &argv);
+
+    GstCaps *vcaps = gst_caps_from_string(
+        "video/x-raw, format=I420, width=1920, height=1080, framerate=60/1, colorimetry=bt709");
+    GstCaps *acaps = gst_caps_from_string(
+        "audio/x-raw, format=F32LE, rate=48000, channels=2, layout=interleaved");
+
+    GstSample *vsample = make_sample(vcaps, 1920 * 1080 * 3 / 2);
+    GstSample *asample = make_sample(acaps, 960 * 2 * 4);
+
+    printf("iterations: %d\n", iterations);
+    printf("video  per-sample parse: %8.1f ns\n", bench_video(vsample, iterations, false));
+    printf("video  cached template:  %8.1f ns\n", bench_video(vsample, iterations, true));
+    printf("audio  per-sample parse: %8.1f ns\n", bench_audio(asample, iterations, false));
+    printf("audio  cached template:  %8.1f ns\n", bench_audio(asample, iterations, true));
+
+    gst_sample_unref(vsample);
+    gst_sample_unref(asample);
+    gst_caps_unref(vcaps);
+    gst_caps_unref(acaps);
+
+    return 0;
+}
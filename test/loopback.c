@@ -0,0 +1,1108 @@
+/*
+ * obs-gstreamer. OBS Studio plugin.
+ * Copyright (C) 2018-2021 Florian Zwoch <fzwoch@gmail.com>
+ *
+ * This file is part of obs-gstreamer.
+ *
+ * obs-gstreamer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * obs-gstreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with obs-gstreamer. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Sender and receiver over the loopback interface, with netsim in between to
+// spoil the network. Each test prints what it measures once a second and
+// exits non-zero when the receiver does not behave.
+// Usage: loopback TEST [PORT]
+//
+//   jitter   Injects phases of growing packet delay jitter and checks that
+//            the adaptive playout latency follows it up and back down.
+//   keyframe Joins a sender with a 10 s GOP and measures the time to the
+//            first frame, without and with keyframe requests.
+//   standby  Puts the decoding of a stream with a 10 s GOP in standby and
+//            measures how fast it resumes from the cached keyframe.
+//   fec      Drops packets at random and reports the loss left after FEC
+//            and the bandwidth it costs, for each protection level.
+//   audio    Injects jitter and loss on an Opus stream and scores the audio
+//            handed over, played out at the deadline and stretched.
+//   congestion
+//            Rate-limits the path of a stream and checks that the sender's
+//            bandwidth estimate settles below the limit and recovers after.
+//   simulcast
+//            Switches between the two layers of a sender with a 10 s GOP
+//            and measures how long it takes for the other size to be
+//            decoded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <obs/obs.h>
+#include <gst/gst.h>
+#include <gst/app/app.h>
+#include <gst/audio/audio.h>
+#include <gst/base/gstbasesink.h>
+
+#include "../streaminsync.h"
+#include "../sender/bwe.h"
+
+#define RTP_CAPS \
+    "application/x-rtp, media=video, clock-rate=90000, encoding-name=H264, payload=96"
+
+static GstElement *sender_new(int port)
+{
+    gchar *desc = g_strdup_printf(
+        "videotestsrc is-live=true pattern=ball ! video/x-raw, width=640, height=360, framerate=30/1 ! "
+        "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=30 ! "
+        "rtph264pay pt=96 config-interval=-1 ! netsim name=netsim ! udpsink host=127.0.0.1 port=%d",
+        port);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    return pipe;
+}
+
+static GstElement *receiver_new(int port, gint latency)
+{
+    gchar *desc = g_strdup_printf(
+        "rtpbin name=rtpbin latency=%d udpsrc port=%d caps=\"" RTP_CAPS "\" ! rtpbin.recv_rtp_sink_0 "
+        "rtpbin. ! rtph264depay ! avdec_h264 ! fakesink name=sink sync=true",
+        latency, port);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    return pipe;
+}
+
+// What the plugin's bus callbacks do with the latency messages the
+// jitterbuffers post when the controller changes them
+static void recalculate_latency(GstElement *pipe)
+{
+    GstBus *bus = gst_element_get_bus(pipe);
+    GstMessage *message;
+
+    while ((message = gst_bus_pop_filtered(bus, GST_MESSAGE_LATENCY)) != NULL)
+    {
+        gst_bin_recalculate_latency(GST_BIN(pipe));
+        gst_message_unref(message);
+    }
+    gst_object_unref(bus);
+}
+
+static guint sink_latency_ms(GstElement *pipe)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipe), "sink");
+    const GstClockTime latency = gst_base_sink_get_latency(GST_BASE_SINK(sink));
+
+    gst_object_unref(sink);
+    return latency / GST_MSECOND;
+}
+
+static void set_jitter(GstElement *sender, int max_delay)
+{
+    GstElement *netsim = gst_bin_get_by_name(GST_BIN(sender), "netsim");
+
+    g_object_set(netsim, "min-delay", 0, "max-delay", max_delay, NULL);
+    gst_object_unref(netsim);
+}
+
+typedef struct
+{
+    int seconds;
+    int max_delay;
+} phase_t;
+
+static int test_jitter(int port)
+{
+    static const phase_t phases[] = {
+        {10, 0},
+        {20, 60},
+        {20, 200},
+        {40, 0},
+    };
+    const streaminsync_latency_t config = {
+        .latency = 100,
+        .min = 20,
+        .max = 1000,
+        .adaptive = TRUE,
+    };
+
+    GstElement *sender = sender_new(port);
+    GstElement *receiver = receiver_new(port, streaminsync_latency_initial(&config));
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(receiver), "rtpbin");
+
+    if (sender == NULL || receiver == NULL)
+    {
+        fprintf(stderr, "cannot create the pipelines\n");
+        return 1;
+    }
+
+    streaminsync_latency_add(rtpbin, &config);
+
+    gst_element_set_state(receiver, GST_STATE_PLAYING);
+    gst_element_set_state(sender, GST_STATE_PLAYING);
+
+    guint latency_calm = 0;
+    guint latency_peak = 0;
+    guint latency_end = 0;
+    guint sink_calm = 0;
+    guint sink_peak = 0;
+    guint sink_end = 0;
+    int t = 0;
+
+    printf("%6s %10s %10s %10s %10s %8s %8s\n", "time", "injected", "latency", "sink", "jitter", "late", "lost");
+
+    for (size_t p = 0; p < G_N_ELEMENTS(phases); p++)
+    {
+        set_jitter(sender, phases[p].max_delay);
+
+        for (int s = 0; s < phases[p].seconds; s++, t++)
+        {
+            g_usleep(G_USEC_PER_SEC);
+            recalculate_latency(receiver);
+
+            streaminsync_stats_t stats = {0};
+
+            streaminsync_stats_rtp(rtpbin, G_MAXUINT, 0, &stats);
+
+            printf("%6d %10d %10d %10u %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT "\n",
+                   t, phases[p].max_delay, stats.latency, sink_latency_ms(receiver), stats.jitter / GST_MSECOND,
+                   stats.late, stats.lost);
+        }
+
+        guint latency;
+        g_object_get(rtpbin, "latency", &latency, NULL);
+        const guint sink = sink_latency_ms(receiver);
+
+        if (p == 0)
+        {
+            latency_calm = latency;
+            sink_calm = sink;
+        }
+        else if (p == 2)
+        {
+            latency_peak = latency;
+            sink_peak = sink;
+        }
+        else if (p == 3)
+        {
+            latency_end = latency;
+            sink_end = sink;
+        }
+    }
+
+    streaminsync_latency_remove(rtpbin);
+
+    gst_element_set_state(sender, GST_STATE_NULL);
+    gst_element_set_state(receiver, GST_STATE_NULL);
+    gst_object_unref(rtpbin);
+    gst_object_unref(sender);
+    gst_object_unref(receiver);
+
+    // The buffer has to grow past the injected delay and shrink again once
+    // the network has calmed down.
+    if (latency_peak < (guint)phases[2].max_delay || latency_peak <= latency_calm ||
+        latency_end >= latency_peak)
+    {
+        printf("FAIL: calm %u ms, peak %u ms, end %u ms\n", latency_calm, latency_peak, latency_end);
+        return 1;
+    }
+
+    // And the sink has to play out with it, not with the startup latency
+    if (sink_peak < latency_peak || sink_peak <= sink_calm || sink_end >= sink_peak)
+    {
+        printf("FAIL: sink latency calm %u ms, peak %u ms, end %u ms\n", sink_calm, sink_peak, sink_end);
+        return 1;
+    }
+
+    printf("OK: calm %u ms, peak %u ms, end %u ms, sink %u/%u/%u ms\n", latency_calm, latency_peak, latency_end,
+           sink_calm, sink_peak, sink_end);
+    return 0;
+}
+
+// Sender with RTCP both ways, on ports PORT to PORT + 2 like one session of
+// the real sender.
+static GstElement *rtcp_sender_new(int port, int key_int_max)
+{
+    gchar *desc = g_strdup_printf(
+        "rtpbin name=rtpbin rtp-profile=avpf "
+        "videotestsrc is-live=true pattern=ball ! video/x-raw, width=640, height=360, framerate=30/1 ! "
+        "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=%d ! "
+        "rtph264pay pt=96 config-interval=-1 ! rtpbin.send_rtp_sink_0 "
+        "rtpbin.send_rtp_src_0 ! udpsink host=127.0.0.1 port=%d "
+        "rtpbin.send_rtcp_src_0 ! udpsink host=127.0.0.1 port=%d sync=false async=false "
+        "udpsrc port=%d ! rtpbin.recv_rtcp_sink_0",
+        key_int_max, port, port + 1, port + 2);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    return pipe;
+}
+
+typedef struct
+{
+    gint64 started;
+    gint64 first_frame;
+    gint done;
+} ttff_t;
+
+static GstFlowReturn ttff_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    ttff_t *ttff = user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+
+    if (!g_atomic_int_get(&ttff->done))
+    {
+        ttff->first_frame = g_get_monotonic_time();
+        g_atomic_int_set(&ttff->done, TRUE);
+    }
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static void link_branch(GstElement *rtpbin, GstPad *pad, gpointer user_data)
+{
+    GstElement *branch = user_data;
+    GstPad *sinkpad = gst_element_get_static_pad(branch, "sink");
+
+    if (!gst_pad_is_linked(sinkpad))
+        gst_pad_link(pad, sinkpad);
+    gst_object_unref(sinkpad);
+}
+
+// The receiving end of the streaminsync source, rtpbin and video branch,
+// for a sender from rtcp_sender_new().
+static GstElement *video_receiver_new(int port, const streaminsync_sink_t *sink, GstElement **branch)
+{
+    GstElement *pipe = gst_pipeline_new(NULL);
+    GstElement *rtpbin = streaminsync_rtpbin_new(200);
+    GstElement *rtpsrc = gst_element_factory_make("udpsrc", NULL);
+    GstElement *rtcpsrc = gst_element_factory_make("udpsrc", NULL);
+    GstElement *rtcpsink = gst_element_factory_make("udpsink", NULL);
+    GstCaps *caps = streaminsync_rtp_caps(STREAMINSYNC_SESSION_VIDEO);
+
+    *branch = streaminsync_branch_new(STREAMINSYNC_SESSION_VIDEO, sink);
+
+    gst_element_set_name(rtpbin, "rtpbin");
+    g_object_set(rtpsrc, "port", port, "caps", caps, NULL);
+    g_object_set(rtcpsrc, "port", port + 1, NULL);
+    g_object_set(rtcpsink, "host", "127.0.0.1", "port", port + 2, "sync", FALSE, "async", FALSE, NULL);
+    gst_caps_unref(caps);
+
+    gst_bin_add_many(GST_BIN(pipe), rtpbin, rtpsrc, rtcpsrc, rtcpsink, *branch, NULL);
+    gst_element_link_pads(rtpsrc, "src", rtpbin, "recv_rtp_sink_0");
+    gst_element_link_pads(rtcpsrc, "src", rtpbin, "recv_rtcp_sink_0");
+    gst_element_link_pads(rtpbin, "send_rtcp_src_0", rtcpsink, "sink");
+    g_signal_connect(rtpbin, "pad-added", G_CALLBACK(link_branch), *branch);
+
+    return pipe;
+}
+
+// Joins a running sender. Returns the time to the first frame in ms.
+static int join(int port, gboolean request_keyframes)
+{
+    ttff_t ttff = {0};
+    const streaminsync_sink_t sink = {
+        .decoder = "avdec_h264",
+        .request_keyframes = request_keyframes,
+        .video_cbs = {NULL, NULL, ttff_new_sample},
+        .user_data = &ttff,
+    };
+    GstElement *branch;
+    GstElement *pipe = video_receiver_new(port, &sink, &branch);
+
+    ttff.started = g_get_monotonic_time();
+    gst_element_set_state(pipe, GST_STATE_PLAYING);
+
+    for (int i = 0; i < 150 && !g_atomic_int_get(&ttff.done); i++)
+        g_usleep(100 * 1000);
+
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+
+    if (!ttff.done)
+        return -1;
+
+    return (ttff.first_frame - ttff.started) / G_TIME_SPAN_MILLISECOND;
+}
+
+static int test_keyframe(int port)
+{
+    const int runs = 5;
+    int total[2] = {0, 0};
+
+    GstElement *sender = rtcp_sender_new(port, 300);
+    if (sender == NULL)
+    {
+        fprintf(stderr, "cannot create the sender\n");
+        return 1;
+    }
+
+    gst_element_set_state(sender, GST_STATE_PLAYING);
+
+    printf("%4s %12s %12s\n", "run", "ttff before", "ttff after");
+
+    for (int run = 0; run < runs; run++)
+    {
+        int ttff[2];
+
+        // Join at different points of the GOP
+        g_usleep(g_random_int_range(500, 3000) * 1000);
+
+        for (int requests = 0; requests < 2; requests++)
+        {
+            ttff[requests] = join(port, requests);
+            total[requests] += ttff[requests] < 0 ? 15000 : ttff[requests];
+        }
+
+        printf("%4d %9d ms %9d ms\n", run, ttff[0], ttff[1]);
+    }
+
+    gst_element_set_state(sender, GST_STATE_NULL);
+    gst_object_unref(sender);
+
+    printf("mean %9d ms %9d ms\n", total[0] / runs, total[1] / runs);
+
+    // With requests the sender's GOP must not matter any more
+    if (total[1] >= total[0])
+    {
+        printf("FAIL: keyframe requests do not speed up the first frame\n");
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+typedef struct
+{
+    ttff_t ttff;
+    gint frames;
+} standby_counters_t;
+
+static GstFlowReturn standby_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    standby_counters_t *counters = user_data;
+
+    g_atomic_int_inc(&counters->frames);
+
+    return ttff_new_sample(appsink, &counters->ttff);
+}
+
+static int wait_first_frame(ttff_t *ttff)
+{
+    for (int i = 0; i < 1500 && !g_atomic_int_get(&ttff->done); i++)
+        g_usleep(10 * 1000);
+
+    if (!g_atomic_int_get(&ttff->done))
+        return -1;
+
+    return (ttff->first_frame - ttff->started) / G_TIME_SPAN_MILLISECOND;
+}
+
+static int test_standby(int port)
+{
+    const int rounds = 5;
+    standby_counters_t counters = {0};
+    const streaminsync_sink_t sink = {
+        .decoder = "avdec_h264",
+        .request_keyframes = TRUE,
+        .video_cbs = {NULL, NULL, standby_new_sample},
+        .user_data = &counters,
+    };
+    int worst = 0;
+    int leaked = 0;
+
+    GstElement *sender = rtcp_sender_new(port, 300);
+    GstElement *branch;
+    GstElement *receiver = video_receiver_new(port, &sink, &branch);
+
+    if (sender == NULL || receiver == NULL || branch == NULL)
+    {
+        fprintf(stderr, "cannot create the pipelines\n");
+        return 1;
+    }
+
+    gst_element_set_state(sender, GST_STATE_PLAYING);
+    counters.ttff.started = g_get_monotonic_time();
+    gst_element_set_state(receiver, GST_STATE_PLAYING);
+
+    printf("%6s %12s %10s\n", "round", "standby", "resume");
+    printf("%6s %12s %7d ms\n", "join", "", wait_first_frame(&counters.ttff));
+
+    for (int round = 0; round < rounds; round++)
+    {
+        // Hidden for a while, somewhere in the 10 s GOP
+        streaminsync_branch_set_standby(branch, TRUE);
+        g_usleep(200 * 1000);
+        const gint before = g_atomic_int_get(&counters.frames);
+        g_usleep(g_random_int_range(1000, 4000) * 1000);
+        const gint during = g_atomic_int_get(&counters.frames) - before;
+
+        counters.ttff.started = g_get_monotonic_time();
+        g_atomic_int_set(&counters.ttff.done, FALSE);
+        streaminsync_branch_set_standby(branch, FALSE);
+
+        const int resume = wait_first_frame(&counters.ttff);
+
+        printf("%6d %6d frames %7d ms\n", round, during, resume);
+
+        leaked += during;
+        worst = resume < 0 || worst < 0 ? -1 : MAX(worst, resume);
+
+        g_usleep(G_USEC_PER_SEC);
+    }
+
+    gst_element_set_state(receiver, GST_STATE_NULL);
+    gst_element_set_state(sender, GST_STATE_NULL);
+    gst_object_unref(receiver);
+    gst_object_unref(sender);
+
+    // Nothing decoded while hidden, and back well before the next keyframe
+    if (leaked > 0 || worst < 0 || worst >= 1000)
+    {
+        printf("FAIL: %d frames decoded in standby, resumed after %d ms at worst\n", leaked, worst);
+        return 1;
+    }
+
+    printf("OK: resumed after %d ms at worst\n", worst);
+    return 0;
+}
+
+// Sender with ULPFEC as the real sender adds it, media packets and the bytes
+// before and after FEC are counted.
+typedef struct
+{
+    gint sent;
+    gint64 media_bytes;
+    gint64 total_bytes;
+    gint delivered;
+} fec_counters_t;
+
+static GstPadProbeReturn count_packets(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    g_atomic_int_inc((gint *)user_data);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn count_bytes(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    gint64 *bytes = user_data;
+
+    // Only touched from the sender's streaming thread
+    *bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_counter(GstElement *pipe, const char *name, const char *pad_name,
+                        GstPadProbeCallback callback, gpointer user_data)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipe), name);
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(element);
+}
+
+static GstElement *fec_sender_new(int port, int percentage, double drop, fec_counters_t *counters)
+{
+    gchar *desc = g_strdup_printf(
+        "videotestsrc is-live=true pattern=ball ! video/x-raw, width=640, height=360, framerate=30/1 ! "
+        "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=30 bitrate=1500 ! "
+        "rtph264pay name=pay pt=%d config-interval=-1 ! "
+        "rtpulpfecenc name=fec pt=%d percentage=%d multipacket=true ! "
+        "netsim drop-probability=%f ! udpsink host=127.0.0.1 port=%d",
+        STREAMINSYNC_VIDEO_PT, STREAMINSYNC_FEC_PT, percentage, drop, port);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    if (pipe == NULL)
+        return NULL;
+
+    add_counter(pipe, "pay", "src", count_packets, &counters->sent);
+    add_counter(pipe, "fec", "sink", count_bytes, &counters->media_bytes);
+    add_counter(pipe, "fec", "src", count_bytes, &counters->total_bytes);
+
+    return pipe;
+}
+
+static void link_counted_sink(GstElement *rtpbin, GstPad *pad, gpointer user_data)
+{
+    fec_counters_t *counters = user_data;
+    GstElement *pipe = GST_ELEMENT(gst_element_get_parent(rtpbin));
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+    GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+
+    g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(pipe), sink);
+    gst_element_sync_state_with_parent(sink);
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, count_packets, &counters->delivered, NULL);
+    gst_pad_link(pad, sinkpad);
+
+    gst_object_unref(sinkpad);
+    gst_object_unref(pipe);
+}
+
+// The receiving rtpbin of the streaminsync source, which recovers with
+// whatever FEC arrives.
+static GstElement *fec_receiver_new(int port, fec_counters_t *counters)
+{
+    GstElement *pipe = gst_pipeline_new(NULL);
+    GstElement *rtpbin = streaminsync_rtpbin_new(200);
+    GstElement *rtpsrc = gst_element_factory_make("udpsrc", NULL);
+    GstCaps *caps = streaminsync_rtp_caps(STREAMINSYNC_SESSION_VIDEO);
+
+    g_object_set(rtpsrc, "port", port, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    gst_element_set_name(rtpbin, "rtpbin");
+    gst_bin_add_many(GST_BIN(pipe), rtpbin, rtpsrc, NULL);
+    gst_element_link_pads(rtpsrc, "src", rtpbin, "recv_rtp_sink_0");
+    g_signal_connect(rtpbin, "pad-added", G_CALLBACK(link_counted_sink), counters);
+
+    return pipe;
+}
+
+static int test_fec(int port)
+{
+    static const int levels[] = {0, 10, 25, 50};
+    const double drop = 0.05;
+    const int seconds = 15;
+    double residual[G_N_ELEMENTS(levels)];
+
+    printf("%6s %10s %10s %10s %10s %10s\n", "level", "sent", "lost", "recovered", "residual", "overhead");
+
+    for (size_t i = 0; i < G_N_ELEMENTS(levels); i++)
+    {
+        fec_counters_t counters = {0};
+        streaminsync_stats_t stats = {0};
+
+        GstElement *receiver = fec_receiver_new(port, &counters);
+        GstElement *sender = fec_sender_new(port, levels[i], drop, &counters);
+
+        if (sender == NULL || receiver == NULL)
+        {
+            fprintf(stderr, "cannot create the pipelines\n");
+            return 1;
+        }
+
+        gst_element_set_state(receiver, GST_STATE_PLAYING);
+        gst_element_set_state(sender, GST_STATE_PLAYING);
+        g_usleep(seconds * G_USEC_PER_SEC);
+
+        // Let the receiver play out what is still in its buffer
+        gst_element_set_state(sender, GST_STATE_NULL);
+        g_usleep(G_USEC_PER_SEC);
+
+        GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(receiver), "rtpbin");
+        streaminsync_stats_rtp(rtpbin, G_MAXUINT, 0, &stats);
+        gst_object_unref(rtpbin);
+
+        gst_element_set_state(receiver, GST_STATE_NULL);
+        gst_object_unref(sender);
+        gst_object_unref(receiver);
+
+        const gint delivered = g_atomic_int_get(&counters.delivered);
+        residual[i] = counters.sent > 0 ? 100.0 * MAX(counters.sent - delivered, 0) / counters.sent : 100.0;
+        const double overhead = counters.media_bytes > 0
+                                    ? 100.0 * (counters.total_bytes - counters.media_bytes) / counters.media_bytes
+                                    : 0.0;
+
+        printf("%5d%% %10d %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %9.2f%% %9.1f%%\n",
+               levels[i], counters.sent, stats.lost, stats.recovered, residual[i], overhead);
+    }
+
+    // Any protection has to leave less loss than none
+    if (residual[G_N_ELEMENTS(levels) - 1] >= residual[0])
+    {
+        printf("FAIL: FEC does not reduce the loss\n");
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
+
+// What OBS would get from the audio branch, with or without stretching
+typedef struct
+{
+    streaminsync_stretch_t *stretch;
+    // Where the last buffer ended on the OBS timeline
+    guint64 next;
+    gint buffers;
+    gint glitches;
+    // Sum of the distances to the deadline, us
+    gint64 offset;
+} audio_score_t;
+
+static GstFlowReturn score_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    audio_score_t *score = user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    const guint64 due = streaminsync_playout_time(appsink, sample);
+    GstAudioInfo info;
+    GstMapInfo map;
+
+    if (due && gst_audio_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+        gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        guint32 frames = map.size / info.bpf;
+        guint64 timestamp = due;
+
+        if (score->stretch)
+        {
+            const gfloat *out;
+            frames = streaminsync_stretch_process(score->stretch, (const gfloat *)map.data, frames, info.rate,
+                                                  info.channels, due, &out, &timestamp);
+        }
+
+        // A gap or an overlap of more than a millisecond can be heard
+        const GstClockTimeDiff step = GST_CLOCK_DIFF(score->next, timestamp);
+        if (score->next && ABS(step) > GST_MSECOND)
+            score->glitches++;
+
+        score->next = timestamp + gst_util_uint64_scale(frames, GST_SECOND, info.rate);
+        score->offset += ABS(GST_CLOCK_DIFF(due, timestamp)) / GST_USECOND;
+        score->buffers++;
+
+        gst_buffer_unmap(buffer, &map);
+    }
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static GstElement *opus_sender_new(int port, double drop)
+{
+    gchar *desc = g_strdup_printf(
+        "audiotestsrc is-live=true wave=sine freq=440 ! audio/x-raw, rate=48000, channels=2 ! "
+        "opusenc inband-fec=true packet-loss-percentage=10 ! rtpopuspay pt=%d ! "
+        "netsim name=netsim drop-probability=%f ! udpsink host=127.0.0.1 port=%d",
+        STREAMINSYNC_AUDIO_PT, drop, port);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    return pipe;
+}
+
+// The receiving end of the streaminsync source, rtpbin and audio branch,
+// with the adaptive latency moving the deadlines around.
+static GstElement *opus_receiver_new(int port, gint latency, audio_score_t *score)
+{
+    const streaminsync_sink_t sink = {
+        .audio_cbs = {NULL, NULL, score_new_sample},
+        .user_data = score,
+    };
+
+    GstElement *pipe = gst_pipeline_new(NULL);
+    GstElement *rtpbin = streaminsync_rtpbin_new(latency);
+    GstElement *rtpsrc = gst_element_factory_make("udpsrc", NULL);
+    GstElement *branch = streaminsync_branch_new(STREAMINSYNC_SESSION_AUDIO, &sink);
+    GstCaps *caps = streaminsync_rtp_caps(STREAMINSYNC_SESSION_AUDIO);
+
+    g_object_set(rtpsrc, "port", port, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    gst_element_set_name(rtpbin, "rtpbin");
+    gst_bin_add_many(GST_BIN(pipe), rtpbin, rtpsrc, branch, NULL);
+    gst_element_link_pads(rtpsrc, "src", rtpbin, "recv_rtp_sink_1");
+    g_signal_connect(rtpbin, "pad-added", G_CALLBACK(link_branch), branch);
+
+    return pipe;
+}
+
+static int test_audio(int port)
+{
+    static const phase_t phases[] = {
+        {10, 0},
+        {20, 60},
+        {20, 150},
+        {20, 0},
+    };
+    static const char *const modes[] = {"deadline", "stretched"};
+    const streaminsync_latency_t config = {
+        .latency = 60,
+        .min = 20,
+        .max = 1000,
+        .adaptive = TRUE,
+    };
+    const double drop = 0.05;
+    audio_score_t scores[G_N_ELEMENTS(modes)] = {{0}};
+
+    printf("%10s %8s %10s %10s %8s %8s %10s\n", "mode", "seconds", "glitches", "offset", "lost", "recovered",
+           "stretched");
+
+    for (size_t m = 0; m < G_N_ELEMENTS(modes); m++)
+    {
+        audio_score_t *score = &scores[m];
+        streaminsync_stats_t stats = {0};
+        int seconds = 0;
+
+        score->stretch = m == 1 ? streaminsync_stretch_new() : NULL;
+
+        GstElement *sender = opus_sender_new(port, drop);
+        GstElement *receiver = opus_receiver_new(port, streaminsync_latency_initial(&config), score);
+
+        if (sender == NULL || receiver == NULL)
+        {
+            fprintf(stderr, "cannot create the pipelines\n");
+            return 1;
+        }
+
+        GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(receiver), "rtpbin");
+
+        streaminsync_latency_add(rtpbin, &config);
+
+        gst_element_set_state(receiver, GST_STATE_PLAYING);
+        gst_element_set_state(sender, GST_STATE_PLAYING);
+
+        for (size_t p = 0; p < G_N_ELEMENTS(phases); p++)
+        {
+            set_jitter(sender, phases[p].max_delay);
+            g_usleep(phases[p].seconds * G_USEC_PER_SEC);
+            seconds += phases[p].seconds;
+        }
+
+        streaminsync_stats_rtp(rtpbin, G_MAXUINT, 0, &stats);
+        streaminsync_latency_remove(rtpbin);
+
+        gst_element_set_state(sender, GST_STATE_NULL);
+        gst_element_set_state(receiver, GST_STATE_NULL);
+        gst_object_unref(rtpbin);
+        gst_object_unref(sender);
+        gst_object_unref(receiver);
+
+        const gint stretched = score->stretch ? streaminsync_stretch_count(score->stretch) : 0;
+
+        printf("%10s %8d %10d %7.1f ms %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %10d\n", modes[m], seconds,
+               score->glitches, score->buffers > 0 ? score->offset / 1000.0 / score->buffers : 0.0, stats.lost,
+               stats.recovered, stretched);
+
+        streaminsync_stretch_free(score->stretch);
+    }
+
+    const double offset = scores[1].buffers > 0 ? scores[1].offset / 1000.0 / scores[1].buffers : 0.0;
+
+    // Stretching has to take out the clicks without drifting off the
+    // deadline that keeps the sources in sync
+    if (scores[1].glitches >= MAX(scores[0].glitches, 1) || offset > 20.0)
+    {
+        printf("FAIL: %d glitches instead of %d, %.1f ms off the deadline\n", scores[1].glitches,
+               scores[0].glitches, offset);
+        return 1;
+    }
+
+    printf("OK: %d glitches instead of %d, %.1f ms off the deadline\n", scores[1].glitches, scores[0].glitches,
+           offset);
+    return 0;
+}
+
+// Sender like the real one with congestion control, a 3 Mbit/s video
+// stream of noise, which the encoder cannot make any smaller, through a
+// shaper named "shaper".
+static GstElement *twcc_sender_new(int port, bwe_t **bwe)
+{
+    gchar *desc = g_strdup_printf(
+        "rtpbin name=rtpbin rtp-profile=avpf "
+        "videotestsrc is-live=true pattern=snow ! video/x-raw, width=640, height=360, framerate=30/1 ! "
+        "x264enc name=venc tune=zerolatency speed-preset=ultrafast key-int-max=60 bitrate=3000 ! "
+        "rtph264pay name=pay pt=%d config-interval=-1 ! rtpbin.send_rtp_sink_0 "
+        "rtpbin.send_rtp_src_0 ! netsim name=shaper ! udpsink host=127.0.0.1 port=%d "
+        "rtpbin.send_rtcp_src_0 ! udpsink host=127.0.0.1 port=%d sync=false async=false "
+        "udpsrc port=%d ! rtpbin.recv_rtcp_sink_0",
+        STREAMINSYNC_VIDEO_PT, port, port + 1, port + 2);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    if (pipe == NULL)
+        return NULL;
+
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(pipe), "rtpbin");
+    GstElement *venc = gst_bin_get_by_name(GST_BIN(pipe), "venc");
+    GstElement *pay = gst_bin_get_by_name(GST_BIN(pipe), "pay");
+
+    *bwe = bwe_add_extension(pay) ? bwe_new(rtpbin, 0, venc, NULL, 200, 3000) : NULL;
+
+    gst_object_unref(rtpbin);
+    gst_object_unref(venc);
+    gst_object_unref(pay);
+
+    return pipe;
+}
+
+static GstFlowReturn drop_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    gst_sample_unref(gst_app_sink_pull_sample(appsink));
+
+    return GST_FLOW_OK;
+}
+
+static int test_congestion(int port)
+{
+    // Seconds and shaper limit in kbps, -1 for none
+    static const struct
+    {
+        int seconds;
+        int kbps;
+    } phases[] = {
+        {10, -1},
+        {30, 1000},
+        {30, -1},
+    };
+    const streaminsync_sink_t sink = {
+        .decoder = "avdec_h264",
+        .video_cbs = {NULL, NULL, drop_new_sample},
+    };
+    bwe_t *bwe = NULL;
+    GstElement *branch;
+
+    GstElement *sender = twcc_sender_new(port, &bwe);
+    GstElement *receiver = video_receiver_new(port, &sink, &branch);
+
+    if (sender == NULL || receiver == NULL || bwe == NULL)
+    {
+        fprintf(stderr, "cannot create the pipelines\n");
+        return 1;
+    }
+
+    GstElement *shaper = gst_bin_get_by_name(GST_BIN(sender), "shaper");
+
+    gst_element_set_state(receiver, GST_STATE_PLAYING);
+    gst_element_set_state(sender, GST_STATE_PLAYING);
+
+    bwe_report_t report = {0};
+    int limited = 0;
+    int recovered = 0;
+    int t = 0;
+
+    printf("%6s %8s %10s %8s %8s %10s\n", "time", "limit", "received", "lost", "trend", "video");
+
+    for (size_t p = 0; p < G_N_ELEMENTS(phases); p++)
+    {
+        g_object_set(shaper, "max-kbps", phases[p].kbps, NULL);
+
+        for (int s = 0; s < phases[p].seconds * 2; s++)
+        {
+            g_usleep(G_USEC_PER_SEC / 2);
+            bwe_update(bwe, &report);
+
+            if (s % 2)
+                printf("%6d %8d %10d %7.1f%% %5d us %10d\n", t++, phases[p].kbps, report.received_kbps,
+                       report.loss, report.delay_trend, report.video_kbps);
+        }
+
+        if (p == 1)
+            limited = report.video_kbps;
+        else if (p == 2)
+            recovered = report.video_kbps;
+    }
+
+    gst_element_set_state(sender, GST_STATE_NULL);
+    gst_element_set_state(receiver, GST_STATE_NULL);
+    bwe_free(bwe);
+    gst_object_unref(shaper);
+    gst_object_unref(sender);
+    gst_object_unref(receiver);
+
+    // Under the limit without starving the stream, and back up once the
+    // limit is gone
+    if (limited > phases[1].kbps || limited < phases[1].kbps / 3 || recovered < 2 * phases[1].kbps)
+    {
+        printf("FAIL: %d kbps under a %d kbps limit, %d kbps after\n", limited, phases[1].kbps, recovered);
+        return 1;
+    }
+
+    printf("OK: %d kbps under a %d kbps limit, %d kbps after\n", limited, phases[1].kbps, recovered);
+    return 0;
+}
+
+// Sender with two simulcast layers, 640x360 and 320x180, from one capture
+// and with RTCP like rtcp_sender_new().
+static GstElement *simulcast_sender_new(int port, int key_int_max)
+{
+    gchar *desc = g_strdup_printf(
+        "rtpbin name=rtpbin rtp-profile=avpf rtpfunnel name=funnel ! rtpbin.send_rtp_sink_0 "
+        "videotestsrc is-live=true pattern=ball ! video/x-raw, width=640, height=360, framerate=30/1 ! tee name=tee "
+        "tee. ! queue ! x264enc tune=zerolatency speed-preset=ultrafast key-int-max=%d ! "
+        "rtph264pay pt=%d config-interval=-1 ! funnel. "
+        "tee. ! queue ! videoscale ! video/x-raw, width=320, height=180 ! "
+        "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=%d ! "
+        "rtph264pay pt=%d config-interval=-1 ! funnel. "
+        "rtpbin.send_rtp_src_0 ! udpsink host=127.0.0.1 port=%d "
+        "rtpbin.send_rtcp_src_0 ! udpsink host=127.0.0.1 port=%d sync=false async=false "
+        "udpsrc port=%d ! rtpbin.recv_rtcp_sink_0",
+        key_int_max, STREAMINSYNC_LAYER_PT(0), key_int_max, STREAMINSYNC_LAYER_PT(1), port, port + 1, port + 2);
+    GstElement *pipe = gst_parse_launch(desc, NULL);
+    g_free(desc);
+
+    return pipe;
+}
+
+typedef struct
+{
+    ttff_t ttff;
+    // Height the switch is waited for at
+    gint height;
+} switch_t;
+
+static GstFlowReturn switch_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    switch_t *sw = user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    GstVideoInfo info;
+
+    if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+        info.height == g_atomic_int_get(&sw->height) && !g_atomic_int_get(&sw->ttff.done))
+    {
+        sw->ttff.first_frame = g_get_monotonic_time();
+        g_atomic_int_set(&sw->ttff.done, TRUE);
+    }
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static void link_layer(GstElement *rtpbin, GstPad *pad, gpointer user_data)
+{
+    GstElement *layers = user_data;
+    guint session, pt;
+    guint32 ssrc;
+
+    if (!streaminsync_parse_pad_name(GST_PAD_NAME(pad), &session, &ssrc, &pt))
+        return;
+
+    GstPad *sinkpad = streaminsync_layers_sink(layers, pt);
+    if (sinkpad && !gst_pad_is_linked(sinkpad))
+        gst_pad_link(pad, sinkpad);
+    if (sinkpad)
+        gst_object_unref(sinkpad);
+}
+
+static int test_simulcast(int port)
+{
+    static const gint heights[] = {360, 180};
+    const int rounds = 5;
+    switch_t sw = {{0}, heights[0]};
+    const streaminsync_sink_t sink = {
+        .decoder = "avdec_h264",
+        .request_keyframes = TRUE,
+        .video_cbs = {NULL, NULL, switch_new_sample},
+        .user_data = &sw,
+    };
+    int worst = 0;
+
+    GstElement *sender = simulcast_sender_new(port, 300);
+    GstElement *branch;
+    GstElement *receiver = video_receiver_new(port, &sink, &branch);
+    GstElement *layers = streaminsync_layers_new();
+
+    if (sender == NULL || receiver == NULL || branch == NULL || layers == NULL)
+    {
+        fprintf(stderr, "cannot create the pipelines\n");
+        return 1;
+    }
+
+    // The layers go in between rtpbin and the branch
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(receiver), "rtpbin");
+    g_signal_handlers_disconnect_by_func(rtpbin, link_branch, branch);
+    g_signal_connect(rtpbin, "pad-added", G_CALLBACK(link_layer), layers);
+    gst_bin_add(GST_BIN(receiver), layers);
+    gst_element_link(layers, branch);
+    gst_object_unref(rtpbin);
+
+    gst_element_set_state(sender, GST_STATE_PLAYING);
+    sw.ttff.started = g_get_monotonic_time();
+    gst_element_set_state(receiver, GST_STATE_PLAYING);
+
+    printf("%6s %8s %10s\n", "round", "height", "switch");
+    printf("%6s %8d %7d ms\n", "join", heights[0], wait_first_frame(&sw.ttff));
+
+    for (int round = 0; round < rounds * 2; round++)
+    {
+        const gint layer = (round + 1) % 2;
+
+        // Somewhere in the 10 s GOP of the layer switched to
+        g_usleep(g_random_int_range(1000, 3000) * 1000);
+
+        g_atomic_int_set(&sw.height, heights[layer]);
+        sw.ttff.started = g_get_monotonic_time();
+        g_atomic_int_set(&sw.ttff.done, FALSE);
+        streaminsync_layers_select(layers, layer);
+
+        const int time = wait_first_frame(&sw.ttff);
+
+        printf("%6d %8d %7d ms\n", round / 2, heights[layer], time);
+
+        worst = time < 0 || worst < 0 ? -1 : MAX(worst, time);
+    }
+
+    gst_element_set_state(receiver, GST_STATE_NULL);
+    gst_element_set_state(sender, GST_STATE_NULL);
+    gst_object_unref(receiver);
+    gst_object_unref(sender);
+
+    // Each switch asks for a keyframe, the GOP must not matter
+    if (worst < 0 || worst >= 1000)
+    {
+        printf("FAIL: switched after %d ms at worst\n", worst);
+        return 1;
+    }
+
+    printf("OK: switched after %d ms at worst\n", worst);
+    return 0;
+}
+
+static const struct
+{
+    const char *name;
+    int (*run)(int port);
+} tests[] = {
+    {"jitter", test_jitter},
+    {"keyframe", test_keyframe},
+    {"standby", test_standby},
+    {"fec", test_fec},
+    {"audio", test_audio},
+    {"congestion", test_congestion},
+    {"simulcast", test_simulcast},
+};
+
+int main(int argc, char **argv)
+{
+    const char *name = argc > 1 ? argv[1] : "";
+    int port = argc > 2 ? atoi(argv[2]) : 5500;
+
+    gst_init(&argc, &argv);
+
+    for (size_t i = 0; i < G_N_ELEMENTS(tests); i++)
+    {
+        if (strcmp(tests[i].name, name) != 0)
+            continue;
+
+        int ret = tests[i].run(port);
+
+        gstreamer_dispatcher_shutdown();
+        return ret;
+    }
+
+    fprintf(stderr, "usage: %s TEST [PORT]\n", argv[0]);
+    for (size_t i = 0; i < G_N_ELEMENTS(tests); i++)
+        fprintf(stderr, "  %s\n", tests[i].name);
+
+    return 1;
+}